@@ -48,6 +48,8 @@ stream-key=<your-mixer-key>
 #include <config.h>
 #endif
 
+#include "gstftlfec.h"
+#include "gstftlnalu.h"
 #include "gstftlsink.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_debug_ftl);
@@ -68,6 +70,14 @@ plugin_init (GstPlugin * plugin)
     return FALSE;
   }
 
+  gst_ftl_nalu_init ();
+  GST_INFO_OBJECT (plugin, "Using %s start code scanner",
+      gst_ftl_nalu_get_scanner_name ());
+
+  gst_ftl_fec_init ();
+  GST_INFO_OBJECT (plugin, "Using %s XOR for FEC",
+      gst_ftl_fec_get_xor_name ());
+
   if (!gst_element_register (plugin, "ftlsink",
           GST_RANK_NONE, GST_TYPE_FTL_SINK)) {
     return FALSE;
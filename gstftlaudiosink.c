@@ -35,10 +35,22 @@ GST_DEBUG_CATEGORY_STATIC (gst_ftl_audio_sink_debug_category);
 struct _GstFtlAudioSink
 {
   GstBaseSink parent_instance;
+
+  GstClockTime prepare_time;
+  /* Running times and mappings of the buffer list being rendered */
+  GArray *list_times;
+  GArray *list_maps;
 };
 
+static GstFlowReturn gst_ftl_audio_sink_prepare (GstBaseSink * sink,
+    GstBuffer * buffer);
 static GstFlowReturn gst_ftl_audio_sink_render (GstBaseSink * sink,
     GstBuffer * buffer);
+static GstFlowReturn gst_ftl_audio_sink_prepare_list (GstBaseSink * sink,
+    GstBufferList * list);
+static GstFlowReturn gst_ftl_audio_sink_render_list (GstBaseSink * sink,
+    GstBufferList * list);
+static void gst_ftl_audio_sink_finalize (GObject * object);
 
 /* pad templates */
 
@@ -56,6 +68,7 @@ G_DEFINE_TYPE (GstFtlAudioSink, gst_ftl_audio_sink, GST_TYPE_BASE_SINK);
 static void
 gst_ftl_audio_sink_class_init (GstFtlAudioSinkClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstBaseSinkClass *base_sink_class = GST_BASE_SINK_CLASS (klass);
 
   GST_DEBUG_CATEGORY_INIT (gst_ftl_audio_sink_debug_category, "ftlaudiosink", 0,
@@ -68,12 +81,51 @@ gst_ftl_audio_sink_class_init (GstFtlAudioSinkClass * klass)
   gst_element_class_add_static_pad_template (GST_ELEMENT_CLASS (klass),
       &gst_ftl_audio_sink_template);
 
+  gobject_class->finalize = gst_ftl_audio_sink_finalize;
+
+  base_sink_class->prepare = GST_DEBUG_FUNCPTR (gst_ftl_audio_sink_prepare);
   base_sink_class->render = GST_DEBUG_FUNCPTR (gst_ftl_audio_sink_render);
+  base_sink_class->prepare_list =
+      GST_DEBUG_FUNCPTR (gst_ftl_audio_sink_prepare_list);
+  base_sink_class->render_list =
+      GST_DEBUG_FUNCPTR (gst_ftl_audio_sink_render_list);
 }
 
 static void
 gst_ftl_audio_sink_init (GstFtlAudioSink * self)
 {
+  self->list_times = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  self->list_maps = g_array_new (FALSE, FALSE, sizeof (GstMapInfo));
+}
+
+static void
+gst_ftl_audio_sink_finalize (GObject * object)
+{
+  GstFtlAudioSink *self = GST_FTL_AUDIO_SINK (object);
+
+  g_array_free (self->list_times, TRUE);
+  g_array_free (self->list_maps, TRUE);
+
+  G_OBJECT_CLASS (gst_ftl_audio_sink_parent_class)->finalize (object);
+}
+
+/* Called before waiting for the clock */
+static GstFlowReturn
+gst_ftl_audio_sink_prepare (GstBaseSink * sink, GstBuffer * buffer)
+{
+  GstFtlAudioSink *self = GST_FTL_AUDIO_SINK (sink);
+
+  self->prepare_time = gst_util_get_timestamp ();
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_ftl_audio_sink_prepare_list (GstBaseSink * sink, GstBufferList * list)
+{
+  GstFtlAudioSink *self = GST_FTL_AUDIO_SINK (sink);
+
+  self->prepare_time = gst_util_get_timestamp ();
+  return GST_FLOW_OK;
 }
 
 static GstFlowReturn
@@ -82,12 +134,9 @@ gst_ftl_audio_sink_render (GstBaseSink * sink, GstBuffer * buffer)
   GstFtlAudioSink *self = GST_FTL_AUDIO_SINK (sink);
   GstFtlSink *parent = GST_FTL_SINK (GST_OBJECT_PARENT (self));
   GstClockTime time;
-  GstMapInfo map;
-  gint bytes_sent;
 
-  if (!gst_ftl_sink_connect (parent)) {
-    return GST_FLOW_ERROR;
-  }
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SYNC, FTL_AUDIO_DATA,
+      gst_util_get_timestamp () - self->prepare_time);
 
   time = GST_BUFFER_DTS_OR_PTS (buffer);
   if (!GST_CLOCK_TIME_IS_VALID (time)) {
@@ -98,19 +147,131 @@ gst_ftl_audio_sink_render (GstBaseSink * sink, GstBuffer * buffer)
 
   time = gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME, time);
 
-  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
-    GST_ERROR_OBJECT (self, "Failed to map %" GST_PTR_FORMAT, buffer);
-    return GST_FLOW_ERROR;
+  return gst_ftl_sink_send_buffer (parent, FTL_AUDIO_DATA, buffer, time);
+}
+
+static GstFlowReturn
+gst_ftl_audio_sink_render_list (GstBaseSink * sink, GstBufferList * list)
+{
+  GstFtlAudioSink *self = GST_FTL_AUDIO_SINK (sink);
+  GstFtlSink *parent = GST_FTL_SINK (GST_OBJECT_PARENT (self));
+  guint length = gst_buffer_list_length (list);
+
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SYNC, FTL_AUDIO_DATA,
+      gst_util_get_timestamp () - self->prepare_time);
+
+  g_array_set_size (self->list_times, length);
+
+  for (guint i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+    GstClockTime time = GST_BUFFER_DTS_OR_PTS (buffer);
+
+    if (!GST_CLOCK_TIME_IS_VALID (time)) {
+      GST_ELEMENT_ERROR (self, STREAM, FAILED,
+          ("Got buffer without timestamp"), ("%" GST_PTR_FORMAT, buffer));
+      return GST_FLOW_ERROR;
+    }
+
+    g_array_index (self->list_times, GstClockTime, i) =
+        gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME, time);
   }
 
+  return gst_ftl_sink_send_list (parent, FTL_AUDIO_DATA, list,
+      (const GstClockTime *) self->list_times->data);
+}
+
+static void
+gst_ftl_audio_sink_send_mapped (GstFtlAudioSink * self, GstFtlSink * parent,
+    const GstMapInfo * map, GstClockTime time)
+{
+  gint bytes_sent;
+  GstFtlCounters *counters;
+  GstClockTime start;
+  gint64 dts_usec = GST_TIME_AS_USECONDS (time);
+
   GST_LOG_OBJECT (self, "sending %" G_GSIZE_FORMAT " bytes at %"
-      GST_TIME_FORMAT, map.size, GST_TIME_ARGS (time));
+      GST_TIME_FORMAT, map->size, GST_TIME_ARGS (time));
 
-  bytes_sent = ftl_ingest_send_media_dts (gst_ftl_sink_get_handle (parent),
-      FTL_AUDIO_DATA, GST_TIME_AS_USECONDS (time), map.data, map.size, 1);
+  start = gst_util_get_timestamp ();
+  bytes_sent = gst_ftl_sink_send_media (parent,
+      gst_ftl_sink_get_handle (parent), FTL_AUDIO_DATA, dts_usec, map,
+      map->data, map->size, TRUE);
 
-  gst_buffer_unmap (buffer, &map);
+  for (guint i = 0; i < gst_ftl_sink_get_n_mirrors (parent); i++) {
+    GstFtlMirror *mirror = gst_ftl_sink_get_mirror (parent, i);
+    ftl_handle_t *handle = gst_ftl_mirror_begin_frame (mirror,
+        FTL_AUDIO_DATA, dts_usec, TRUE);
+
+    if (handle != NULL)
+      gst_ftl_mirror_end_frame (mirror, FTL_AUDIO_DATA, dts_usec,
+          ftl_ingest_send_media_dts (handle, FTL_AUDIO_DATA, dts_usec,
+              map->data, map->size, 1));
+  }
+
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SEND, FTL_AUDIO_DATA,
+      gst_util_get_timestamp () - start);
 
   GST_LOG_OBJECT (self, "sent %d bytes", bytes_sent);
+
+  counters = gst_ftl_sink_get_counters (parent);
+  gst_ftl_counters_inc (counters, GST_FTL_COUNTER_AUDIO_BUFFERS);
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_AUDIO_BYTES, bytes_sent);
+}
+
+/* Sends one Opus packet with the given running time. Called by ftlsink,
+ * either from render() or from its sender thread. */
+GstFlowReturn
+gst_ftl_audio_sink_send_buffer (GstFtlAudioSink * self, GstBuffer * buffer,
+    GstClockTime time)
+{
+  GstFtlSink *parent = GST_FTL_SINK (GST_OBJECT_PARENT (self));
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (self, "Failed to map %" GST_PTR_FORMAT, buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  gst_ftl_audio_sink_send_mapped (self, parent, &map, time);
+
+  gst_buffer_unmap (buffer, &map);
   return GST_FLOW_OK;
 }
+
+/* Sends every Opus packet of @list, with the running times in @times, in
+ * as few syscalls as the native transport manages. Called by ftlsink from
+ * render_list() while connected. */
+GstFlowReturn
+gst_ftl_audio_sink_send_list (GstFtlAudioSink * self, GstBufferList * list,
+    const GstClockTime * times)
+{
+  GstFtlSink *parent = GST_FTL_SINK (GST_OBJECT_PARENT (self));
+  guint length = gst_buffer_list_length (list);
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint mapped;
+
+  /* The transport holds on to the data until the batch goes out */
+  g_array_set_size (self->list_maps, length);
+  for (mapped = 0; mapped < length; mapped++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, mapped);
+
+    if (!gst_buffer_map (buffer, &g_array_index (self->list_maps, GstMapInfo,
+                mapped), GST_MAP_READ)) {
+      GST_ERROR_OBJECT (self, "Failed to map %" GST_PTR_FORMAT, buffer);
+      ret = GST_FLOW_ERROR;
+      break;
+    }
+  }
+
+  gst_ftl_sink_set_batching (parent, FTL_AUDIO_DATA, TRUE);
+  for (guint i = 0; i < mapped; i++)
+    gst_ftl_audio_sink_send_mapped (self, parent,
+        &g_array_index (self->list_maps, GstMapInfo, i), times[i]);
+  gst_ftl_sink_set_batching (parent, FTL_AUDIO_DATA, FALSE);
+
+  for (guint i = 0; i < mapped; i++)
+    gst_buffer_unmap (gst_buffer_list_get (list, i),
+        &g_array_index (self->list_maps, GstMapInfo, i));
+
+  return ret;
+}
@@ -31,6 +31,11 @@ G_BEGIN_DECLS
 #define GST_TYPE_FTL_AUDIO_SINK gst_ftl_audio_sink_get_type ()
 G_DECLARE_FINAL_TYPE (GstFtlAudioSink, gst_ftl_audio_sink, GST, FTL_AUDIO_SINK, GstBaseSink)
 
+GstFlowReturn gst_ftl_audio_sink_send_buffer (GstFtlAudioSink * self,
+    GstBuffer * buffer, GstClockTime time);
+GstFlowReturn gst_ftl_audio_sink_send_list (GstFtlAudioSink * self,
+    GstBufferList * list, const GstClockTime * times);
+
 #define GST_FTL_AUDIO_SINK_CAPS "audio/x-opus"
 
 G_END_DECLS
@@ -0,0 +1,73 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlcounters.h"
+
+/* Indexed by GstFtlCounter */
+static const gchar *const counter_names[GST_FTL_N_COUNTERS] = {
+  "video-buffers-total",
+  "video-keyframes-total",
+  "video-nalus-total",
+  "video-bytes-total",
+  "video-filler-dropped-total",
+  "video-sei-dropped-total",
+  "video-non-ref-dropped-total",
+  "video-idr-skips-total",
+  "video-frames-skipped-total",
+  "video-bytes-shed-total",
+  "video-bytes-copied-total",
+  "audio-buffers-total",
+  "audio-bytes-total",
+  "buffers-dropped-total",
+  "reconnects-total",
+  "transport-packets-total",
+  "transport-syscalls-total",
+  "transport-errors-total",
+  "transport-nacks-total",
+  "transport-nacks-too-late-total",
+  "transport-retransmits-total",
+  "transport-retransmit-evictions-total",
+  "transport-paced-frames-total",
+  "transport-fec-packets-total",
+};
+
+void
+gst_ftl_counters_reset (GstFtlCounters * counters)
+{
+  for (guint i = 0; i < GST_FTL_N_COUNTERS; i++)
+    __atomic_store_n (&counters->values[i], 0, __ATOMIC_RELAXED);
+}
+
+/* Every counter is read atomically, but not all at the same instant */
+void
+gst_ftl_counters_snapshot (GstFtlCounters * counters,
+    GstStructure * structure)
+{
+  for (guint i = 0; i < GST_FTL_N_COUNTERS; i++)
+    gst_structure_set (structure, counter_names[i], G_TYPE_UINT64,
+        __atomic_load_n (&counters->values[i], __ATOMIC_RELAXED), NULL);
+}
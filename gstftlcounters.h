@@ -0,0 +1,85 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_COUNTERS_H_
+#define _GST_FTL_COUNTERS_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  GST_FTL_COUNTER_VIDEO_BUFFERS,
+  GST_FTL_COUNTER_VIDEO_KEYFRAMES,
+  GST_FTL_COUNTER_VIDEO_NALUS,
+  GST_FTL_COUNTER_VIDEO_BYTES,
+  GST_FTL_COUNTER_VIDEO_FILLER_DROPPED,
+  GST_FTL_COUNTER_VIDEO_SEI_DROPPED,
+  GST_FTL_COUNTER_VIDEO_NON_REF_DROPPED,
+  GST_FTL_COUNTER_VIDEO_IDR_SKIPS,
+  GST_FTL_COUNTER_VIDEO_FRAMES_SKIPPED,
+  GST_FTL_COUNTER_VIDEO_BYTES_SHED,
+  GST_FTL_COUNTER_VIDEO_BYTES_COPIED,
+  GST_FTL_COUNTER_AUDIO_BUFFERS,
+  GST_FTL_COUNTER_AUDIO_BYTES,
+  GST_FTL_COUNTER_BUFFERS_DROPPED,
+  GST_FTL_COUNTER_RECONNECTS,
+  GST_FTL_COUNTER_TRANSPORT_PACKETS,
+  GST_FTL_COUNTER_TRANSPORT_SYSCALLS,
+  GST_FTL_COUNTER_TRANSPORT_ERRORS,
+  GST_FTL_COUNTER_TRANSPORT_NACKS,
+  GST_FTL_COUNTER_TRANSPORT_NACKS_TOO_LATE,
+  GST_FTL_COUNTER_TRANSPORT_RETRANSMITS,
+  GST_FTL_COUNTER_TRANSPORT_RTX_EVICTIONS,
+  GST_FTL_COUNTER_TRANSPORT_PACED_FRAMES,
+  GST_FTL_COUNTER_TRANSPORT_FEC_PACKETS,
+  GST_FTL_N_COUNTERS,
+} GstFtlCounter;
+
+/* Monotonic totals, updated from any thread without locking */
+typedef struct
+{
+  guint64 values[GST_FTL_N_COUNTERS];
+} GstFtlCounters;
+
+static inline void
+gst_ftl_counters_add (GstFtlCounters * counters, GstFtlCounter counter,
+    guint64 value)
+{
+  __atomic_fetch_add (&counters->values[counter], value, __ATOMIC_RELAXED);
+}
+
+static inline void
+gst_ftl_counters_inc (GstFtlCounters * counters, GstFtlCounter counter)
+{
+  gst_ftl_counters_add (counters, counter, 1);
+}
+
+void gst_ftl_counters_reset (GstFtlCounters * counters);
+void gst_ftl_counters_snapshot (GstFtlCounters * counters,
+    GstStructure * structure);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Process-wide dispatcher for periodic work of all ftlsinks, such as
+ * draining libftl's status queue and posting statistics.
+ *
+ * libftl can only wait for status messages on one handle at a time, so
+ * instead of a thread per element blocking in ftl_ingest_get_status(), a
+ * small fixed pool of threads calls every registered function once per
+ * DISPATCH_INTERVAL_MS and the functions poll without blocking. Each entry
+ * is always called from the same thread, so calls for one entry never
+ * overlap. A slow function delays the other entries of its thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftldispatcher.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_dispatcher_debug);
+#define GST_CAT_DEFAULT gst_ftl_dispatcher_debug
+
+#define DISPATCH_THREADS 2
+#define DISPATCH_INTERVAL_MS 50
+
+typedef struct
+{
+  GThread *thread;
+  GMutex lock;
+  /* Signalled when entries are added */
+  GCond cond;
+  /* Signalled when an entry has been called */
+  GCond idle_cond;
+
+  GPtrArray *entries;
+  /* Index of the entry being called, and the entry itself */
+  guint cursor;
+  GstFtlDispatchEntry *running;
+} GstFtlDispatchThread;
+
+struct _GstFtlDispatchEntry
+{
+  GstFtlDispatchFunc func;
+  gpointer user_data;
+  GstFtlDispatchThread *thread;
+};
+
+static GstFtlDispatchThread threads[DISPATCH_THREADS];
+
+static gpointer
+gst_ftl_dispatch_thread (gpointer user_data)
+{
+  GstFtlDispatchThread *thread = user_data;
+  gint64 next_time = 0;
+
+  g_mutex_lock (&thread->lock);
+
+  for (;;) {
+    gint64 now;
+
+    if (thread->entries->len == 0) {
+      g_cond_wait (&thread->cond, &thread->lock);
+      continue;
+    }
+
+    now = g_get_monotonic_time ();
+    if (now < next_time) {
+      g_cond_wait_until (&thread->cond, &thread->lock, next_time);
+      continue;
+    }
+
+    /* Don't try to catch up after falling behind */
+    next_time = MAX (next_time + DISPATCH_INTERVAL_MS * 1000, now);
+
+    /* Removing an entry adjusts the cursor, so nothing gets skipped */
+    for (thread->cursor = 0; thread->cursor < thread->entries->len;
+        thread->cursor++) {
+      GstFtlDispatchEntry *entry =
+          g_ptr_array_index (thread->entries, thread->cursor);
+
+      thread->running = entry;
+      g_mutex_unlock (&thread->lock);
+
+      entry->func (entry->user_data);
+
+      g_mutex_lock (&thread->lock);
+      thread->running = NULL;
+      g_cond_broadcast (&thread->idle_cond);
+    }
+  }
+
+  g_mutex_unlock (&thread->lock);
+  return NULL;
+}
+
+/* Starts the dispatch threads the first time an entry gets added, rather
+ * than in every process that loads the plugin */
+static void
+gst_ftl_dispatcher_start (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  GST_DEBUG_CATEGORY_INIT (gst_ftl_dispatcher_debug, "ftldispatcher", 0,
+      "debug category for the ftlsink status dispatcher");
+
+  for (guint i = 0; i < DISPATCH_THREADS; i++) {
+    GstFtlDispatchThread *thread = &threads[i];
+
+    g_mutex_init (&thread->lock);
+    g_cond_init (&thread->cond);
+    g_cond_init (&thread->idle_cond);
+    thread->entries = g_ptr_array_new ();
+    thread->thread = g_thread_new ("ftldispatch", gst_ftl_dispatch_thread,
+        thread);
+  }
+
+  GST_INFO ("Started %d dispatch threads, interval %d ms", DISPATCH_THREADS,
+      DISPATCH_INTERVAL_MS);
+  g_once_init_leave (&initialized, 1);
+}
+
+/* Calls @func periodically until the entry is removed. The first call
+ * happens on the next round of the thread it's assigned to. */
+GstFtlDispatchEntry *
+gst_ftl_dispatcher_add (GstFtlDispatchFunc func, gpointer user_data)
+{
+  GstFtlDispatchEntry *entry;
+  GstFtlDispatchThread *thread = &threads[0];
+
+  gst_ftl_dispatcher_start ();
+
+  /* The sizes only change under the locks, but a stale read merely makes
+   * the balance a little worse */
+  for (guint i = 1; i < DISPATCH_THREADS; i++)
+    if (g_atomic_int_get (&threads[i].entries->len) <
+        g_atomic_int_get (&thread->entries->len))
+      thread = &threads[i];
+
+  entry = g_new0 (GstFtlDispatchEntry, 1);
+  entry->func = func;
+  entry->user_data = user_data;
+  entry->thread = thread;
+
+  g_mutex_lock (&thread->lock);
+  g_ptr_array_add (thread->entries, entry);
+  g_cond_signal (&thread->cond);
+  g_mutex_unlock (&thread->lock);
+
+  GST_DEBUG ("Added entry %p to thread %u", entry, (guint) (thread - threads));
+  return entry;
+}
+
+/* Frees @entry. Once this returns, its function is not running and won't
+ * be called again. May be called from the entry's own function. */
+void
+gst_ftl_dispatcher_remove (GstFtlDispatchEntry * entry)
+{
+  GstFtlDispatchThread *thread = entry->thread;
+  guint index;
+
+  g_mutex_lock (&thread->lock);
+
+  if (thread->thread != g_thread_self ())
+    while (thread->running == entry)
+      g_cond_wait (&thread->idle_cond, &thread->lock);
+
+  for (index = 0; index < thread->entries->len; index++) {
+    if (g_ptr_array_index (thread->entries, index) != entry)
+      continue;
+
+    /* Wraps around for index 0, and the loop's increment brings it back */
+    g_ptr_array_remove_index (thread->entries, index);
+    if (index <= thread->cursor && thread->running != NULL)
+      thread->cursor--;
+    break;
+  }
+
+  g_mutex_unlock (&thread->lock);
+
+  GST_DEBUG ("Removed entry %p", entry);
+  g_free (entry);
+}
@@ -146,3 +146,48 @@ gst_ftl_bitrate_changed_reason_get_nick (ftl_bitrate_changed_reason_t value)
       return "<unknown>";
   }
 }
+
+GType
+gst_ftl_nal_drop_flags_get_type (void)
+{
+  static const GFlagsValue values[] = {
+    {GST_FTL_NAL_DROP_FILLER, "Strip filler data NALUs", "filler"},
+    {GST_FTL_NAL_DROP_SEI, "Strip SEI NALUs that carry only optional "
+          "messages", "sei"},
+    {GST_FTL_NAL_DROP_NON_REFERENCE, "Drop non-reference slices above "
+          "nal-drop-threshold", "non-reference"},
+    {GST_FTL_NAL_DROP_SKIP_TO_IDR, "Skip to the next keyframe above "
+          "nal-skip-threshold", "skip-to-idr"},
+    {0, NULL, NULL},
+  };
+  static gsize id = 0;
+
+  if (g_once_init_enter (&id)) {
+    GType type = g_flags_register_static ("GstFtlNalDropFlags", values);
+    g_once_init_leave (&id, type);
+  }
+
+  return id;
+}
+
+GType
+gst_ftl_transport_mode_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_FTL_TRANSPORT_LIBFTL, "Let libftl packetize and send media",
+        "libftl"},
+    {GST_FTL_TRANSPORT_SENDMMSG, "Packetize natively, send each frame "
+          "with sendmmsg()", "sendmmsg"},
+    {GST_FTL_TRANSPORT_GSO, "Packetize natively, send each frame with "
+          "UDP segmentation offload", "gso"},
+    {0, NULL, NULL},
+  };
+  static gsize id = 0;
+
+  if (g_once_init_enter (&id)) {
+    GType type = g_enum_register_static ("GstFtlTransportMode", values);
+    g_once_init_leave (&id, type);
+  }
+
+  return id;
+}
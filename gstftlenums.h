@@ -29,6 +29,27 @@
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  GST_FTL_NAL_DROP_FILLER = (1 << 0),
+  GST_FTL_NAL_DROP_SEI = (1 << 1),
+  GST_FTL_NAL_DROP_NON_REFERENCE = (1 << 2),
+  GST_FTL_NAL_DROP_SKIP_TO_IDR = (1 << 3),
+} GstFtlNalDropFlags;
+
+#define GST_TYPE_FTL_NAL_DROP_FLAGS (gst_ftl_nal_drop_flags_get_type ())
+GType gst_ftl_nal_drop_flags_get_type (void);
+
+typedef enum
+{
+  GST_FTL_TRANSPORT_LIBFTL,
+  GST_FTL_TRANSPORT_SENDMMSG,
+  GST_FTL_TRANSPORT_GSO,
+} GstFtlTransportMode;
+
+#define GST_TYPE_FTL_TRANSPORT_MODE (gst_ftl_transport_mode_get_type ())
+GType gst_ftl_transport_mode_get_type (void);
+
 GstDebugLevel gst_ftl_log_severity_to_level (ftl_log_severity_t value);
 const gchar * gst_ftl_status_type_get_nick (ftl_status_types_t value);
 const gchar * gst_ftl_status_event_type_get_nick (ftl_status_event_types_t value);
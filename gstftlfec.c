@@ -0,0 +1,328 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * XOR parity for video packets, in the ULPFEC format of RFC 5109.
+ *
+ * A group of up to GST_FTL_FEC_MAX_GROUP_SIZE consecutive packets gets
+ * one parity packet with a single protection level covering the whole
+ * payloads, so a receiver can rebuild any one packet of the group without
+ * asking for it again. The XOR runs over every payload byte sent, so it
+ * picks the widest vector unit the CPU has, like the start code scanner.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlfec.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define RTP_HEADER_SIZE 12
+
+static void
+xor_scalar (guint8 * dst, const guint8 * src, gsize size)
+{
+  gsize pos = 0;
+
+  for (; pos + 8 <= size; pos += 8) {
+    guint64 a, b;
+
+    memcpy (&a, dst + pos, 8);
+    memcpy (&b, src + pos, 8);
+    a ^= b;
+    memcpy (dst + pos, &a, 8);
+  }
+
+  for (; pos < size; pos++)
+    dst[pos] ^= src[pos];
+}
+
+static gboolean
+xor_always_supported (void)
+{
+  return TRUE;
+}
+
+#if defined(__x86_64__)
+
+static void
+xor_sse2 (guint8 * dst, const guint8 * src, gsize size)
+{
+  gsize pos = 0;
+
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (dst + pos));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (src + pos));
+
+    _mm_storeu_si128 ((__m128i *) (dst + pos), _mm_xor_si128 (a, b));
+  }
+
+  xor_scalar (dst + pos, src + pos, size - pos);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+xor_avx2 (guint8 * dst, const guint8 * src, gsize size)
+{
+  gsize pos = 0;
+
+  for (; pos + 32 <= size; pos += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (dst + pos));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (src + pos));
+
+    _mm256_storeu_si256 ((__m256i *) (dst + pos), _mm256_xor_si256 (a, b));
+  }
+
+  xor_sse2 (dst + pos, src + pos, size - pos);
+}
+
+static gboolean
+xor_avx2_supported (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2");
+}
+
+#elif defined(__aarch64__)
+
+static void
+xor_neon (guint8 * dst, const guint8 * src, gsize size)
+{
+  gsize pos = 0;
+
+  for (; pos + 16 <= size; pos += 16)
+    vst1q_u8 (dst + pos, veorq_u8 (vld1q_u8 (dst + pos),
+            vld1q_u8 (src + pos)));
+
+  xor_scalar (dst + pos, src + pos, size - pos);
+}
+
+static gboolean
+xor_neon_supported (void)
+{
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+  return (getauxval (AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+  return TRUE;
+#endif
+}
+
+#endif
+
+/* Ordered from most to least preferred */
+static const GstFtlFecXorImpl xor_impls[] = {
+#if defined(__x86_64__)
+  {"avx2", xor_avx2, xor_avx2_supported},
+  {"sse2", xor_sse2, xor_always_supported},
+#elif defined(__aarch64__)
+  {"neon", xor_neon, xor_neon_supported},
+#endif
+  {"scalar", xor_scalar, xor_always_supported},
+};
+
+static const GstFtlFecXorImpl *active_xor =
+    &xor_impls[G_N_ELEMENTS (xor_impls) - 1];
+
+void
+gst_ftl_fec_init (void)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (xor_impls); i++) {
+    if (xor_impls[i].supported ()) {
+      active_xor = &xor_impls[i];
+      break;
+    }
+  }
+}
+
+const gchar *
+gst_ftl_fec_get_xor_name (void)
+{
+  return active_xor->name;
+}
+
+const GstFtlFecXorImpl *
+gst_ftl_fec_get_xor_impls (guint * n_impls)
+{
+  *n_impls = G_N_ELEMENTS (xor_impls);
+  return xor_impls;
+}
+
+void
+gst_ftl_fec_xor (guint8 * dst, const guint8 * src, gsize size)
+{
+  active_xor->xor (dst, src, size);
+}
+
+static inline guint16
+read_uint16 (const guint8 * data)
+{
+  return (data[0] << 8) | data[1];
+}
+
+static inline void
+write_uint16 (guint8 * data, guint16 value)
+{
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+void
+gst_ftl_fec_group_reset (GstFtlFecGroup * group)
+{
+  group->n_packets = 0;
+  group->protection_length = 0;
+  memset (group->data, 0, GST_FTL_FEC_HEADER_SIZE);
+}
+
+/* Adds a packet to the group. @header is its RTP header, followed by
+ * whatever header bytes of the payload (such as FU-A) are not in
+ * @payload. The group must have room for it. */
+void
+gst_ftl_fec_group_add (GstFtlFecGroup * group, const guint8 * header,
+    gsize header_size, const guint8 * payload, gsize payload_size)
+{
+  guint8 *level = group->data + GST_FTL_FEC_HEADER_SIZE;
+  gsize extra = header_size - RTP_HEADER_SIZE;
+  gsize length = extra + payload_size;
+
+  g_return_if_fail (group->n_packets < GST_FTL_FEC_MAX_GROUP_SIZE);
+  g_return_if_fail (length <= GST_FTL_FEC_MAX_PROTECTED_SIZE);
+
+  if (group->n_packets == 0)
+    group->seq_base = read_uint16 (header + 2);
+  group->n_packets++;
+
+  /* P, X, CC, M and PT, then the timestamp */
+  group->data[0] ^= header[0] & 0x3f;
+  group->data[1] ^= header[1];
+  gst_ftl_fec_xor (group->data + 4, header + 4, 4);
+  group->data[8] ^= length >> 8;
+  group->data[9] ^= length;
+
+  /* Shorter packets count as padded with zeros */
+  if (length > group->protection_length) {
+    memset (level + group->protection_length, 0,
+        length - group->protection_length);
+    group->protection_length = length;
+  }
+
+  gst_ftl_fec_xor (level, header + RTP_HEADER_SIZE, extra);
+  gst_ftl_fec_xor (level + extra, payload, payload_size);
+}
+
+/* Completes the FEC header. Returns the size of the FEC packet's payload
+ * in group->data. */
+gsize
+gst_ftl_fec_group_finish (GstFtlFecGroup * group)
+{
+  guint16 mask = 0;
+
+  for (guint i = 0; i < group->n_packets; i++)
+    mask |= 0x8000 >> i;
+
+  write_uint16 (group->data + 2, group->seq_base);
+  write_uint16 (group->data + 10, group->protection_length);
+  write_uint16 (group->data + 12, mask);
+
+  return GST_FTL_FEC_HEADER_SIZE + group->protection_length;
+}
+
+/* Reads which packets the FEC payload @fec protects. Only understands
+ * what gst_ftl_fec_group_finish() writes. */
+gboolean
+gst_ftl_fec_parse (const guint8 * fec, gsize size, guint16 * seq_base,
+    guint16 * mask)
+{
+  /* E and L are unset */
+  if (size < GST_FTL_FEC_HEADER_SIZE || (fec[0] & 0xc0) != 0 ||
+      GST_FTL_FEC_HEADER_SIZE + read_uint16 (fec + 10) > size)
+    return FALSE;
+
+  *seq_base = read_uint16 (fec + 2);
+  *mask = read_uint16 (fec + 12);
+  return TRUE;
+}
+
+/* Rebuilds packet @seq of the group protected by @fec from the
+ * @n_packets others. @packet needs room for RTP_HEADER_SIZE +
+ * GST_FTL_FEC_MAX_PROTECTED_SIZE bytes. */
+gboolean
+gst_ftl_fec_recover (const guint8 * fec, gsize fec_size,
+    const guint8 * const *packets, const gsize * sizes, guint n_packets,
+    guint16 seq, guint32 ssrc, guint8 * packet, gsize * packet_size)
+{
+  gsize protection_length, length;
+  guint8 *payload = packet + RTP_HEADER_SIZE;
+
+  if (fec_size < GST_FTL_FEC_HEADER_SIZE)
+    return FALSE;
+
+  protection_length = read_uint16 (fec + 10);
+  if (GST_FTL_FEC_HEADER_SIZE + protection_length > fec_size ||
+      protection_length > GST_FTL_FEC_MAX_PROTECTED_SIZE)
+    return FALSE;
+
+  memcpy (packet, fec, 10);
+  memcpy (payload, fec + GST_FTL_FEC_HEADER_SIZE, protection_length);
+
+  for (guint i = 0; i < n_packets; i++) {
+    gsize size = sizes[i] - RTP_HEADER_SIZE;
+
+    if (sizes[i] < RTP_HEADER_SIZE || size > protection_length)
+      return FALSE;
+
+    packet[0] ^= packets[i][0];
+    packet[1] ^= packets[i][1];
+    gst_ftl_fec_xor (packet + 4, packets[i] + 4, 4);
+    packet[8] ^= size >> 8;
+    packet[9] ^= size;
+    gst_ftl_fec_xor (payload, packets[i] + RTP_HEADER_SIZE, size);
+  }
+
+  length = read_uint16 (packet + 8);
+  if (length > protection_length)
+    return FALSE;
+
+  packet[0] = 0x80 | (packet[0] & 0x3f);
+  write_uint16 (packet + 2, seq);
+  packet[8] = ssrc >> 24;
+  packet[9] = ssrc >> 16;
+  packet[10] = ssrc >> 8;
+  packet[11] = ssrc;
+
+  *packet_size = RTP_HEADER_SIZE + length;
+  return TRUE;
+}
@@ -0,0 +1,83 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _GST_FTL_FEC_H_
+#define _GST_FTL_FEC_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Not used by FTL itself, ingests that don't know it drop the packets */
+#define GST_FTL_FEC_PAYLOAD_TYPE 98
+
+/* RFC 5109 FEC header plus one level 0 header with a short mask */
+#define GST_FTL_FEC_HEADER_SIZE 14
+/* Packets the short mask can cover */
+#define GST_FTL_FEC_MAX_GROUP_SIZE 16
+/* Largest RTP payload a group can protect */
+#define GST_FTL_FEC_MAX_PROTECTED_SIZE 1500
+
+/* XORs @size bytes of @src into @dst */
+typedef void (*GstFtlFecXorFunc) (guint8 * dst, const guint8 * src,
+    gsize size);
+
+typedef struct
+{
+  const gchar *name;
+  GstFtlFecXorFunc xor;
+  gboolean (*supported) (void);
+} GstFtlFecXorImpl;
+
+/* The parity of a group of consecutive RTP packets of one stream, each
+ * with a plain 12 byte header, while it is being built */
+typedef struct
+{
+  guint16 seq_base;
+  guint n_packets;
+  gsize protection_length;
+  /* FEC header and level 0 payload */
+  guint8 data[GST_FTL_FEC_HEADER_SIZE + GST_FTL_FEC_MAX_PROTECTED_SIZE];
+} GstFtlFecGroup;
+
+void gst_ftl_fec_init (void);
+const gchar * gst_ftl_fec_get_xor_name (void);
+const GstFtlFecXorImpl * gst_ftl_fec_get_xor_impls (guint * n_impls);
+
+void gst_ftl_fec_xor (guint8 * dst, const guint8 * src, gsize size);
+
+void gst_ftl_fec_group_reset (GstFtlFecGroup * group);
+void gst_ftl_fec_group_add (GstFtlFecGroup * group, const guint8 * header,
+    gsize header_size, const guint8 * payload, gsize payload_size);
+gsize gst_ftl_fec_group_finish (GstFtlFecGroup * group);
+
+gboolean gst_ftl_fec_parse (const guint8 * fec, gsize size,
+    guint16 * seq_base, guint16 * mask);
+gboolean gst_ftl_fec_recover (const guint8 * fec, gsize fec_size,
+    const guint8 * const *packets, const gsize * sizes, guint n_packets,
+    guint16 seq, guint32 ssrc, guint8 * packet, gsize * packet_size);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Holds the buffers that couldn't be sent yet, always starting at the
+ * most recent video keyframe so that whatever gets sent first is
+ * decodable. Audio older than that keyframe is dropped as well.
+ *
+ * When retaining, buffers stay cached after being taken for sending, so
+ * the whole GOP can be replayed after a reconnect.
+ *
+ * Not thread-safe; ftlsink serializes access.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlgopcache.h"
+
+struct _GstFtlGopCache
+{
+  /* Indexed by ftl_media_type_t */
+  GQueue items[2];
+  /* First item not taken yet, NULL if there is none */
+  GList *unsent[2];
+
+  gsize bytes;
+  gboolean retain;
+  gsize max_bytes;
+
+  gboolean have_keyframe;
+  GstClockTime keyframe_time;
+};
+
+GstFtlGopCache *
+gst_ftl_gop_cache_new (void)
+{
+  GstFtlGopCache *cache = g_new0 (GstFtlGopCache, 1);
+
+  g_queue_init (&cache->items[FTL_AUDIO_DATA]);
+  g_queue_init (&cache->items[FTL_VIDEO_DATA]);
+  cache->keyframe_time = GST_CLOCK_TIME_NONE;
+
+  return cache;
+}
+
+void
+gst_ftl_gop_cache_free (GstFtlGopCache * cache)
+{
+  gst_ftl_gop_cache_clear (cache);
+  g_free (cache);
+}
+
+void
+gst_ftl_gop_cache_set_max_bytes (GstFtlGopCache * cache, gsize max_bytes)
+{
+  cache->max_bytes = max_bytes;
+}
+
+void
+gst_ftl_gop_cache_set_retain (GstFtlGopCache * cache, gboolean retain)
+{
+  cache->retain = retain;
+}
+
+gboolean
+gst_ftl_gop_cache_has_keyframe (GstFtlGopCache * cache)
+{
+  return cache->have_keyframe;
+}
+
+void
+gst_ftl_gop_cache_item_free (GstFtlGopCacheItem * item)
+{
+  gst_buffer_unref (item->buffer);
+  g_free (item);
+}
+
+static void
+gst_ftl_gop_cache_clear_media (GstFtlGopCache * cache,
+    ftl_media_type_t media_type)
+{
+  GstFtlGopCacheItem *item;
+
+  while ((item = g_queue_pop_head (&cache->items[media_type])) != NULL) {
+    cache->bytes -= gst_buffer_get_size (item->buffer);
+    gst_ftl_gop_cache_item_free (item);
+  }
+  cache->unsent[media_type] = NULL;
+}
+
+void
+gst_ftl_gop_cache_clear (GstFtlGopCache * cache)
+{
+  gst_ftl_gop_cache_clear_media (cache, FTL_AUDIO_DATA);
+  gst_ftl_gop_cache_clear_media (cache, FTL_VIDEO_DATA);
+  cache->have_keyframe = FALSE;
+  cache->keyframe_time = GST_CLOCK_TIME_NONE;
+}
+
+/* Starts over at a new keyframe, keeping audio that isn't older */
+static void
+gst_ftl_gop_cache_restart (GstFtlGopCache * cache, GstClockTime time)
+{
+  GQueue *audio = &cache->items[FTL_AUDIO_DATA];
+  GstFtlGopCacheItem *item;
+
+  gst_ftl_gop_cache_clear_media (cache, FTL_VIDEO_DATA);
+
+  while ((item = g_queue_peek_head (audio)) != NULL && item->time < time) {
+    if (cache->unsent[FTL_AUDIO_DATA] == audio->head)
+      cache->unsent[FTL_AUDIO_DATA] = audio->head->next;
+    g_queue_pop_head (audio);
+    cache->bytes -= gst_buffer_get_size (item->buffer);
+    gst_ftl_gop_cache_item_free (item);
+  }
+
+  cache->have_keyframe = TRUE;
+  cache->keyframe_time = time;
+}
+
+/* Returns FALSE if @buffer was not cached because it can't be decoded
+ * without data the cache no longer has */
+gboolean
+gst_ftl_gop_cache_push (GstFtlGopCache * cache, ftl_media_type_t media_type,
+    GstBuffer * buffer, GstClockTime time)
+{
+  GstFtlGopCacheItem *item;
+  gsize size = gst_buffer_get_size (buffer);
+
+  if (media_type == FTL_VIDEO_DATA &&
+      !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    gst_ftl_gop_cache_restart (cache, time);
+
+  if (!cache->have_keyframe)
+    return FALSE;
+
+  if (media_type == FTL_AUDIO_DATA && time < cache->keyframe_time)
+    return FALSE;
+
+  /* Out of space, wait for the next keyframe */
+  if (cache->bytes + size > cache->max_bytes) {
+    gst_ftl_gop_cache_clear (cache);
+    return FALSE;
+  }
+
+  item = g_new (GstFtlGopCacheItem, 1);
+  item->buffer = gst_buffer_ref (buffer);
+  item->time = time;
+
+  g_queue_push_tail (&cache->items[media_type], item);
+  if (cache->unsent[media_type] == NULL)
+    cache->unsent[media_type] = cache->items[media_type].tail;
+  cache->bytes += size;
+  return TRUE;
+}
+
+/* Moves all items of @media_type that weren't taken before to @items,
+ * oldest first. When retaining, @items gets new references instead. */
+void
+gst_ftl_gop_cache_take (GstFtlGopCache * cache, ftl_media_type_t media_type,
+    GQueue * items)
+{
+  GstFtlGopCacheItem *item, *copy;
+  GList *l;
+
+  if (!cache->retain) {
+    while ((item = g_queue_pop_head (&cache->items[media_type])) != NULL) {
+      cache->bytes -= gst_buffer_get_size (item->buffer);
+      g_queue_push_tail (items, item);
+    }
+    cache->unsent[media_type] = NULL;
+
+    /* The connection gets that keyframe now. Later deltas can't be cached
+     * against it, they would reach the next connection without it. */
+    if (media_type == FTL_VIDEO_DATA) {
+      cache->have_keyframe = FALSE;
+      cache->keyframe_time = GST_CLOCK_TIME_NONE;
+    }
+    return;
+  }
+
+  for (l = cache->unsent[media_type]; l != NULL; l = l->next) {
+    item = l->data;
+    copy = g_new (GstFtlGopCacheItem, 1);
+    copy->buffer = gst_buffer_ref (item->buffer);
+    copy->time = item->time;
+    g_queue_push_tail (items, copy);
+  }
+  cache->unsent[media_type] = NULL;
+}
+
+/* Makes everything retained available to take again */
+void
+gst_ftl_gop_cache_rewind (GstFtlGopCache * cache)
+{
+  cache->unsent[FTL_AUDIO_DATA] = cache->items[FTL_AUDIO_DATA].head;
+  cache->unsent[FTL_VIDEO_DATA] = cache->items[FTL_VIDEO_DATA].head;
+}
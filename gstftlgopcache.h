@@ -0,0 +1,57 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_GOP_CACHE_H_
+#define _GST_FTL_GOP_CACHE_H_
+
+#include <gst/gst.h>
+#include "ftl.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstFtlGopCache GstFtlGopCache;
+
+typedef struct
+{
+  GstBuffer *buffer;
+  GstClockTime time;
+} GstFtlGopCacheItem;
+
+GstFtlGopCache * gst_ftl_gop_cache_new (void);
+void gst_ftl_gop_cache_free (GstFtlGopCache * cache);
+
+void gst_ftl_gop_cache_set_max_bytes (GstFtlGopCache * cache, gsize max_bytes);
+void gst_ftl_gop_cache_set_retain (GstFtlGopCache * cache, gboolean retain);
+gboolean gst_ftl_gop_cache_has_keyframe (GstFtlGopCache * cache);
+gboolean gst_ftl_gop_cache_push (GstFtlGopCache * cache,
+    ftl_media_type_t media_type, GstBuffer * buffer, GstClockTime time);
+void gst_ftl_gop_cache_take (GstFtlGopCache * cache,
+    ftl_media_type_t media_type, GQueue * items);
+void gst_ftl_gop_cache_rewind (GstFtlGopCache * cache);
+void gst_ftl_gop_cache_clear (GstFtlGopCache * cache);
+
+void gst_ftl_gop_cache_item_free (GstFtlGopCacheItem * item);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlhistogram.h"
+
+#define SUB_BUCKETS (1 << GST_FTL_HISTOGRAM_SUB_BUCKET_BITS)
+
+static guint
+bucket_index (guint64 value)
+{
+  guint shift;
+
+  if (value < SUB_BUCKETS)
+    return value;
+
+  /* Keep the top SUB_BUCKET_BITS + 1 bits of value */
+  shift = 63 - __builtin_clzll (value) - GST_FTL_HISTOGRAM_SUB_BUCKET_BITS;
+  return ((shift + 1) << GST_FTL_HISTOGRAM_SUB_BUCKET_BITS) +
+      ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* Middle of the range covered by bucket @index */
+static guint64
+bucket_value (guint index)
+{
+  guint shift;
+  guint64 lower;
+
+  if (index < SUB_BUCKETS)
+    return index;
+
+  shift = (index >> GST_FTL_HISTOGRAM_SUB_BUCKET_BITS) - 1;
+  lower = (guint64) (SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift;
+  return lower + (((G_GUINT64_CONSTANT (1) << shift) - 1) >> 1);
+}
+
+void
+gst_ftl_histogram_record (GstFtlHistogram * histogram, GstClockTime value)
+{
+  __atomic_fetch_add (&histogram->buckets[bucket_index (value)], 1,
+      __ATOMIC_RELAXED);
+}
+
+void
+gst_ftl_histogram_reset (GstFtlHistogram * histogram)
+{
+  for (guint i = 0; i < GST_FTL_HISTOGRAM_N_BUCKETS; i++)
+    __atomic_store_n (&histogram->buckets[i], 0, __ATOMIC_RELAXED);
+}
+
+static GstClockTime
+percentile (const guint32 * buckets, guint64 count, guint64 per_mille)
+{
+  guint64 rank = MAX ((count * per_mille + 999) / 1000, 1);
+  guint64 seen = 0;
+
+  for (guint i = 0; i < GST_FTL_HISTOGRAM_N_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return bucket_value (i);
+  }
+
+  return GST_CLOCK_TIME_NONE;
+}
+
+/* Returns the distribution recorded since the last call and starts over.
+ * Values recorded meanwhile end up in either interval. */
+GstStructure *
+gst_ftl_histogram_take (GstFtlHistogram * histogram, const gchar * name)
+{
+  guint32 buckets[GST_FTL_HISTOGRAM_N_BUCKETS];
+  GstClockTime max = 0;
+  guint64 count = 0;
+  GstStructure *structure;
+
+  for (guint i = 0; i < GST_FTL_HISTOGRAM_N_BUCKETS; i++) {
+    buckets[i] = __atomic_exchange_n (&histogram->buckets[i], 0,
+        __ATOMIC_RELAXED);
+    if (buckets[i] > 0) {
+      count += buckets[i];
+      max = bucket_value (i);
+    }
+  }
+
+  structure = gst_structure_new (name, "count", G_TYPE_UINT64, count, NULL);
+
+  if (count > 0)
+    gst_structure_set (structure,
+        "p50", GST_TYPE_CLOCK_TIME, percentile (buckets, count, 500),
+        "p99", GST_TYPE_CLOCK_TIME, percentile (buckets, count, 990),
+        "p999", GST_TYPE_CLOCK_TIME, percentile (buckets, count, 999),
+        "max", GST_TYPE_CLOCK_TIME, max, NULL);
+
+  return structure;
+}
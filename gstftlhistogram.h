@@ -0,0 +1,52 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_HISTOGRAM_H_
+#define _GST_FTL_HISTOGRAM_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* 8 sub-buckets for each power of two up to 2^63 ns */
+#define GST_FTL_HISTOGRAM_SUB_BUCKET_BITS 3
+#define GST_FTL_HISTOGRAM_N_BUCKETS \
+    ((64 - GST_FTL_HISTOGRAM_SUB_BUCKET_BITS + 1) << \
+        GST_FTL_HISTOGRAM_SUB_BUCKET_BITS)
+
+/* Log-bucketed histogram of durations, recorded without locking. Values
+ * are reported with an error of at most 1/16. */
+typedef struct
+{
+  guint32 buckets[GST_FTL_HISTOGRAM_N_BUCKETS];
+} GstFtlHistogram;
+
+void gst_ftl_histogram_record (GstFtlHistogram * histogram,
+    GstClockTime value);
+void gst_ftl_histogram_reset (GstFtlHistogram * histogram);
+GstStructure * gst_ftl_histogram_take (GstFtlHistogram * histogram,
+    const gchar * name);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * An additional ingest that receives a copy of everything ftlsink sends.
+ *
+ * Each mirror owns its own libftl handle and a thread that connects,
+ * watches the connection and reconnects with backoff for as long as the
+ * element runs. Failures stay local to the mirror: they are logged and
+ * counted, but never fail the element.
+ *
+ * The streaming threads check out the handle for one frame at a time with
+ * gst_ftl_mirror_begin_frame(), which skips mirrors that are not connected
+ * and keeps video back until the next keyframe after each (re)connect.
+ * gst_ftl_mirror_take_keyframe_request() tells ftlvideosink when to ask
+ * upstream for that keyframe.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlmirror.h"
+
+#include "gstftlenums.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_mirror_debug);
+#define GST_CAT_DEFAULT gst_ftl_mirror_debug
+
+#define STATUS_POLL_RATE_MS 200
+
+struct _GstFtlMirror
+{
+  /* Not reffed, only used for logging */
+  GstObject *parent;
+  gchar *hostname;
+  ftl_handle_t handle;
+
+  GstClockTime backoff_min;
+  GstClockTime backoff_max;
+
+  GThread *thread;
+  gint stopping;
+  GMutex lock;
+  GCond cond;
+
+  /* Held for reading while sending a frame, for writing while
+   * disconnecting */
+  GRWLock send_lock;
+  gint connected;
+  gint video_need_keyframe;
+  gint keyframe_requested;
+  /* Indexed by ftl_media_type_t, set by gst_ftl_mirror_begin_replay() */
+  gint replaying[2];
+  /* Indexed by ftl_media_type_t, only used by that stream's thread */
+  gint64 last_dts[2];
+
+  /* Updated atomically, indexed by ftl_media_type_t */
+  guint64 frames[2];
+  guint64 bytes[2];
+  guint64 frames_skipped;
+  guint64 reconnects;
+  guint64 connect_failures;
+};
+
+static gpointer gst_ftl_mirror_thread (gpointer user_data);
+
+/* Returns NULL if libftl rejects the parameters */
+GstFtlMirror *
+gst_ftl_mirror_new (GstObject * parent, const gchar * hostname,
+    const gchar * stream_key, guint peak_kbps, GstClockTime backoff_min,
+    GstClockTime backoff_max)
+{
+  static gsize debug_initialized = 0;
+  ftl_ingest_params_t params;
+  ftl_status_t status_code;
+  GstFtlMirror *mirror;
+
+  if (g_once_init_enter (&debug_initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ftl_mirror_debug, "ftlmirror", 0,
+        "debug category for ftlsink mirrors");
+    g_once_init_leave (&debug_initialized, 1);
+  }
+
+  mirror = g_new0 (GstFtlMirror, 1);
+
+  params.ingest_hostname = (gchar *) hostname;
+  params.stream_key = (gchar *) stream_key;
+  params.video_codec = FTL_VIDEO_H264;
+  params.audio_codec = FTL_AUDIO_OPUS;
+  params.peak_kbps = peak_kbps;
+  params.fps_num = 0;
+  params.fps_den = 1;
+  params.vendor_name = PACKAGE_NAME;
+  params.vendor_version = VERSION;
+
+  status_code = ftl_ingest_create (&mirror->handle, &params);
+  if (status_code != FTL_SUCCESS) {
+    GST_WARNING_OBJECT (parent, "Failed to create ingest handle for mirror "
+        "%s: %s", hostname, ftl_status_code_to_string (status_code));
+    g_free (mirror);
+    return NULL;
+  }
+
+  mirror->parent = parent;
+  mirror->hostname = g_strdup (hostname);
+  mirror->backoff_min = backoff_min;
+  mirror->backoff_max = MAX (backoff_min, backoff_max);
+  mirror->last_dts[FTL_AUDIO_DATA] = G_MININT64;
+  mirror->last_dts[FTL_VIDEO_DATA] = G_MININT64;
+  g_mutex_init (&mirror->lock);
+  g_cond_init (&mirror->cond);
+  g_rw_lock_init (&mirror->send_lock);
+
+  mirror->thread = g_thread_new ("ftlmirror", gst_ftl_mirror_thread, mirror);
+  return mirror;
+}
+
+/* Stops the mirror thread and disconnects. A handshake in progress can't
+ * be cancelled, so this might block until it finishes. */
+void
+gst_ftl_mirror_free (GstFtlMirror * mirror)
+{
+  ftl_status_t status_code;
+
+  g_mutex_lock (&mirror->lock);
+  g_atomic_int_set (&mirror->stopping, TRUE);
+  g_cond_signal (&mirror->cond);
+  g_mutex_unlock (&mirror->lock);
+
+  g_thread_join (mirror->thread);
+
+  status_code = ftl_ingest_destroy (&mirror->handle);
+  if (status_code != FTL_SUCCESS)
+    GST_WARNING_OBJECT (mirror->parent, "Failed to destroy ingest handle "
+        "for mirror %s: %s", mirror->hostname,
+        ftl_status_code_to_string (status_code));
+
+  g_free (mirror->hostname);
+  g_mutex_clear (&mirror->lock);
+  g_cond_clear (&mirror->cond);
+  g_rw_lock_clear (&mirror->send_lock);
+  g_free (mirror);
+}
+
+/* Returns FALSE if we got stopped */
+static gboolean
+gst_ftl_mirror_wait (GstFtlMirror * mirror, GstClockTime delay)
+{
+  gint64 end_time = g_get_monotonic_time () + delay / GST_USECOND;
+  gboolean stopping;
+
+  g_mutex_lock (&mirror->lock);
+  while (!(stopping = g_atomic_int_get (&mirror->stopping)) &&
+      g_cond_wait_until (&mirror->cond, &mirror->lock, end_time));
+  g_mutex_unlock (&mirror->lock);
+
+  return !stopping;
+}
+
+/* Handles status messages until the connection drops or we get stopped */
+static void
+gst_ftl_mirror_watch (GstFtlMirror * mirror)
+{
+  ftl_status_msg_t message;
+
+  while (!g_atomic_int_get (&mirror->stopping)) {
+    if (ftl_ingest_get_status (&mirror->handle, &message,
+            STATUS_POLL_RATE_MS) != FTL_SUCCESS)
+      continue;
+
+    switch (message.type) {
+      case FTL_STATUS_LOG:
+        g_strchomp (message.msg.log.string);
+        GST_CAT_LEVEL_LOG (GST_CAT_DEFAULT,
+            gst_ftl_log_severity_to_level (message.msg.log.log_level),
+            mirror->parent, "%s: %s", mirror->hostname,
+            message.msg.log.string);
+        break;
+
+      case FTL_STATUS_EVENT:
+        GST_INFO_OBJECT (mirror->parent, "Mirror %s event: %s, reason %s: %s",
+            mirror->hostname,
+            gst_ftl_status_event_type_get_nick (message.msg.event.type),
+            gst_ftl_status_event_reason_get_nick (message.msg.event.reason),
+            ftl_status_code_to_string (message.msg.event.error_code));
+
+        if (message.msg.event.type == FTL_STATUS_EVENT_TYPE_DISCONNECTED)
+          return;
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+static gpointer
+gst_ftl_mirror_thread (gpointer user_data)
+{
+  GstFtlMirror *mirror = user_data;
+  GstClockTime delay = mirror->backoff_min;
+  gboolean first = TRUE;
+
+  while (!g_atomic_int_get (&mirror->stopping)) {
+    ftl_status_t status_code = ftl_ingest_connect (&mirror->handle);
+
+    if (status_code != FTL_SUCCESS) {
+      GST_WARNING_OBJECT (mirror->parent, "Failed to connect to mirror %s: "
+          "%s, retrying in %" GST_TIME_FORMAT, mirror->hostname,
+          ftl_status_code_to_string (status_code), GST_TIME_ARGS (delay));
+      __atomic_fetch_add (&mirror->connect_failures, 1, __ATOMIC_RELAXED);
+
+      ftl_ingest_disconnect (&mirror->handle);
+      if (!gst_ftl_mirror_wait (mirror, delay))
+        break;
+
+      delay = MIN (delay * 2, mirror->backoff_max);
+      continue;
+    }
+
+    GST_INFO_OBJECT (mirror->parent, "connected to mirror %s",
+        mirror->hostname);
+
+    if (!first)
+      __atomic_fetch_add (&mirror->reconnects, 1, __ATOMIC_RELAXED);
+    first = FALSE;
+    delay = mirror->backoff_min;
+
+    /* The ingest needs to start decoding at a keyframe */
+    g_atomic_int_set (&mirror->keyframe_requested, FALSE);
+    g_atomic_int_set (&mirror->video_need_keyframe, TRUE);
+    g_atomic_int_set (&mirror->connected, TRUE);
+
+    gst_ftl_mirror_watch (mirror);
+
+    g_atomic_int_set (&mirror->connected, FALSE);
+
+    /* Wait for frames in flight */
+    g_rw_lock_writer_lock (&mirror->send_lock);
+    ftl_ingest_disconnect (&mirror->handle);
+    g_rw_lock_writer_unlock (&mirror->send_lock);
+
+    if (!gst_ftl_mirror_wait (mirror, delay))
+      break;
+  }
+
+  return NULL;
+}
+
+/* Returns the handle to send a frame to, or NULL to skip the frame. Must be
+ * followed by gst_ftl_mirror_end_frame() if it returns a handle. */
+ftl_handle_t *
+gst_ftl_mirror_begin_frame (GstFtlMirror * mirror,
+    ftl_media_type_t media_type, gint64 dts_usec, gboolean keyframe)
+{
+  if (!g_atomic_int_get (&mirror->connected))
+    return NULL;
+
+  /* The mirror already has the frames of a replay, up to the last one it
+   * got */
+  if (G_UNLIKELY (g_atomic_int_get (&mirror->replaying[media_type]))) {
+    if (dts_usec <= mirror->last_dts[media_type])
+      return NULL;
+    g_atomic_int_set (&mirror->replaying[media_type], FALSE);
+  }
+
+  if (media_type == FTL_VIDEO_DATA &&
+      g_atomic_int_get (&mirror->video_need_keyframe)) {
+    if (!keyframe) {
+      __atomic_fetch_add (&mirror->frames_skipped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    g_atomic_int_set (&mirror->video_need_keyframe, FALSE);
+  }
+
+  g_rw_lock_reader_lock (&mirror->send_lock);
+
+  if (!g_atomic_int_get (&mirror->connected)) {
+    g_rw_lock_reader_unlock (&mirror->send_lock);
+    return NULL;
+  }
+
+  return &mirror->handle;
+}
+
+/* Like gst_ftl_mirror_begin_frame(), for the next part of the frame with
+ * @dts_usec. Returns NULL if the mirror missed the start of the frame or
+ * reconnected since. */
+ftl_handle_t *
+gst_ftl_mirror_continue_frame (GstFtlMirror * mirror,
+    ftl_media_type_t media_type, gint64 dts_usec)
+{
+  if (!g_atomic_int_get (&mirror->connected) ||
+      dts_usec != mirror->last_dts[media_type])
+    return NULL;
+
+  if (media_type == FTL_VIDEO_DATA &&
+      g_atomic_int_get (&mirror->video_need_keyframe))
+    return NULL;
+
+  g_rw_lock_reader_lock (&mirror->send_lock);
+
+  if (!g_atomic_int_get (&mirror->connected)) {
+    g_rw_lock_reader_unlock (&mirror->send_lock);
+    return NULL;
+  }
+
+  return &mirror->handle;
+}
+
+/* @dts_usec must be the one passed to gst_ftl_mirror_begin_frame() or
+ * gst_ftl_mirror_continue_frame() */
+void
+gst_ftl_mirror_end_frame (GstFtlMirror * mirror, ftl_media_type_t media_type,
+    gint64 dts_usec, gint bytes_sent)
+{
+  g_rw_lock_reader_unlock (&mirror->send_lock);
+
+  if (dts_usec != mirror->last_dts[media_type])
+    __atomic_fetch_add (&mirror->frames[media_type], 1, __ATOMIC_RELAXED);
+  mirror->last_dts[media_type] = dts_usec;
+
+  __atomic_fetch_add (&mirror->bytes[media_type], bytes_sent,
+      __ATOMIC_RELAXED);
+}
+
+/* Called when ftlsink is about to replay its GOP cache after reconnecting
+ * the main ingest */
+void
+gst_ftl_mirror_begin_replay (GstFtlMirror * mirror)
+{
+  g_atomic_int_set (&mirror->replaying[FTL_AUDIO_DATA], TRUE);
+  g_atomic_int_set (&mirror->replaying[FTL_VIDEO_DATA], TRUE);
+}
+
+/* Returns TRUE once per (re)connect while the mirror waits for a keyframe,
+ * for the caller to ask upstream for one */
+gboolean
+gst_ftl_mirror_take_keyframe_request (GstFtlMirror * mirror)
+{
+  return g_atomic_int_get (&mirror->video_need_keyframe) &&
+      g_atomic_int_compare_and_exchange (&mirror->keyframe_requested, FALSE,
+      TRUE);
+}
+
+#define LOAD(field) __atomic_load_n (&mirror->field, __ATOMIC_RELAXED)
+
+GstStructure *
+gst_ftl_mirror_get_stats (GstFtlMirror * mirror)
+{
+  return gst_structure_new ("ftl-mirror",
+      "hostname", G_TYPE_STRING, mirror->hostname,
+      "connected", G_TYPE_BOOLEAN, g_atomic_int_get (&mirror->connected),
+      "video-frames-total", G_TYPE_UINT64, LOAD (frames[FTL_VIDEO_DATA]),
+      "video-bytes-total", G_TYPE_UINT64, LOAD (bytes[FTL_VIDEO_DATA]),
+      "video-frames-skipped-total", G_TYPE_UINT64, LOAD (frames_skipped),
+      "audio-frames-total", G_TYPE_UINT64, LOAD (frames[FTL_AUDIO_DATA]),
+      "audio-bytes-total", G_TYPE_UINT64, LOAD (bytes[FTL_AUDIO_DATA]),
+      "reconnects-total", G_TYPE_UINT64, LOAD (reconnects),
+      "connect-failures-total", G_TYPE_UINT64, LOAD (connect_failures),
+      NULL);
+}
+
+#undef LOAD
@@ -0,0 +1,52 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_MIRROR_H_
+#define _GST_FTL_MIRROR_H_
+
+#include <gst/gst.h>
+#include "ftl.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstFtlMirror GstFtlMirror;
+
+GstFtlMirror * gst_ftl_mirror_new (GstObject * parent,
+    const gchar * hostname, const gchar * stream_key, guint peak_kbps,
+    GstClockTime backoff_min, GstClockTime backoff_max);
+void gst_ftl_mirror_free (GstFtlMirror * mirror);
+
+ftl_handle_t * gst_ftl_mirror_begin_frame (GstFtlMirror * mirror,
+    ftl_media_type_t media_type, gint64 dts_usec, gboolean keyframe);
+ftl_handle_t * gst_ftl_mirror_continue_frame (GstFtlMirror * mirror,
+    ftl_media_type_t media_type, gint64 dts_usec);
+void gst_ftl_mirror_end_frame (GstFtlMirror * mirror,
+    ftl_media_type_t media_type, gint64 dts_usec, gint bytes_sent);
+void gst_ftl_mirror_begin_replay (GstFtlMirror * mirror);
+gboolean gst_ftl_mirror_take_keyframe_request (GstFtlMirror * mirror);
+
+GstStructure * gst_ftl_mirror_get_stats (GstFtlMirror * mirror);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,545 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlnalu.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+static gsize
+find_start_code_scalar (const guint8 * data, gsize size)
+{
+  gsize pos = 2;
+
+  /* pos is the candidate position of the 01 byte. Anything but 00 or 01
+   * there rules out start codes ending at pos, pos + 1 and pos + 2. */
+  while (pos < size) {
+    if (data[pos] > 1)
+      pos += 3;
+    else if (data[pos] == 0)
+      pos += 1;
+    else if (data[pos - 1] == 0 && data[pos - 2] == 0)
+      return pos - 2;
+    else
+      pos += 3;
+  }
+
+  return size;
+}
+
+static gboolean
+scanner_always_supported (void)
+{
+  return TRUE;
+}
+
+#if defined(__x86_64__)
+
+static gsize
+find_start_code_sse2 (const guint8 * data, gsize size)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi8 (1);
+  gsize pos = 0;
+
+  /* Each iteration tests the 16 candidate positions pos .. pos + 15, which
+   * needs 18 readable bytes */
+  for (; pos + 18 <= size; pos += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (data + pos));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (data + pos + 1));
+    __m128i c = _mm_loadu_si128 ((const __m128i *) (data + pos + 2));
+    __m128i zz = _mm_cmpeq_epi8 (_mm_or_si128 (a, b), zero);
+    guint mask;
+
+    if (G_LIKELY (_mm_movemask_epi8 (zz) == 0))
+      continue;
+
+    mask = _mm_movemask_epi8 (_mm_and_si128 (zz, _mm_cmpeq_epi8 (c, one)));
+    if (mask != 0)
+      return pos + __builtin_ctz (mask);
+  }
+
+  return pos + find_start_code_scalar (data + pos, size - pos);
+}
+
+__attribute__ ((target ("avx2")))
+static gsize
+find_start_code_avx2 (const guint8 * data, gsize size)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i one = _mm256_set1_epi8 (1);
+  gsize pos = 0;
+
+  for (; pos + 34 <= size; pos += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (data + pos));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (data + pos + 1));
+    __m256i c = _mm256_loadu_si256 ((const __m256i *) (data + pos + 2));
+    __m256i zz = _mm256_cmpeq_epi8 (_mm256_or_si256 (a, b), zero);
+    guint mask;
+
+    if (G_LIKELY (_mm256_movemask_epi8 (zz) == 0))
+      continue;
+
+    mask = _mm256_movemask_epi8 (_mm256_and_si256 (zz,
+            _mm256_cmpeq_epi8 (c, one)));
+    if (mask != 0)
+      return pos + __builtin_ctz (mask);
+  }
+
+  return pos + find_start_code_sse2 (data + pos, size - pos);
+}
+
+static gboolean
+scanner_avx2_supported (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2");
+}
+
+#elif defined(__aarch64__)
+
+static gsize
+find_start_code_neon (const guint8 * data, gsize size)
+{
+  const uint8x16_t one = vdupq_n_u8 (1);
+  gsize pos = 0;
+
+  for (; pos + 18 <= size; pos += 16) {
+    uint8x16_t a = vld1q_u8 (data + pos);
+    uint8x16_t b = vld1q_u8 (data + pos + 1);
+    uint8x16_t c = vld1q_u8 (data + pos + 2);
+    uint8x16_t m = vandq_u8 (vceqzq_u8 (vorrq_u8 (a, b)), vceqq_u8 (c, one));
+    guint64 bits;
+
+    /* Narrow the byte mask to one nibble per candidate position */
+    bits = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16
+            (vreinterpretq_u16_u8 (m), 4)), 0);
+    if (G_LIKELY (bits == 0))
+      continue;
+
+    return pos + (__builtin_ctzll (bits) >> 2);
+  }
+
+  return pos + find_start_code_scalar (data + pos, size - pos);
+}
+
+static gboolean
+scanner_neon_supported (void)
+{
+#if defined(__linux__) && defined(HWCAP_ASIMD)
+  return (getauxval (AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+  return TRUE;
+#endif
+}
+
+#endif
+
+/* Ordered from most to least preferred */
+static const GstFtlStartCodeScanner scanners[] = {
+#if defined(__x86_64__)
+  {"avx2", find_start_code_avx2, scanner_avx2_supported},
+  {"sse2", find_start_code_sse2, scanner_always_supported},
+#elif defined(__aarch64__)
+  {"neon", find_start_code_neon, scanner_neon_supported},
+#endif
+  {"scalar", find_start_code_scalar, scanner_always_supported},
+};
+
+static const GstFtlStartCodeScanner *active_scanner =
+    &scanners[G_N_ELEMENTS (scanners) - 1];
+
+void
+gst_ftl_nalu_init (void)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (scanners); i++) {
+    if (scanners[i].supported ()) {
+      active_scanner = &scanners[i];
+      break;
+    }
+  }
+}
+
+const gchar *
+gst_ftl_nalu_get_scanner_name (void)
+{
+  return active_scanner->name;
+}
+
+const GstFtlStartCodeScanner *
+gst_ftl_nalu_get_scanners (guint * n_scanners)
+{
+  *n_scanners = G_N_ELEMENTS (scanners);
+  return scanners;
+}
+
+gsize
+gst_ftl_nalu_find_start_code (const guint8 * data, gsize size)
+{
+  return active_scanner->find (data, size);
+}
+
+static void
+append_nalu (GArray * nalus, const guint8 * data, gsize offset, gsize size)
+{
+  GstFtlNalu nalu;
+
+  nalu.offset = offset;
+  nalu.size = size;
+  nalu.data = data + offset;
+  nalu.type = data[offset] & 0x1f;
+  nalu.ref_idc = (data[offset] >> 5) & 0x3;
+  g_array_append_val (nalus, nalu);
+}
+
+/* Random access to the bytes of an access unit split into chunks. Reads
+ * are mostly sequential, so it remembers the chunk it last read from. */
+typedef struct
+{
+  const GstFtlNaluChunk *chunks;
+  guint n_chunks;
+  guint index;
+  /* Offset of chunks[index] in the access unit */
+  gsize start;
+} ChunkReader;
+
+static void
+chunk_reader_seek (ChunkReader * reader, gsize pos)
+{
+  while (reader->index > 0 && pos < reader->start) {
+    reader->index--;
+    reader->start -= reader->chunks[reader->index].size;
+  }
+
+  while (reader->index + 1 < reader->n_chunks &&
+      pos >= reader->start + reader->chunks[reader->index].size) {
+    reader->start += reader->chunks[reader->index].size;
+    reader->index++;
+  }
+}
+
+static guint8
+chunk_reader_byte (ChunkReader * reader, gsize pos)
+{
+  chunk_reader_seek (reader, pos);
+  return reader->chunks[reader->index].data[pos - reader->start];
+}
+
+/* Like gst_ftl_nalu_find_start_code(), but returns the offset of the
+ * first start code at or after @pos, or @size */
+static gsize
+chunk_reader_find_start_code (ChunkReader * reader, gsize pos, gsize size)
+{
+  while (pos < size) {
+    const GstFtlNaluChunk *chunk;
+    gsize local, found, end;
+
+    chunk_reader_seek (reader, pos);
+    chunk = &reader->chunks[reader->index];
+    local = pos - reader->start;
+    end = reader->start + chunk->size;
+
+    found = gst_ftl_nalu_find_start_code (chunk->data + local,
+        chunk->size - local);
+    if (found < chunk->size - local)
+      return pos + found;
+
+    /* The scanner can't see start codes straddling the chunk's end */
+    for (gsize p = MAX (pos, MAX (end, 2) - 2); p < end && size - p >= 3;
+        p++) {
+      if (chunk_reader_byte (reader, p) == 0 &&
+          chunk_reader_byte (reader, p + 1) == 0 &&
+          chunk_reader_byte (reader, p + 2) == 1)
+        return p;
+    }
+
+    pos = end;
+  }
+
+  return size;
+}
+
+static void
+chunk_reader_append_nalu (ChunkReader * reader, gsize offset, gsize size,
+    GArray * nalus)
+{
+  guint8 header = chunk_reader_byte (reader, offset);
+  const GstFtlNaluChunk *chunk = &reader->chunks[reader->index];
+  GstFtlNalu nalu;
+
+  nalu.offset = offset;
+  nalu.size = size;
+  nalu.data = size <= reader->start + chunk->size - offset ?
+      chunk->data + (offset - reader->start) : NULL;
+  nalu.type = header & 0x1f;
+  nalu.ref_idc = (header >> 5) & 0x3;
+  g_array_append_val (nalus, nalu);
+}
+
+static gsize
+chunks_get_size (const GstFtlNaluChunk * chunks, guint n_chunks)
+{
+  gsize size = 0;
+
+  for (guint i = 0; i < n_chunks; i++)
+    size += chunks[i].size;
+
+  return size;
+}
+
+/* Appends the NALUs of an Annex-B access unit to @nalus. Bytes before the
+ * first start code and empty NALUs are skipped. */
+gboolean
+gst_ftl_nalu_parse_byte_stream (const guint8 * data, gsize size,
+    GArray * nalus)
+{
+  GstFtlNaluChunk chunk = { data, size };
+
+  return gst_ftl_nalu_parse_byte_stream_chunks (&chunk, 1, nalus);
+}
+
+gboolean
+gst_ftl_nalu_parse_byte_stream_chunks (const GstFtlNaluChunk * chunks,
+    guint n_chunks, GArray * nalus)
+{
+  ChunkReader reader = { chunks, n_chunks, 0, 0 };
+  gsize size = chunks_get_size (chunks, n_chunks);
+  gsize pos = chunk_reader_find_start_code (&reader, 0, size);
+
+  while (pos < size) {
+    gsize start = pos + 3;
+    gsize next = chunk_reader_find_start_code (&reader, start, size);
+    gsize end = next;
+
+    /* Leave out the leading zero of a 4-byte start code */
+    if (next < size && chunk_reader_byte (&reader, next - 1) == 0)
+      end--;
+
+    if (end > start)
+      chunk_reader_append_nalu (&reader, start, end - start, nalus);
+
+    pos = next;
+  }
+
+  return TRUE;
+}
+
+/* Appends the NALUs of a length-prefixed access unit to @nalus. Returns
+ * FALSE if a length prefix runs past the end of @data. */
+gboolean
+gst_ftl_nalu_parse_avc (const guint8 * data, gsize size,
+    guint nal_length_size, GArray * nalus)
+{
+  GstFtlNaluChunk chunk = { data, size };
+
+  return gst_ftl_nalu_parse_avc_chunks (&chunk, 1, nal_length_size, nalus);
+}
+
+gboolean
+gst_ftl_nalu_parse_avc_chunks (const GstFtlNaluChunk * chunks,
+    guint n_chunks, guint nal_length_size, GArray * nalus)
+{
+  ChunkReader reader = { chunks, n_chunks, 0, 0 };
+  gsize size = chunks_get_size (chunks, n_chunks);
+  gsize pos = 0;
+
+  g_return_val_if_fail (nal_length_size >= 1 && nal_length_size <= 4, FALSE);
+
+  while (pos < size) {
+    gsize nalu_len = 0;
+
+    if (size - pos < nal_length_size)
+      return FALSE;
+
+    for (guint i = 0; i < nal_length_size; i++)
+      nalu_len = (nalu_len << 8) | chunk_reader_byte (&reader, pos++);
+
+    if (nalu_len > size - pos)
+      return FALSE;
+
+    if (nalu_len > 0)
+      chunk_reader_append_nalu (&reader, pos, nalu_len, nalus);
+
+    pos += nalu_len;
+  }
+
+  return TRUE;
+}
+
+/* Points the NALUs in @nalus, parsed earlier from the same access unit, at
+ * @chunks. NALUs spanning chunks get a NULL data pointer. */
+void
+gst_ftl_nalu_set_chunk_data (const GstFtlNaluChunk * chunks, guint n_chunks,
+    GArray * nalus)
+{
+  ChunkReader reader = { chunks, n_chunks, 0, 0 };
+
+  for (guint i = 0; i < nalus->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (nalus, GstFtlNalu, i);
+    const GstFtlNaluChunk *chunk;
+
+    chunk_reader_seek (&reader, nalu->offset);
+    chunk = &reader.chunks[reader.index];
+    nalu->data = nalu->size <= reader.start + chunk->size - nalu->offset ?
+        chunk->data + (nalu->offset - reader.start) : NULL;
+  }
+}
+
+static gboolean
+parse_parameter_sets (const guint8 * data, gsize size, gsize * pos,
+    guint count, GArray * nalus)
+{
+  for (guint i = 0; i < count; i++) {
+    gsize len;
+
+    if (size - *pos < 2)
+      return FALSE;
+
+    len = (data[*pos] << 8) | data[*pos + 1];
+    *pos += 2;
+
+    if (len == 0 || len > size - *pos)
+      return FALSE;
+
+    append_nalu (nalus, data, *pos, len);
+    *pos += len;
+  }
+
+  return TRUE;
+}
+
+/* Parses an AVCDecoderConfigurationRecord, appending its SPS and PPS to
+ * @nalus */
+gboolean
+gst_ftl_nalu_parse_avc_codec_data (const guint8 * data, gsize size,
+    guint * nal_length_size, GArray * nalus)
+{
+  gsize pos = 6;
+
+  if (size < 7 || data[0] != 1)
+    return FALSE;
+
+  *nal_length_size = (data[4] & 0x3) + 1;
+
+  if (!parse_parameter_sets (data, size, &pos, data[5] & 0x1f, nalus))
+    return FALSE;
+
+  if (pos >= size)
+    return FALSE;
+  pos++;
+
+  return parse_parameter_sets (data, size, &pos, data[pos - 1], nalus);
+}
+
+/* Reads the RBSP of a NALU, removing emulation prevention bytes */
+typedef struct
+{
+  const guint8 *data;
+  gsize size;
+  gsize pos;
+  guint zeros;
+} RbspReader;
+
+static gboolean
+rbsp_read_byte (RbspReader * reader, guint8 * byte)
+{
+  if (reader->pos >= reader->size)
+    return FALSE;
+
+  if (reader->zeros >= 2 && reader->data[reader->pos] == 3) {
+    reader->pos++;
+    reader->zeros = 0;
+    if (reader->pos >= reader->size)
+      return FALSE;
+  }
+
+  *byte = reader->data[reader->pos++];
+  reader->zeros = *byte == 0 ? reader->zeros + 1 : 0;
+  return TRUE;
+}
+
+/* Reads an SEI payload type or size: 0xFF bytes, each adding 255, followed
+ * by a final byte */
+static gboolean
+rbsp_read_sei_value (RbspReader * reader, guint * value)
+{
+  guint8 byte;
+
+  *value = 0;
+  do {
+    if (!rbsp_read_byte (reader, &byte))
+      return FALSE;
+    *value += byte;
+  } while (byte == 0xff);
+
+  return TRUE;
+}
+
+static gboolean
+rbsp_more_data (RbspReader * reader)
+{
+  /* The rbsp_trailing_bits, 0x80 at byte alignment, end the SEI */
+  return reader->pos < reader->size &&
+      !(reader->pos == reader->size - 1 && reader->data[reader->pos] == 0x80);
+}
+
+/* Returns TRUE if the SEI NALU @data, including its header, carries only
+ * messages that don't affect decoding or presentation: filler payload (3)
+ * and unregistered user data (5), such as the encoder's version string.
+ * Anything else, e.g. captions or recovery points, or a malformed SEI, must
+ * be kept. */
+gboolean
+gst_ftl_nalu_sei_is_optional (const guint8 * data, gsize size)
+{
+  RbspReader reader = { data, size, 1, 0 };
+
+  while (rbsp_more_data (&reader)) {
+    guint type, payload_size;
+    guint8 byte;
+
+    if (!rbsp_read_sei_value (&reader, &type) ||
+        !rbsp_read_sei_value (&reader, &payload_size))
+      return FALSE;
+
+    if (type != 3 && type != 5)
+      return FALSE;
+
+    for (guint i = 0; i < payload_size; i++) {
+      if (!rbsp_read_byte (&reader, &byte))
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,86 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_NALU_H_
+#define _GST_FTL_NALU_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Returns the offset of the first 00 00 01 sequence in @data, or @size if
+ * there is none */
+typedef gsize (*GstFtlStartCodeFindFunc) (const guint8 * data, gsize size);
+
+/* A NALU inside an access unit, without start code or length prefix.
+ * @data points into the parsed memory, or is NULL if the NALU spans
+ * several chunks. */
+typedef struct
+{
+  gsize offset;
+  gsize size;
+  const guint8 *data;
+  guint8 type;
+  guint8 ref_idc;
+} GstFtlNalu;
+
+/* One piece of an access unit that isn't contiguous in memory, such as a
+ * mapped GstMemory. Offsets of parsed NALUs count from the start of the
+ * first chunk. */
+typedef struct
+{
+  const guint8 *data;
+  gsize size;
+} GstFtlNaluChunk;
+
+typedef struct
+{
+  const gchar *name;
+  GstFtlStartCodeFindFunc find;
+  gboolean (*supported) (void);
+} GstFtlStartCodeScanner;
+
+void gst_ftl_nalu_init (void);
+const gchar * gst_ftl_nalu_get_scanner_name (void);
+const GstFtlStartCodeScanner * gst_ftl_nalu_get_scanners (guint * n_scanners);
+
+gsize gst_ftl_nalu_find_start_code (const guint8 * data, gsize size);
+
+gboolean gst_ftl_nalu_parse_byte_stream (const guint8 * data, gsize size,
+    GArray * nalus);
+gboolean gst_ftl_nalu_parse_avc (const guint8 * data, gsize size,
+    guint nal_length_size, GArray * nalus);
+gboolean gst_ftl_nalu_parse_byte_stream_chunks (const GstFtlNaluChunk * chunks,
+    guint n_chunks, GArray * nalus);
+gboolean gst_ftl_nalu_parse_avc_chunks (const GstFtlNaluChunk * chunks,
+    guint n_chunks, guint nal_length_size, GArray * nalus);
+void gst_ftl_nalu_set_chunk_data (const GstFtlNaluChunk * chunks,
+    guint n_chunks, GArray * nalus);
+gboolean gst_ftl_nalu_parse_avc_codec_data (const guint8 * data, gsize size,
+    guint * nal_length_size, GArray * nalus);
+
+gboolean gst_ftl_nalu_sei_is_optional (const guint8 * data, gsize size);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Frame pacer for the native media transports.
+ *
+ * A large IDR frame leaving at line rate overflows switch buffers on the
+ * way to the ingest and comes back as a storm of NACKs. When a frame
+ * starts, the pacer learns its size and the span to spread it over. The
+ * transport sends it in slices and waits before each until the bytes
+ * before it are due, sleeping to an absolute CLOCK_MONOTONIC time with
+ * clock_nanosleep() so the error doesn't add up over a frame.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlpacer.h"
+
+#include <errno.h>
+#include <time.h>
+
+static gint64
+get_monotonic_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+void
+gst_ftl_pacer_init (GstFtlPacer * pacer, GstFtlHistogram * error)
+{
+  pacer->error = error;
+  pacer->span = 0;
+}
+
+/* Paces the next @size bytes over @span, starting now. A frame that ends
+ * up larger goes out unpaced at the end. */
+void
+gst_ftl_pacer_begin_frame (GstFtlPacer * pacer, gsize size,
+    GstClockTime span)
+{
+  pacer->start = get_monotonic_ns ();
+  pacer->span = size > 0 ? span : 0;
+  pacer->size = size;
+  pacer->sent = 0;
+}
+
+/* Waits until the next @size bytes of the frame are due */
+void
+gst_ftl_pacer_wait (GstFtlPacer * pacer, gsize size)
+{
+  struct timespec ts;
+  gint64 due, now;
+
+  if (!gst_ftl_pacer_is_active (pacer))
+    return;
+
+  /* The first slice is due right away */
+  if (pacer->sent == 0) {
+    pacer->sent = size;
+    return;
+  }
+
+  due = pacer->start + gst_util_uint64_scale (pacer->span,
+      MIN (pacer->sent, pacer->size), pacer->size);
+  pacer->sent += size;
+
+  ts.tv_sec = due / GST_SECOND;
+  ts.tv_nsec = due % GST_SECOND;
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+      EINTR);
+
+  /* Also counts slices that were late before we got to wait, because
+   * the frame's data arrived too slowly */
+  now = get_monotonic_ns ();
+  gst_ftl_histogram_record (pacer->error, now - due);
+}
+
+void
+gst_ftl_pacer_end_frame (GstFtlPacer * pacer)
+{
+  pacer->span = 0;
+}
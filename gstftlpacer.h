@@ -0,0 +1,62 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _GST_FTL_PACER_H_
+#define _GST_FTL_PACER_H_
+
+#include <gst/gst.h>
+#include "gstftlhistogram.h"
+
+G_BEGIN_DECLS
+
+/* Spreads the packets of a frame evenly over a span of time. Only used
+ * by the thread sending the frame. */
+typedef struct
+{
+  /* Records how late each slice went out */
+  GstFtlHistogram *error;
+
+  /* Monotonic times in ns, 0 span while not pacing */
+  gint64 start;
+  gint64 span;
+  gsize size;
+  gsize sent;
+} GstFtlPacer;
+
+void gst_ftl_pacer_init (GstFtlPacer * pacer, GstFtlHistogram * error);
+
+void gst_ftl_pacer_begin_frame (GstFtlPacer * pacer, gsize size,
+    GstClockTime span);
+void gst_ftl_pacer_wait (GstFtlPacer * pacer, gsize size);
+void gst_ftl_pacer_end_frame (GstFtlPacer * pacer);
+
+static inline gboolean
+gst_ftl_pacer_is_active (GstFtlPacer * pacer)
+{
+  return pacer->span > 0;
+}
+
+G_END_DECLS
+
+#endif
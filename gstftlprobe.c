@@ -0,0 +1,235 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Picks the ingest with the lowest round-trip time from a list of
+ * candidates. All candidates are probed at the same time, each with a few
+ * TCP handshakes to the FTL port; the fastest handshake of each counts as
+ * its RTT.
+ *
+ * Results are cached per candidate list for the whole process, so
+ * restarting a pipeline doesn't pay for the probe again.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlprobe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_probe_debug);
+#define GST_CAT_DEFAULT gst_ftl_probe_debug
+
+#define PROBE_COUNT 3
+
+typedef struct
+{
+  const gchar *hostname;
+  guint port;
+  GstClockTime timeout;
+  GstClockTime rtt;
+} GstFtlProbe;
+
+typedef struct
+{
+  gchar *hostname;
+  GstClockTime rtt;
+  gint64 expires;
+} GstFtlProbeCacheEntry;
+
+static GMutex cache_lock;
+/* Candidate list => GstFtlProbeCacheEntry */
+static GHashTable *cache;
+
+static void
+cache_entry_free (GstFtlProbeCacheEntry * entry)
+{
+  g_free (entry->hostname);
+  g_free (entry);
+}
+
+/* Returns the duration of a TCP handshake with @addr, or
+ * GST_CLOCK_TIME_NONE on failure */
+static GstClockTime
+probe_handshake (const struct addrinfo *addr, GstClockTime timeout)
+{
+  struct pollfd pfd;
+  GstClockTime start, rtt = GST_CLOCK_TIME_NONE;
+  gint fd, error = 0;
+  socklen_t len = sizeof (error);
+
+  fd = socket (addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK |
+      SOCK_CLOEXEC, addr->ai_protocol);
+  if (fd < 0)
+    return GST_CLOCK_TIME_NONE;
+
+  start = gst_util_get_timestamp ();
+
+  if (connect (fd, addr->ai_addr, addr->ai_addrlen) < 0 &&
+      errno != EINPROGRESS)
+    goto out;
+
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  if (poll (&pfd, 1, GST_TIME_AS_MSECONDS (timeout)) != 1)
+    goto out;
+
+  if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+    goto out;
+
+  rtt = gst_util_get_timestamp () - start;
+
+out:
+  close (fd);
+  return rtt;
+}
+
+static gpointer
+probe_thread (gpointer user_data)
+{
+  GstFtlProbe *probe = user_data;
+  struct addrinfo hints = { 0, }, *addrs;
+  gchar port[8];
+  gint ret;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  g_snprintf (port, sizeof (port), "%u", probe->port);
+
+  ret = getaddrinfo (probe->hostname, port, &hints, &addrs);
+  if (ret != 0) {
+    GST_INFO ("Failed to resolve %s: %s", probe->hostname,
+        gai_strerror (ret));
+    return NULL;
+  }
+
+  /* libftl connects to the first address */
+  for (guint i = 0; i < PROBE_COUNT; i++) {
+    GstClockTime rtt = probe_handshake (addrs, probe->timeout);
+
+    if (!GST_CLOCK_TIME_IS_VALID (rtt))
+      break;
+    if (!GST_CLOCK_TIME_IS_VALID (probe->rtt) || rtt < probe->rtt)
+      probe->rtt = rtt;
+  }
+
+  freeaddrinfo (addrs);
+
+  GST_DEBUG ("%s: RTT %" GST_TIME_FORMAT, probe->hostname,
+      GST_TIME_ARGS (probe->rtt));
+  return NULL;
+}
+
+/* Returns the reachable candidate with the lowest RTT and stores its RTT
+ * in @rtt, or returns NULL if none answered within @timeout. Results stay
+ * valid for @ttl (0 = don't cache). Blocks while probing. */
+gchar *
+gst_ftl_probe_select_ingest (const gchar * const *candidates, guint port,
+    GstClockTime timeout, GstClockTime ttl, GstClockTime * rtt)
+{
+  static gsize initialized = 0;
+  guint n_candidates = g_strv_length ((gchar **) candidates);
+  GstFtlProbe *probes;
+  GThread **threads;
+  GstFtlProbeCacheEntry *entry;
+  gchar *joined, *key, *best = NULL;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ftl_probe_debug, "ftlprobe", 0,
+        "debug category for ftlsink ingest selection");
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) cache_entry_free);
+    g_once_init_leave (&initialized, 1);
+  }
+
+  *rtt = GST_CLOCK_TIME_NONE;
+
+  if (n_candidates == 0)
+    return NULL;
+
+  joined = g_strjoinv (",", (gchar **) candidates);
+  key = g_strdup_printf ("%u:%s", port, joined);
+  g_free (joined);
+
+  g_mutex_lock (&cache_lock);
+  entry = g_hash_table_lookup (cache, key);
+  if (entry != NULL && entry->expires > g_get_monotonic_time ()) {
+    best = g_strdup (entry->hostname);
+    *rtt = entry->rtt;
+  }
+  g_mutex_unlock (&cache_lock);
+
+  if (best != NULL) {
+    GST_DEBUG ("Using cached choice %s", best);
+    g_free (key);
+    return best;
+  }
+
+  probes = g_new0 (GstFtlProbe, n_candidates);
+  threads = g_new0 (GThread *, n_candidates);
+
+  for (guint i = 0; i < n_candidates; i++) {
+    probes[i].hostname = candidates[i];
+    probes[i].port = port;
+    probes[i].timeout = timeout;
+    probes[i].rtt = GST_CLOCK_TIME_NONE;
+    threads[i] = g_thread_new ("ftlprobe", probe_thread, &probes[i]);
+  }
+
+  for (guint i = 0; i < n_candidates; i++) {
+    g_thread_join (threads[i]);
+
+    if (GST_CLOCK_TIME_IS_VALID (probes[i].rtt) &&
+        (!GST_CLOCK_TIME_IS_VALID (*rtt) || probes[i].rtt < *rtt)) {
+      best = (gchar *) probes[i].hostname;
+      *rtt = probes[i].rtt;
+    }
+  }
+
+  best = g_strdup (best);
+
+  if (best != NULL && ttl > 0) {
+    entry = g_new0 (GstFtlProbeCacheEntry, 1);
+    entry->hostname = g_strdup (best);
+    entry->rtt = *rtt;
+    entry->expires = g_get_monotonic_time () + ttl / GST_USECOND;
+
+    g_mutex_lock (&cache_lock);
+    g_hash_table_replace (cache, key, entry);
+    g_mutex_unlock (&cache_lock);
+  } else {
+    g_free (key);
+  }
+
+  g_free (probes);
+  g_free (threads);
+  return best;
+}
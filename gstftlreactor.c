@@ -0,0 +1,301 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Process-wide reactor for the sockets of all ftlsinks.
+ *
+ * The native media transports have to read the RTCP feedback the ingest
+ * sends back as it arrives, also while no media flows, but a thread per
+ * socket doesn't scale to hundreds of streams. Instead, a few threads,
+ * each pinned to one of the CPUs we may run on, wait on an epoll instance
+ * of their own, and every socket is assigned to the least loaded one.
+ * Sockets are level-triggered, so a function that doesn't read everything
+ * gets called again on the next round. Calls for one source never
+ * overlap; a slow function delays the other sources of its thread.
+ *
+ * libftl's control connection stays on libftl's threads, it doesn't hand
+ * out its sockets.
+ */
+
+/* For pthread_setaffinity_np() */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlreactor.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_reactor_debug);
+#define GST_CAT_DEFAULT gst_ftl_reactor_debug
+
+#define REACTOR_MAX_THREADS 4
+#define REACTOR_MAX_EVENTS 64
+
+/* Aligned so that threads don't share cache lines */
+typedef struct
+{
+  GThread *thread;
+  gint epoll_fd;
+  /* CPU to pin to, or -1 */
+  gint cpu;
+
+  GMutex lock;
+  /* Signalled when a source has been called */
+  GCond idle_cond;
+
+  /* Indexed by the low half of the epoll data, NULL for free slots */
+  GPtrArray *sources;
+  guint n_sources;
+  /* Tells reused slots apart, the high half of the epoll data */
+  guint32 generation;
+  GstFtlReactorSource *running;
+} __attribute__ ((aligned (GST_FTL_CACHE_LINE_SIZE))) GstFtlReactorThread;
+
+struct _GstFtlReactorSource
+{
+  GstFtlReactorFunc func;
+  gpointer user_data;
+  gint fd;
+  guint index;
+  guint32 generation;
+  GstFtlReactorThread *thread;
+};
+
+static GstFtlReactorThread threads[REACTOR_MAX_THREADS];
+static guint n_threads;
+
+static void
+gst_ftl_reactor_pin (GstFtlReactorThread * thread)
+{
+  cpu_set_t set;
+  gint ret;
+
+  CPU_ZERO (&set);
+  CPU_SET (thread->cpu, &set);
+
+  ret = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+  if (ret != 0)
+    GST_WARNING ("Failed to pin reactor thread to CPU %d: %s", thread->cpu,
+        g_strerror (ret));
+}
+
+static gpointer
+gst_ftl_reactor_thread (gpointer user_data)
+{
+  GstFtlReactorThread *thread = user_data;
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  if (thread->cpu >= 0)
+    gst_ftl_reactor_pin (thread);
+
+  for (;;) {
+    gint n_events = epoll_wait (thread->epoll_fd, events,
+        G_N_ELEMENTS (events), -1);
+
+    if (n_events < 0) {
+      if (errno == EINTR)
+        continue;
+
+      GST_ERROR ("epoll_wait() failed: %s", g_strerror (errno));
+      break;
+    }
+
+    g_mutex_lock (&thread->lock);
+
+    for (gint i = 0; i < n_events; i++) {
+      guint index = events[i].data.u64 & G_MAXUINT32;
+      guint32 generation = events[i].data.u64 >> 32;
+      GstFtlReactorSource *source = NULL;
+
+      if (index < thread->sources->len)
+        source = g_ptr_array_index (thread->sources, index);
+
+      /* Removed since epoll_wait() returned */
+      if (source == NULL || source->generation != generation)
+        continue;
+
+      thread->running = source;
+      g_mutex_unlock (&thread->lock);
+
+      source->func (source->fd, source->user_data);
+
+      g_mutex_lock (&thread->lock);
+      thread->running = NULL;
+      g_cond_broadcast (&thread->idle_cond);
+    }
+
+    g_mutex_unlock (&thread->lock);
+  }
+
+  return NULL;
+}
+
+/* Starts a thread per CPU we may run on, up to REACTOR_MAX_THREADS, the
+ * first time a socket gets watched. Only the native transports need them,
+ * not every process that loads the plugin. */
+static void
+gst_ftl_reactor_start (void)
+{
+  static gsize initialized = 0;
+  cpu_set_t allowed;
+  gint cpu = 0, n_cpus;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  GST_DEBUG_CATEGORY_INIT (gst_ftl_reactor_debug, "ftlreactor", 0,
+      "debug category for the ftlsink socket reactor");
+
+  if (sched_getaffinity (0, sizeof (allowed), &allowed) == 0) {
+    n_cpus = CPU_COUNT (&allowed);
+  } else {
+    GST_WARNING ("Failed to get the CPU affinity: %s", g_strerror (errno));
+    n_cpus = 0;
+  }
+
+  for (gint i = 0; i < CLAMP (n_cpus, 1, REACTOR_MAX_THREADS); i++) {
+    GstFtlReactorThread *thread = &threads[n_threads];
+
+    thread->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (thread->epoll_fd < 0) {
+      GST_ERROR ("Failed to create epoll instance: %s", g_strerror (errno));
+      break;
+    }
+
+    /* The next allowed CPU, if we know them */
+    thread->cpu = -1;
+    for (; n_cpus > 0 && cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET (cpu, &allowed)) {
+        thread->cpu = cpu++;
+        break;
+      }
+    }
+
+    g_mutex_init (&thread->lock);
+    g_cond_init (&thread->idle_cond);
+    thread->sources = g_ptr_array_new ();
+    thread->thread = g_thread_new ("ftlreactor", gst_ftl_reactor_thread,
+        thread);
+    n_threads++;
+  }
+
+  GST_INFO ("Started %u reactor threads", n_threads);
+  g_once_init_leave (&initialized, 1);
+}
+
+/* Calls @func from a reactor thread whenever @fd is readable, until the
+ * source is removed. @fd must stay open until then. */
+GstFtlReactorSource *
+gst_ftl_reactor_add (gint fd, GstFtlReactorFunc func, gpointer user_data,
+    GError ** error)
+{
+  GstFtlReactorSource *source;
+  GstFtlReactorThread *thread;
+  struct epoll_event event = { 0, };
+  guint index;
+
+  gst_ftl_reactor_start ();
+
+  if (n_threads == 0) {
+    g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+        "No reactor threads");
+    return NULL;
+  }
+
+  /* The counts only change under the locks, but a stale read merely makes
+   * the balance a little worse */
+  thread = &threads[0];
+  for (guint i = 1; i < n_threads; i++)
+    if (g_atomic_int_get (&threads[i].n_sources) <
+        g_atomic_int_get (&thread->n_sources))
+      thread = &threads[i];
+
+  source = g_new0 (GstFtlReactorSource, 1);
+  source->func = func;
+  source->user_data = user_data;
+  source->fd = fd;
+  source->thread = thread;
+
+  g_mutex_lock (&thread->lock);
+
+  for (index = 0; index < thread->sources->len; index++)
+    if (g_ptr_array_index (thread->sources, index) == NULL)
+      break;
+  if (index == thread->sources->len)
+    g_ptr_array_add (thread->sources, NULL);
+
+  source->index = index;
+  source->generation = ++thread->generation;
+
+  event.events = EPOLLIN;
+  event.data.u64 = (guint64) source->generation << 32 | index;
+  if (epoll_ctl (thread->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+        "Failed to watch socket: %s", g_strerror (errno));
+    g_mutex_unlock (&thread->lock);
+    g_free (source);
+    return NULL;
+  }
+
+  g_ptr_array_index (thread->sources, index) = source;
+  g_atomic_int_inc (&thread->n_sources);
+  g_mutex_unlock (&thread->lock);
+
+  GST_DEBUG ("Added source %p for fd %d to thread %u", source, fd,
+      (guint) (thread - threads));
+  return source;
+}
+
+/* Frees @source. Once this returns, its function is not running and won't
+ * be called again. May be called from the source's own function. */
+void
+gst_ftl_reactor_remove (GstFtlReactorSource * source)
+{
+  GstFtlReactorThread *thread = source->thread;
+
+  g_mutex_lock (&thread->lock);
+
+  if (epoll_ctl (thread->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL) < 0)
+    GST_WARNING ("Failed to unwatch fd %d: %s", source->fd,
+        g_strerror (errno));
+
+  g_ptr_array_index (thread->sources, source->index) = NULL;
+  g_atomic_int_add (&thread->n_sources, -1);
+
+  if (thread->thread != g_thread_self ())
+    while (thread->running == source)
+      g_cond_wait (&thread->idle_cond, &thread->lock);
+
+  g_mutex_unlock (&thread->lock);
+
+  GST_DEBUG ("Removed source %p", source);
+  g_free (source);
+}
@@ -0,0 +1,45 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _GST_FTL_REACTOR_H_
+#define _GST_FTL_REACTOR_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* For keeping state that different threads write apart */
+#define GST_FTL_CACHE_LINE_SIZE 64
+
+typedef struct _GstFtlReactorSource GstFtlReactorSource;
+
+typedef void (*GstFtlReactorFunc) (gint fd, gpointer user_data);
+
+GstFtlReactorSource * gst_ftl_reactor_add (gint fd, GstFtlReactorFunc func,
+    gpointer user_data, GError ** error);
+void gst_ftl_reactor_remove (GstFtlReactorSource * source);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Keeps the packets sent most recently so NACKed ones can be sent again.
+ *
+ * The slots form a ring indexed by the low bits of the RTP sequence
+ * number, so looking a packet up is a mask and a compare. Payloads are
+ * not copied, each slot holds a reference to the GstMemory the packet
+ * came from and maps it again when needed.
+ *
+ * Packets leave the ring in order once they are older than max_time, or
+ * early (an eviction) when the ring runs out of slots or max_bytes.
+ *
+ * Not thread-safe; the transport serializes access.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlrtxring.h"
+
+#include <string.h>
+
+/* Size slots for packets of this size on average, a bit under half of a
+ * full one */
+#define AVERAGE_PACKET_SIZE 512
+#define MIN_CAPACITY 256
+/* Half the sequence number space, so lookups stay unambiguous */
+#define MAX_CAPACITY 32768
+
+struct _GstFtlRtxRing
+{
+  GstFtlRtxPacket *slots;
+  guint mask;
+
+  /* The packets are the count ones before next_seq */
+  guint16 next_seq;
+  guint count;
+  gsize bytes;
+
+  gint64 max_time;
+  gsize max_bytes;
+};
+
+GstFtlRtxRing *
+gst_ftl_rtx_ring_new (GstClockTime max_time, gsize max_bytes)
+{
+  GstFtlRtxRing *ring = g_new0 (GstFtlRtxRing, 1);
+  guint capacity = MIN_CAPACITY;
+
+  while (capacity < MAX_CAPACITY &&
+      capacity < max_bytes / AVERAGE_PACKET_SIZE)
+    capacity *= 2;
+
+  ring->slots = g_new0 (GstFtlRtxPacket, capacity);
+  ring->mask = capacity - 1;
+  ring->max_time = GST_TIME_AS_USECONDS (max_time);
+  ring->max_bytes = max_bytes;
+
+  return ring;
+}
+
+void
+gst_ftl_rtx_ring_free (GstFtlRtxRing * ring)
+{
+  gst_ftl_rtx_ring_clear (ring);
+  g_free (ring->slots);
+  g_free (ring);
+}
+
+static void
+drop_oldest (GstFtlRtxRing * ring)
+{
+  GstFtlRtxPacket *packet =
+      &ring->slots[(guint16) (ring->next_seq - ring->count) & ring->mask];
+
+  gst_memory_unref (packet->memory);
+  packet->memory = NULL;
+  ring->bytes -= packet->size;
+  ring->count--;
+}
+
+/* Adds the packet sent with @seq at @now (in microseconds), which must
+ * follow the last one pushed; otherwise the ring starts over. Takes a
+ * reference to @memory. Returns the number of packets evicted to make
+ * room. */
+guint
+gst_ftl_rtx_ring_push (GstFtlRtxRing * ring, guint16 seq,
+    const guint8 * header, guint header_size, GstMemory * memory,
+    gsize offset, gsize size, gint64 now)
+{
+  GstFtlRtxPacket *packet;
+  guint evicted = 0;
+
+  g_return_val_if_fail (header_size <= GST_FTL_RTX_MAX_HEADER_SIZE, 0);
+
+  if (ring->count > 0 && seq != ring->next_seq)
+    gst_ftl_rtx_ring_clear (ring);
+
+  while (ring->count > 0 && now - ring->slots[(guint16) (ring->next_seq -
+              ring->count) & ring->mask].sent_time > ring->max_time)
+    drop_oldest (ring);
+
+  while (ring->count > 0 && (ring->count > ring->mask ||
+          ring->bytes + size > ring->max_bytes)) {
+    drop_oldest (ring);
+    evicted++;
+  }
+
+  packet = &ring->slots[seq & ring->mask];
+  memcpy (packet->header, header, header_size);
+  packet->header_size = header_size;
+  packet->memory = gst_memory_ref (memory);
+  packet->offset = offset;
+  packet->size = size;
+  packet->sent_time = now;
+  packet->seq = seq;
+
+  ring->next_seq = seq + 1;
+  ring->count++;
+  ring->bytes += size;
+
+  return evicted;
+}
+
+/* Returns the packet with @seq, or NULL if it already left the ring */
+const GstFtlRtxPacket *
+gst_ftl_rtx_ring_lookup (GstFtlRtxRing * ring, guint16 seq)
+{
+  guint16 age = ring->next_seq - 1 - seq;
+
+  if (age >= ring->count)
+    return NULL;
+
+  return &ring->slots[seq & ring->mask];
+}
+
+void
+gst_ftl_rtx_ring_clear (GstFtlRtxRing * ring)
+{
+  while (ring->count > 0)
+    drop_oldest (ring);
+}
+
+guint
+gst_ftl_rtx_ring_get_n_packets (GstFtlRtxRing * ring)
+{
+  return ring->count;
+}
+
+gsize
+gst_ftl_rtx_ring_get_bytes (GstFtlRtxRing * ring)
+{
+  return ring->bytes;
+}
+
+guint
+gst_ftl_rtx_ring_get_capacity (GstFtlRtxRing * ring)
+{
+  return ring->mask + 1;
+}
@@ -0,0 +1,64 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_RTX_RING_H_
+#define _GST_FTL_RTX_RING_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* RTP header plus FU-A indicator and header */
+#define GST_FTL_RTX_MAX_HEADER_SIZE 14
+
+typedef struct _GstFtlRtxRing GstFtlRtxRing;
+
+/* A sent packet: its header, and its payload as a range of @memory */
+typedef struct
+{
+  guint8 header[GST_FTL_RTX_MAX_HEADER_SIZE];
+  guint header_size;
+  GstMemory *memory;
+  gsize offset;
+  gsize size;
+  gint64 sent_time;
+  guint16 seq;
+} GstFtlRtxPacket;
+
+GstFtlRtxRing * gst_ftl_rtx_ring_new (GstClockTime max_time, gsize max_bytes);
+void gst_ftl_rtx_ring_free (GstFtlRtxRing * ring);
+
+guint gst_ftl_rtx_ring_push (GstFtlRtxRing * ring, guint16 seq,
+    const guint8 * header, guint header_size, GstMemory * memory,
+    gsize offset, gsize size, gint64 now);
+const GstFtlRtxPacket * gst_ftl_rtx_ring_lookup (GstFtlRtxRing * ring,
+    guint16 seq);
+void gst_ftl_rtx_ring_clear (GstFtlRtxRing * ring);
+
+guint gst_ftl_rtx_ring_get_n_packets (GstFtlRtxRing * ring);
+gsize gst_ftl_rtx_ring_get_bytes (GstFtlRtxRing * ring);
+guint gst_ftl_rtx_ring_get_capacity (GstFtlRtxRing * ring);
+
+G_END_DECLS
+
+#endif
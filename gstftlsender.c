@@ -0,0 +1,424 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Hands buffers from the streaming threads to a dedicated thread that
+ * performs the actual ftl_ingest_send_media_dts() calls, so stalls in
+ * libftl don't propagate back into the encoder.
+ *
+ * Each media type gets its own bounded single-producer/single-consumer
+ * ring, so the streaming threads only ever do two atomic operations and
+ * never block on each other or on the sender. The sender thread merges
+ * both rings in DTS order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftlsender.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_sender_debug);
+#define GST_CAT_DEFAULT gst_ftl_sender_debug
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct
+{
+  GstBuffer *buffer;
+  GstClockTime time;
+  gint64 enqueue_time;
+} GstFtlSenderItem;
+
+typedef struct
+{
+  /* Only written by the consumer */
+  gint head;
+  guint8 head_padding[CACHE_LINE_SIZE - sizeof (gint)];
+
+  /* Only written by the producer */
+  gint tail;
+  guint8 tail_padding[CACHE_LINE_SIZE - sizeof (gint)];
+
+  guint mask;
+  GstFtlSenderItem *items;
+} GstFtlSenderRing;
+
+struct _GstFtlSender
+{
+  GstObject *parent;
+
+  /* Indexed by ftl_media_type_t */
+  GstFtlSenderRing rings[2];
+
+  GstFtlSenderFunc func;
+  gpointer user_data;
+  /* Indexed by ftl_media_type_t, may be NULL */
+  GstFtlHistogram *queue_latency;
+
+  GThread *thread;
+  gint running;
+  gint sleeping;
+  GMutex lock;
+  GCond cond;
+  GCond idle_cond;
+
+  /* First error returned by func, handed back to the streaming threads */
+  gint flow;
+
+  /* Only touched by the video streaming thread */
+  gboolean video_need_keyframe;
+  /* Indexed by ftl_media_type_t, each only touched by the streaming
+   * thread of that media. Buffers dropped since the queue filled up. */
+  guint full_dropped[2];
+
+  gint dropped;
+
+  /* Interval statistics, protected by lock */
+  guint depth_max;
+  guint64 latency_count;
+  GstClockTime latency_sum;
+  GstClockTime latency_max;
+};
+
+static gpointer gst_ftl_sender_thread (gpointer user_data);
+
+static void
+ring_init (GstFtlSenderRing * ring, guint capacity)
+{
+  guint size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+
+  ring->head = ring->tail = 0;
+  ring->mask = size - 1;
+  ring->items = g_new0 (GstFtlSenderItem, size);
+}
+
+static guint
+ring_length (GstFtlSenderRing * ring)
+{
+  guint head = g_atomic_int_get (&ring->head);
+  guint tail = g_atomic_int_get (&ring->tail);
+
+  return tail - head;
+}
+
+static gboolean
+ring_push (GstFtlSenderRing * ring, const GstFtlSenderItem * item)
+{
+  guint tail = g_atomic_int_get (&ring->tail);
+  guint head = g_atomic_int_get (&ring->head);
+
+  if (tail - head > ring->mask)
+    return FALSE;
+
+  ring->items[tail & ring->mask] = *item;
+  g_atomic_int_set (&ring->tail, tail + 1);
+  return TRUE;
+}
+
+static GstFtlSenderItem *
+ring_peek (GstFtlSenderRing * ring)
+{
+  guint head = g_atomic_int_get (&ring->head);
+  guint tail = g_atomic_int_get (&ring->tail);
+
+  if (head == tail)
+    return NULL;
+
+  return &ring->items[head & ring->mask];
+}
+
+/* Releases the slot returned by ring_peek() back to the producer */
+static void
+ring_pop (GstFtlSenderRing * ring)
+{
+  guint head = g_atomic_int_get (&ring->head);
+
+  g_atomic_int_set (&ring->head, head + 1);
+}
+
+static void
+ring_clear (GstFtlSenderRing * ring)
+{
+  GstFtlSenderItem *item;
+
+  while ((item = ring_peek (ring)) != NULL) {
+    gst_buffer_unref (item->buffer);
+    ring_pop (ring);
+  }
+
+  g_free (ring->items);
+}
+
+GstFtlSender *
+gst_ftl_sender_new (GstObject * parent, guint capacity,
+    GstFtlSenderFunc func, gpointer user_data,
+    GstFtlHistogram * queue_latency)
+{
+  static gsize debug_initialized = 0;
+  GstFtlSender *sender;
+
+  if (g_once_init_enter (&debug_initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ftl_sender_debug, "ftlsender", 0,
+        "debug category for ftlsink sender thread");
+    g_once_init_leave (&debug_initialized, 1);
+  }
+
+  sender = g_new0 (GstFtlSender, 1);
+  sender->parent = parent;
+  ring_init (&sender->rings[FTL_AUDIO_DATA], capacity);
+  ring_init (&sender->rings[FTL_VIDEO_DATA], capacity);
+  sender->func = func;
+  sender->user_data = user_data;
+  sender->queue_latency = queue_latency;
+  sender->flow = GST_FLOW_OK;
+  sender->running = TRUE;
+  g_mutex_init (&sender->lock);
+  g_cond_init (&sender->cond);
+  g_cond_init (&sender->idle_cond);
+
+  sender->thread = g_thread_new ("ftlsender", gst_ftl_sender_thread, sender);
+  return sender;
+}
+
+/* Stops the sender thread, dropping whatever is still queued */
+void
+gst_ftl_sender_free (GstFtlSender * sender)
+{
+  g_mutex_lock (&sender->lock);
+  g_atomic_int_set (&sender->running, FALSE);
+  g_cond_signal (&sender->cond);
+  g_cond_broadcast (&sender->idle_cond);
+  g_mutex_unlock (&sender->lock);
+
+  g_thread_join (sender->thread);
+
+  GST_DEBUG_OBJECT (sender->parent, "dropping %u audio and %u video buffers",
+      ring_length (&sender->rings[FTL_AUDIO_DATA]),
+      ring_length (&sender->rings[FTL_VIDEO_DATA]));
+
+  ring_clear (&sender->rings[FTL_AUDIO_DATA]);
+  ring_clear (&sender->rings[FTL_VIDEO_DATA]);
+
+  g_mutex_clear (&sender->lock);
+  g_cond_clear (&sender->cond);
+  g_cond_clear (&sender->idle_cond);
+  g_free (sender);
+}
+
+static gboolean
+gst_ftl_sender_is_empty (GstFtlSender * sender)
+{
+  return ring_length (&sender->rings[FTL_AUDIO_DATA]) == 0 &&
+      ring_length (&sender->rings[FTL_VIDEO_DATA]) == 0;
+}
+
+/* Called from the streaming thread of @media_type. Takes a reference to
+ * @buffer if it gets queued. */
+GstFlowReturn
+gst_ftl_sender_push (GstFtlSender * sender, ftl_media_type_t media_type,
+    GstBuffer * buffer, GstClockTime time)
+{
+  GstFtlSenderItem item;
+  GstFlowReturn ret;
+
+  ret = g_atomic_int_get (&sender->flow);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  /* After dropping video, only a keyframe makes the stream decodable
+   * again */
+  if (media_type == FTL_VIDEO_DATA && sender->video_need_keyframe) {
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+      GST_LOG_OBJECT (sender->parent, "waiting for keyframe, dropping %"
+          GST_PTR_FORMAT, buffer);
+      g_atomic_int_inc (&sender->dropped);
+      return GST_FLOW_OK;
+    }
+    sender->video_need_keyframe = FALSE;
+  }
+
+  item.buffer = gst_buffer_ref (buffer);
+  item.time = time;
+  item.enqueue_time = g_get_monotonic_time ();
+
+  if (!ring_push (&sender->rings[media_type], &item)) {
+    if (sender->full_dropped[media_type]++ == 0)
+      GST_WARNING_OBJECT (sender->parent, "%s queue full, dropping buffers",
+          media_type == FTL_VIDEO_DATA ? "video" : "audio");
+    gst_buffer_unref (buffer);
+    g_atomic_int_inc (&sender->dropped);
+    if (media_type == FTL_VIDEO_DATA)
+      sender->video_need_keyframe = TRUE;
+    return GST_FLOW_OK;
+  }
+
+  if (sender->full_dropped[media_type] > 0) {
+    GST_WARNING_OBJECT (sender->parent, "%s queue has room again after "
+        "dropping %u buffers", media_type == FTL_VIDEO_DATA ? "video" :
+        "audio", sender->full_dropped[media_type]);
+    sender->full_dropped[media_type] = 0;
+  }
+
+  if (g_atomic_int_get (&sender->sleeping)) {
+    g_mutex_lock (&sender->lock);
+    g_cond_signal (&sender->cond);
+    g_mutex_unlock (&sender->lock);
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Blocks until everything queued so far has been sent */
+void
+gst_ftl_sender_drain (GstFtlSender * sender)
+{
+  g_mutex_lock (&sender->lock);
+  while (g_atomic_int_get (&sender->running) &&
+      !gst_ftl_sender_is_empty (sender))
+    g_cond_wait (&sender->idle_cond, &sender->lock);
+  g_mutex_unlock (&sender->lock);
+}
+
+/* Returns how full the queue of @media_type is, in percent */
+guint
+gst_ftl_sender_get_fill_level (GstFtlSender * sender,
+    ftl_media_type_t media_type)
+{
+  GstFtlSenderRing *ring = &sender->rings[media_type];
+
+  return ring_length (ring) * 100 / (ring->mask + 1);
+}
+
+/* Adds the sender statistics to @structure and starts a new interval */
+void
+gst_ftl_sender_take_stats (GstFtlSender * sender, GstStructure * structure)
+{
+  guint depth = ring_length (&sender->rings[FTL_AUDIO_DATA]) +
+      ring_length (&sender->rings[FTL_VIDEO_DATA]);
+  GstClockTime latency_avg = 0;
+
+  g_mutex_lock (&sender->lock);
+
+  if (sender->latency_count > 0)
+    latency_avg = sender->latency_sum / sender->latency_count;
+
+  gst_structure_set (structure,
+      "send-queue-depth", G_TYPE_UINT, depth,
+      "send-queue-depth-max", G_TYPE_UINT, MAX (depth, sender->depth_max),
+      "send-queue-dropped", G_TYPE_UINT,
+      (guint) g_atomic_int_get (&sender->dropped),
+      "send-latency-avg", GST_TYPE_CLOCK_TIME, latency_avg,
+      "send-latency-max", GST_TYPE_CLOCK_TIME, sender->latency_max, NULL);
+
+  sender->depth_max = 0;
+  sender->latency_count = 0;
+  sender->latency_sum = 0;
+  sender->latency_max = 0;
+
+  g_mutex_unlock (&sender->lock);
+}
+
+/* Picks the ring whose head has the lowest DTS */
+static GstFtlSenderRing *
+gst_ftl_sender_next_ring (GstFtlSender * sender)
+{
+  GstFtlSenderRing *audio = &sender->rings[FTL_AUDIO_DATA];
+  GstFtlSenderRing *video = &sender->rings[FTL_VIDEO_DATA];
+  GstFtlSenderItem *audio_item = ring_peek (audio);
+  GstFtlSenderItem *video_item = ring_peek (video);
+
+  if (audio_item == NULL)
+    return video_item ? video : NULL;
+  if (video_item == NULL)
+    return audio;
+
+  return audio_item->time <= video_item->time ? audio : video;
+}
+
+static gpointer
+gst_ftl_sender_thread (gpointer user_data)
+{
+  GstFtlSender *sender = user_data;
+
+  GST_DEBUG_OBJECT (sender->parent, "sender thread started");
+
+  while (g_atomic_int_get (&sender->running)) {
+    GstFtlSenderRing *ring = gst_ftl_sender_next_ring (sender);
+    ftl_media_type_t media_type;
+    GstFtlSenderItem item;
+    GstFlowReturn ret;
+    GstClockTime latency;
+    guint depth;
+
+    if (ring == NULL) {
+      g_mutex_lock (&sender->lock);
+      g_atomic_int_set (&sender->sleeping, TRUE);
+      while (g_atomic_int_get (&sender->running) &&
+          gst_ftl_sender_is_empty (sender)) {
+        g_cond_broadcast (&sender->idle_cond);
+        g_cond_wait (&sender->cond, &sender->lock);
+      }
+      g_atomic_int_set (&sender->sleeping, FALSE);
+      g_mutex_unlock (&sender->lock);
+      continue;
+    }
+
+    media_type = ring == &sender->rings[FTL_VIDEO_DATA] ?
+        FTL_VIDEO_DATA : FTL_AUDIO_DATA;
+    item = *ring_peek (ring);
+    depth = ring_length (&sender->rings[FTL_AUDIO_DATA]) +
+        ring_length (&sender->rings[FTL_VIDEO_DATA]);
+
+    if (sender->queue_latency != NULL)
+      gst_ftl_histogram_record (&sender->queue_latency[media_type],
+          (g_get_monotonic_time () - item.enqueue_time) * GST_USECOND);
+
+    ret = sender->func (media_type, item.buffer, item.time, sender->user_data);
+    latency = (g_get_monotonic_time () - item.enqueue_time) * GST_USECOND;
+
+    /* Only release the slot once sent, so an empty sender is a drained
+     * sender */
+    gst_buffer_unref (item.buffer);
+    ring_pop (ring);
+
+    if (ret != GST_FLOW_OK) {
+      GST_DEBUG_OBJECT (sender->parent, "send returned %s",
+          gst_flow_get_name (ret));
+      g_atomic_int_compare_and_exchange (&sender->flow, GST_FLOW_OK, ret);
+    }
+
+    g_mutex_lock (&sender->lock);
+    sender->depth_max = MAX (sender->depth_max, depth);
+    sender->latency_count++;
+    sender->latency_sum += latency;
+    sender->latency_max = MAX (sender->latency_max, latency);
+    g_mutex_unlock (&sender->lock);
+  }
+
+  GST_DEBUG_OBJECT (sender->parent, "sender thread stopped");
+  return NULL;
+}
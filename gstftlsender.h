@@ -0,0 +1,54 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_SENDER_H_
+#define _GST_FTL_SENDER_H_
+
+#include <gst/gst.h>
+#include "ftl.h"
+#include "gstftlhistogram.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstFtlSender GstFtlSender;
+
+typedef GstFlowReturn (*GstFtlSenderFunc) (ftl_media_type_t media_type,
+    GstBuffer * buffer, GstClockTime time, gpointer user_data);
+
+GstFtlSender * gst_ftl_sender_new (GstObject * parent, guint capacity,
+    GstFtlSenderFunc func, gpointer user_data,
+    GstFtlHistogram * queue_latency);
+void gst_ftl_sender_free (GstFtlSender * sender);
+
+GstFlowReturn gst_ftl_sender_push (GstFtlSender * sender,
+    ftl_media_type_t media_type, GstBuffer * buffer, GstClockTime time);
+void gst_ftl_sender_drain (GstFtlSender * sender);
+guint gst_ftl_sender_get_fill_level (GstFtlSender * sender,
+    ftl_media_type_t media_type);
+
+void gst_ftl_sender_take_stats (GstFtlSender * sender,
+    GstStructure * structure);
+
+G_END_DECLS
+
+#endif
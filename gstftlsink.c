@@ -41,41 +41,174 @@
 
 #include "gstftlsink.h"
 
+#include "gstftldispatcher.h"
 #include "gstftlenums.h"
+#include "gstftlgopcache.h"
+#include "gstftlhistogram.h"
+#include "gstftlmirror.h"
+#include "gstftlprobe.h"
+#include "gstftlsender.h"
+#include "gstftltransport.h"
 #include "gstftlvideosink.h"
 #include "gstftlaudiosink.h"
 #include <inttypes.h>
-
-#define STATUS_POLL_RATE_MS 200
+#include <string.h>
+
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_ENCODER_BITRATE_PROPERTY "bitrate"
+#define DEFAULT_NAL_DROP_POLICY 0
+#define DEFAULT_NAL_DROP_THRESHOLD 50
+#define DEFAULT_NAL_SKIP_THRESHOLD 90
+#define DEFAULT_ENCODER_BITRATE_DIVISOR 1000
+#define DEFAULT_BITRATE_HYSTERESIS 10
+#define MAX_ENCODER_SEARCH_DEPTH 16
+#define DEFAULT_SEND_QUEUE_SIZE 64
+#define DEFAULT_GOP_CACHE_SIZE (4 * 1024 * 1024)
+#define DEFAULT_GOP_CACHE_REPLAY FALSE
+#define DEFAULT_RECONNECT_ATTEMPTS 5
+#define DEFAULT_RECONNECT_BACKOFF_MIN (100 * GST_MSECOND)
+#define DEFAULT_RECONNECT_BACKOFF_MAX (5 * GST_SECOND)
+#define DEFAULT_INGEST_PROBE_TTL (5 * 60 * GST_SECOND)
+#define DEFAULT_MEDIA_TRANSPORT GST_FTL_TRANSPORT_LIBFTL
+#define DEFAULT_RETRANSMIT_TIME GST_SECOND
+#define DEFAULT_RETRANSMIT_SIZE (4 * 1024 * 1024)
+#define DEFAULT_PACING_FRACTION 0.0
+#define DEFAULT_FEC_PERCENTAGE 0
+#define INGEST_PROBE_TIMEOUT GST_SECOND
 
 GST_DEBUG_CATEGORY_STATIC (gst_debug_ftl_sink);
 #define GST_CAT_DEFAULT gst_debug_ftl_sink
 
 static GQuark ftl_stats_id;
+static GQuark ftl_reconnecting_id;
+static GQuark ftl_reconnected_id;
+
+typedef enum
+{
+  GST_FTL_SINK_DISCONNECTED,
+  GST_FTL_SINK_CONNECTING,
+  GST_FTL_SINK_CONNECTED,
+  GST_FTL_SINK_RECONNECTING,
+  GST_FTL_SINK_CONNECT_FAILED,
+} GstFtlSinkConnectionState;
+
+typedef struct
+{
+  ftl_packet_stats_msg_t packets;
+  ftl_video_frame_stats_msg_t frames;
+} GstFtlSinkStatusTotals;
 
 struct _GstFtlSink
 {
   GstBin parent_instance;
 
   gchar *ingest_hostname;
+  gchar **ingest_candidates;
+  GstClockTime ingest_probe_ttl;
+  /* What we passed to libftl, and its RTT if we probed for it */
+  gchar *selected_ingest;
+  GstClockTime selected_ingest_rtt;
   gchar *stream_key;
   gboolean sync;
   guint peak_kbps;
 
+  gboolean adaptive_bitrate;
+  guint min_kbps;
+  guint max_kbps;
+  guint bitrate_hysteresis;
+  gchar *encoder_bitrate_property;
+  guint encoder_bitrate_divisor;
+  /* Used by the status task only */
+  guint64 target_bitrate;
+
+  /* Read atomically, for every video buffer */
+  gint nal_drop_policy;         /* GstFtlNalDropFlags */
+  gint nal_drop_threshold;
+  gint nal_skip_threshold;
+  /* Video queue fill level in percent as last reported by libftl, raised to
+   * nal_drop_threshold while it throttles. Read atomically. */
+  gint ftl_queue_level;
+
   GstPad *audiosinkpad;
   GstPad *videosinkpad;
 
   GstElement *ftlvideosink;
   GstElement *ftlaudiosink;
 
+  /* Created on the first connect, when the framerate is known. Set
+   * atomically, the status dispatcher reads it. */
   ftl_handle_t handle;
+  gint handle_created;
   GMutex connect_lock;
+  /* From the video caps, 0/1 if unknown */
+  gint fps_n, fps_d;
+
+  GstFtlTransportMode media_transport;
+  guint media_port;
+  GstClockTime retransmit_time;
+  guint retransmit_size;
+  gdouble pacing_fraction;
+  gint fec_percentage;
+  /* Sends our media instead of libftl while connected, unless
+   * media_transport is libftl */
+  GstFtlTransport *transport;
+  /* Held for reading while sending through the transport, for writing while
+   * reopening it after a reconnect */
+  GRWLock send_lock;
 
   gboolean async_connect;
-  gboolean connected;
-
-  GstTask *status_task;
-  GRecMutex status_lock;
+  gint connection_state;        /* GstFtlSinkConnectionState */
+
+  gint reconnect_attempts;
+  GstClockTime reconnect_backoff_min;
+  GstClockTime reconnect_backoff_max;
+
+  /* Buffers rendered while (re)connecting, and the current GOP if we
+   * may have to reconnect. Also protects the connection state
+   * transitions other than to CONNECTED from the streaming threads. */
+  GMutex cache_lock;
+  GstFtlGopCache *gop_cache;
+  guint gop_cache_size;
+  gboolean gop_cache_replay;
+  /* gop_cache_replay while we may reconnect, fixed while running */
+  gboolean gop_cache_retain;
+  /* Indexed by ftl_media_type_t, only used by that stream's thread */
+  gboolean cache_pending[2];
+  gint video_need_keyframe;
+
+  /* Background (re)connect, protected by cache_lock */
+  GThread *connect_thread;
+  GCond connect_cond;
+  gboolean connect_cancelled;
+
+  gboolean async_send;
+  guint send_queue_size;
+  GstFtlSender *sender;
+
+  /* GstStructures from the mirrors property */
+  GPtrArray *mirror_targets;
+  /* GstFtlMirrors while PAUSED or PLAYING. Streaming threads use it
+   * without locking, stats readers under the object lock. */
+  GPtrArray *mirrors;
+
+  /* Drains libftl's status queue while PAUSED or PLAYING */
+  GstFtlDispatchEntry *status_entry;
+
+  GstFtlCounters counters;
+  /* Indexed by ftl_media_type_t */
+  GstFtlHistogram latency[GST_FTL_N_LATENCY_STAGES][2];
+  GstFtlHistogram pacing_error;
+
+  GstClockTime stats_interval;
+  GstClockTime next_stats_time;
+  GstStructure *stats_message;
+
+  /* Used by the status task only. Indexed by ftl_media_type_t. */
+  GstFtlSinkStatusTotals status_base[2];
+  GstFtlSinkStatusTotals status_last[2];
+  guint64 bitrate_changes;
+  guint64 frames_dropped_reports;
+  guint64 network_reports;
 };
 
 static void gst_ftl_sink_finalize (GObject * object);
@@ -85,9 +218,11 @@ static void gst_ftl_sink_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * param_spec);
 static GstStateChangeReturn gst_ftl_sink_change_state (GstElement * element,
     GstStateChange transition);
-static void gst_ftl_sink_status_loop (gpointer user_data);
+static void gst_ftl_sink_dispatch_status (gpointer user_data);
+static void gst_ftl_sink_stop_status (GstFtlSink * self);
 static void gst_ftl_sink_handle_event (GstFtlSink * self,
     ftl_status_event_msg_t * event);
+static GstStructure *gst_ftl_sink_get_stats (GstFtlSink * self);
 
 enum
 {
@@ -101,12 +236,39 @@ enum
   PROP_ASYNC_CONNECT,
   PROP_SYNC,
   PROP_INGEST_HOSTNAME,
+  PROP_INGEST_CANDIDATES,
+  PROP_INGEST_PROBE_TTL,
   PROP_STREAM_KEY,
   PROP_PEAK_KBPS,
+  PROP_ASYNC_SEND,
+  PROP_SEND_QUEUE_SIZE,
+  PROP_GOP_CACHE_SIZE,
+  PROP_GOP_CACHE_REPLAY,
+  PROP_RECONNECT_ATTEMPTS,
+  PROP_RECONNECT_BACKOFF_MIN,
+  PROP_RECONNECT_BACKOFF_MAX,
+  PROP_STATS_INTERVAL,
+  PROP_STATS,
+  PROP_ADAPTIVE_BITRATE,
+  PROP_MIN_KBPS,
+  PROP_MAX_KBPS,
+  PROP_BITRATE_HYSTERESIS,
+  PROP_ENCODER_BITRATE_PROPERTY,
+  PROP_ENCODER_BITRATE_DIVISOR,
+  PROP_NAL_DROP_POLICY,
+  PROP_NAL_DROP_THRESHOLD,
+  PROP_NAL_SKIP_THRESHOLD,
+  PROP_MIRRORS,
+  PROP_MEDIA_TRANSPORT,
+  PROP_MEDIA_PORT,
+  PROP_RETRANSMIT_TIME,
+  PROP_RETRANSMIT_SIZE,
+  PROP_PACING_FRACTION,
+  PROP_FEC_PERCENTAGE,
   N_PROPERTIES,
 };
 
-static guint G_GNUC_UNUSED signals[N_SIGNALS] = { 0, };
+static guint signals[N_SIGNALS] = { 0, };
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
 #define gst_ftl_sink_parent_class parent_class
@@ -139,6 +301,8 @@ gst_ftl_sink_class_init (GstFtlSinkClass * klass)
       "debug category for ftlsink element");
 
   ftl_stats_id = g_quark_from_static_string ("ftl-stats");
+  ftl_reconnecting_id = g_quark_from_static_string ("ftl-reconnecting");
+  ftl_reconnected_id = g_quark_from_static_string ("ftl-reconnected");
 
   gst_element_class_set_metadata (element_class,
       "FTL Sink", "Sink",
@@ -155,7 +319,8 @@ gst_ftl_sink_class_init (GstFtlSinkClass * klass)
   gobject_class->finalize = gst_ftl_sink_finalize;
 
   properties[PROP_ASYNC_CONNECT] = g_param_spec_boolean ("async-connect",
-      "Async connect", "Connect on PAUSED, otherwise on first push", TRUE,
+      "Async connect", "Connect on PAUSED, otherwise in the background on "
+      "first push", TRUE,
       G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
       GST_PARAM_MUTABLE_READY);
 
@@ -164,7 +329,20 @@ gst_ftl_sink_class_init (GstFtlSinkClass * klass)
       G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
   properties[PROP_INGEST_HOSTNAME] = g_param_spec_string ("ingest-hostname",
-      "Ingest hostname", "Hostname to connect to", "auto",
+      "Ingest hostname", "Hostname to connect to (auto = pick the fastest "
+      "of ingest-candidates, or let libftl choose)", "auto",
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_INGEST_CANDIDATES] = g_param_spec_boxed ("ingest-candidates",
+      "Ingest candidates", "Ingest hostnames to probe in parallel when "
+      "ingest-hostname is auto. The one with the lowest RTT gets used.",
+      G_TYPE_STRV,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_INGEST_PROBE_TTL] = g_param_spec_uint64 ("ingest-probe-ttl",
+      "Ingest probe TTL", "How long to reuse the result of probing "
+      "ingest-candidates, in nanoseconds (0 = probe every time)",
+      0, G_MAXUINT64, DEFAULT_INGEST_PROBE_TTL,
       G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
   properties[PROP_STREAM_KEY] = g_param_spec_string ("stream-key", "Stream key",
@@ -175,11 +353,178 @@ gst_ftl_sink_class_init (GstFtlSinkClass * klass)
       "Bitrate in kbit/sec to pace outgoing packets", 0, G_MAXINT, 0,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_ASYNC_SEND] = g_param_spec_boolean ("async-send",
+      "Async send", "Hand buffers to a separate thread for sending instead of "
+      "sending from the streaming threads", FALSE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+      GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_SEND_QUEUE_SIZE] = g_param_spec_uint ("send-queue-size",
+      "Send queue size", "Maximum number of buffers per stream queued for "
+      "the send thread when async-send is enabled", 1, G_MAXUINT16,
+      DEFAULT_SEND_QUEUE_SIZE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+      GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_GOP_CACHE_SIZE] = g_param_spec_uint ("gop-cache-size",
+      "GOP cache size", "Maximum number of bytes buffered from the last "
+      "keyframe while connecting, and kept for replay after reconnecting "
+      "if gop-cache-replay is set (0 = drop)", 0, G_MAXUINT,
+      DEFAULT_GOP_CACHE_SIZE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+      GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_GOP_CACHE_REPLAY] = g_param_spec_boolean ("gop-cache-replay",
+      "GOP cache replay", "Keep the current GOP while connected and replay "
+      "it after reconnecting. Costs a cache entry per buffer and holds up to "
+      "gop-cache-size bytes; without it, video resumes at the next keyframe",
+      DEFAULT_GOP_CACHE_REPLAY,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+      GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_RECONNECT_ATTEMPTS] = g_param_spec_int ("reconnect-attempts",
+      "Reconnect attempts", "Number of times to try reconnecting after the "
+      "connection was lost before erroring out (0 = don't reconnect, "
+      "-1 = unlimited)", -1, G_MAXINT, DEFAULT_RECONNECT_ATTEMPTS,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+      GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_RECONNECT_BACKOFF_MIN] =
+      g_param_spec_uint64 ("reconnect-backoff-min", "Minimum reconnect backoff",
+      "Time to wait before the first reconnect attempt, doubled for every "
+      "further attempt", 0, G_MAXUINT64, DEFAULT_RECONNECT_BACKOFF_MIN,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_RECONNECT_BACKOFF_MAX] =
+      g_param_spec_uint64 ("reconnect-backoff-max", "Maximum reconnect backoff",
+      "Maximum time to wait between reconnect attempts", 0, G_MAXUINT64,
+      DEFAULT_RECONNECT_BACKOFF_MAX,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_STATS_INTERVAL] = g_param_spec_uint64 ("stats-interval",
+      "Stats interval", "Interval between ftl-stats messages (0 = whenever "
+      "libftl reports statistics)", 0, G_MAXUINT64, DEFAULT_STATS_INTERVAL,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_STATS] = g_param_spec_boxed ("stats", "Stats",
+      "Totals since the last change to PAUSED, as in the ftl-stats message",
+      GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ADAPTIVE_BITRATE] = g_param_spec_boolean ("adaptive-bitrate",
+      "Adaptive bitrate", "Follow libftl's bitrate changes by sending an "
+      "ftl-bitrate-changed upstream event and setting the encoder's bitrate",
+      FALSE, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MIN_KBPS] = g_param_spec_uint ("min-kbps", "Minimum bitrate",
+      "Lowest bitrate in kbit/sec to adapt to (0 = no limit)", 0, G_MAXINT, 0,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MAX_KBPS] = g_param_spec_uint ("max-kbps", "Maximum bitrate",
+      "Highest bitrate in kbit/sec to adapt to (0 = no limit)", 0, G_MAXINT, 0,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BITRATE_HYSTERESIS] =
+      g_param_spec_uint ("bitrate-hysteresis", "Bitrate hysteresis",
+      "Ignore bitrate changes smaller than this percentage of the current "
+      "target", 0, 100, DEFAULT_BITRATE_HYSTERESIS,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ENCODER_BITRATE_PROPERTY] =
+      g_param_spec_string ("encoder-bitrate-property",
+      "Encoder bitrate property", "Property to set on the closest upstream "
+      "element that has it (NULL = only send the event)",
+      DEFAULT_ENCODER_BITRATE_PROPERTY,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ENCODER_BITRATE_DIVISOR] =
+      g_param_spec_uint ("encoder-bitrate-divisor", "Encoder bitrate divisor",
+      "Bits per second per unit of the encoder's bitrate property",
+      1, G_MAXUINT, DEFAULT_ENCODER_BITRATE_DIVISOR,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_NAL_DROP_POLICY] = g_param_spec_flags ("nal-drop-policy",
+      "NAL drop policy", "Which video NALUs may be dropped to shed bytes "
+      "(none by default)",
+      GST_TYPE_FTL_NAL_DROP_FLAGS, DEFAULT_NAL_DROP_POLICY,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_NAL_DROP_THRESHOLD] =
+      g_param_spec_uint ("nal-drop-threshold", "NAL drop threshold",
+      "Send queue fill level in percent above which non-reference slices "
+      "are dropped", 0, 100, DEFAULT_NAL_DROP_THRESHOLD,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_NAL_SKIP_THRESHOLD] =
+      g_param_spec_uint ("nal-skip-threshold", "NAL skip threshold",
+      "Send queue fill level in percent above which video is dropped until "
+      "the next keyframe", 0, 100, DEFAULT_NAL_SKIP_THRESHOLD,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MIRRORS] = gst_param_spec_array ("mirrors", "Mirrors",
+      "Additional ingests that get a copy of the stream, as ftl-mirror "
+      "structures with hostname and stream-key fields. They reconnect on "
+      "their own and never fail the element.",
+      g_param_spec_boxed ("mirror", "Mirror", "Ingest hostname and stream key",
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+
+  properties[PROP_MEDIA_TRANSPORT] = g_param_spec_enum ("media-transport",
+      "Media transport", "How media gets to the main ingest. The native "
+      "transports only use libftl for the handshake and send each frame's "
+      "packets with as few syscalls as possible. They need a known ingest, "
+      "from ingest-hostname or ingest-candidates, not libftl's auto.",
+      GST_TYPE_FTL_TRANSPORT_MODE, DEFAULT_MEDIA_TRANSPORT,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MEDIA_PORT] = g_param_spec_uint ("media-port",
+      "Media port", "UDP port of the ingest for the native transports. "
+      "libftl doesn't tell which port the ingest assigned.", 1, G_MAXUINT16,
+      GST_FTL_TRANSPORT_DEFAULT_PORT,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_RETRANSMIT_TIME] = g_param_spec_uint64 ("retransmit-time",
+      "Retransmit time", "How long the native transports keep sent packets "
+      "for retransmission (0 = no retransmissions)", 0, G_MAXUINT64,
+      DEFAULT_RETRANSMIT_TIME,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_RETRANSMIT_SIZE] = g_param_spec_uint ("retransmit-size",
+      "Retransmit size", "Bytes of payload the native transports keep per "
+      "stream for retransmission, dropping packets early if needed "
+      "(0 = no retransmissions)", 0, G_MAXUINT, DEFAULT_RETRANSMIT_SIZE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_PACING_FRACTION] = g_param_spec_double ("pacing-fraction",
+      "Pacing fraction", "Fraction of the frame interval the native "
+      "transports spread each video frame's packets over instead of "
+      "sending them in a burst (0 = no pacing). Needs a framerate in the "
+      "caps and alignment=au. With async-send, audio waits meanwhile.",
+      0.0, 1.0, DEFAULT_PACING_FRACTION,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FEC_PERCENTAGE] = g_param_spec_int ("fec-percentage",
+      "FEC percentage", "XOR parity packets the native transports add per "
+      "100 video packets, at least one per 16 (0 = no FEC, -1 = adapt to "
+      "the share of packets the ingest NACKs)", -1, 50,
+      DEFAULT_FEC_PERCENTAGE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, N_PROPERTIES, properties);
 
+  /**
+   * GstFtlSink::get-stats:
+   * @ftlsink: the #GstFtlSink
+   *
+   * Returns: (transfer full): the same #GstStructure as the stats property
+   */
+  signals[SIGNAL_GET_STATS] = g_signal_new_class_handler ("get-stats",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_CALLBACK (gst_ftl_sink_get_stats), NULL, NULL, NULL,
+      GST_TYPE_STRUCTURE, 0);
+
   element_class->change_state = GST_DEBUG_FUNCPTR (gst_ftl_sink_change_state);
 
-  GST_DEBUG_REGISTER_FUNCPTR (gst_ftl_sink_status_loop);
+  GST_DEBUG_REGISTER_FUNCPTR (gst_ftl_sink_dispatch_status);
 }
 
 static void
@@ -215,11 +560,17 @@ gst_ftl_sink_init (GstFtlSink * self)
   g_object_bind_property (self, "sync", self->ftlaudiosink, "sync",
       G_BINDING_DEFAULT);
 
-  self->status_task = gst_task_new (gst_ftl_sink_status_loop, self, NULL);
-  g_rec_mutex_init (&self->status_lock);
-  gst_task_set_lock (self->status_task, &self->status_lock);
-
   g_mutex_init (&self->connect_lock);
+  g_rw_lock_init (&self->send_lock);
+
+  g_mutex_init (&self->cache_lock);
+  self->gop_cache = gst_ftl_gop_cache_new ();
+  g_cond_init (&self->connect_cond);
+
+  self->mirror_targets =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+  self->selected_ingest_rtt = GST_CLOCK_TIME_NONE;
+  self->fps_d = 1;
 }
 
 static void
@@ -227,10 +578,23 @@ gst_ftl_sink_finalize (GObject * object)
 {
   GstFtlSink *self = GST_FTL_SINK (object);
 
-  g_clear_object (&self->status_task);
-  g_rec_mutex_clear (&self->status_lock);
+  g_free (self->ingest_hostname);
+  g_strfreev (self->ingest_candidates);
+  g_free (self->selected_ingest);
+  g_free (self->stream_key);
+  g_free (self->encoder_bitrate_property);
+
+  if (self->stats_message != NULL)
+    gst_structure_free (self->stats_message);
 
   g_mutex_clear (&self->connect_lock);
+  g_rw_lock_clear (&self->send_lock);
+
+  gst_ftl_gop_cache_free (self->gop_cache);
+  g_mutex_clear (&self->cache_lock);
+  g_cond_clear (&self->connect_cond);
+
+  g_ptr_array_unref (self->mirror_targets);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -257,6 +621,15 @@ gst_ftl_sink_set_property (GObject * object, guint prop_id,
       self->ingest_hostname = g_value_dup_string (value);
       break;
 
+    case PROP_INGEST_CANDIDATES:
+      g_strfreev (self->ingest_candidates);
+      self->ingest_candidates = g_value_dup_boxed (value);
+      break;
+
+    case PROP_INGEST_PROBE_TTL:
+      self->ingest_probe_ttl = g_value_get_uint64 (value);
+      break;
+
     case PROP_STREAM_KEY:
       g_free (self->stream_key);
       self->stream_key = g_value_dup_string (value);
@@ -266,6 +639,112 @@ gst_ftl_sink_set_property (GObject * object, guint prop_id,
       self->peak_kbps = g_value_get_uint (value);
       break;
 
+    case PROP_ASYNC_SEND:
+      self->async_send = g_value_get_boolean (value);
+      break;
+
+    case PROP_SEND_QUEUE_SIZE:
+      self->send_queue_size = g_value_get_uint (value);
+      break;
+
+    case PROP_GOP_CACHE_SIZE:
+      self->gop_cache_size = g_value_get_uint (value);
+      break;
+
+    case PROP_GOP_CACHE_REPLAY:
+      self->gop_cache_replay = g_value_get_boolean (value);
+      break;
+
+    case PROP_RECONNECT_ATTEMPTS:
+      self->reconnect_attempts = g_value_get_int (value);
+      break;
+
+    case PROP_RECONNECT_BACKOFF_MIN:
+      self->reconnect_backoff_min = g_value_get_uint64 (value);
+      break;
+
+    case PROP_RECONNECT_BACKOFF_MAX:
+      self->reconnect_backoff_max = g_value_get_uint64 (value);
+      break;
+
+    case PROP_ADAPTIVE_BITRATE:
+      self->adaptive_bitrate = g_value_get_boolean (value);
+      break;
+
+    case PROP_MIN_KBPS:
+      self->min_kbps = g_value_get_uint (value);
+      break;
+
+    case PROP_MAX_KBPS:
+      self->max_kbps = g_value_get_uint (value);
+      break;
+
+    case PROP_BITRATE_HYSTERESIS:
+      self->bitrate_hysteresis = g_value_get_uint (value);
+      break;
+
+    case PROP_ENCODER_BITRATE_PROPERTY:
+      g_free (self->encoder_bitrate_property);
+      self->encoder_bitrate_property = g_value_dup_string (value);
+      break;
+
+    case PROP_ENCODER_BITRATE_DIVISOR:
+      self->encoder_bitrate_divisor = g_value_get_uint (value);
+      break;
+
+    case PROP_NAL_DROP_POLICY:
+      g_atomic_int_set (&self->nal_drop_policy, g_value_get_flags (value));
+      break;
+
+    case PROP_NAL_DROP_THRESHOLD:
+      g_atomic_int_set (&self->nal_drop_threshold,
+          g_value_get_uint (value));
+      break;
+
+    case PROP_NAL_SKIP_THRESHOLD:
+      g_atomic_int_set (&self->nal_skip_threshold,
+          g_value_get_uint (value));
+      break;
+
+    case PROP_MIRRORS:
+      g_ptr_array_set_size (self->mirror_targets, 0);
+      for (guint i = 0; i < gst_value_array_get_size (value); i++) {
+        const GstStructure *target =
+            g_value_get_boxed (gst_value_array_get_value (value, i));
+        if (target != NULL)
+          g_ptr_array_add (self->mirror_targets, gst_structure_copy (target));
+      }
+      break;
+
+    case PROP_MEDIA_TRANSPORT:
+      self->media_transport = g_value_get_enum (value);
+      break;
+
+    case PROP_MEDIA_PORT:
+      self->media_port = g_value_get_uint (value);
+      break;
+
+    case PROP_RETRANSMIT_TIME:
+      self->retransmit_time = g_value_get_uint64 (value);
+      break;
+
+    case PROP_RETRANSMIT_SIZE:
+      self->retransmit_size = g_value_get_uint (value);
+      break;
+
+    case PROP_PACING_FRACTION:
+      self->pacing_fraction = g_value_get_double (value);
+      break;
+
+    case PROP_FEC_PERCENTAGE:
+      self->fec_percentage = g_value_get_int (value);
+      break;
+
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint64 (value);
+      self->next_stats_time = GST_CLOCK_TIME_NONE;
+      break;
+
     default:
       /* We don't have any other property... */
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -294,6 +773,14 @@ gst_ftl_sink_get_property (GObject * object, guint prop_id,
       g_value_set_string (value, self->ingest_hostname);
       break;
 
+    case PROP_INGEST_CANDIDATES:
+      g_value_set_boxed (value, self->ingest_candidates);
+      break;
+
+    case PROP_INGEST_PROBE_TTL:
+      g_value_set_uint64 (value, self->ingest_probe_ttl);
+      break;
+
     case PROP_STREAM_KEY:
       g_value_set_string (value, self->stream_key);
       break;
@@ -302,6 +789,113 @@ gst_ftl_sink_get_property (GObject * object, guint prop_id,
       g_value_set_uint (value, self->peak_kbps);
       break;
 
+    case PROP_ASYNC_SEND:
+      g_value_set_boolean (value, self->async_send);
+      break;
+
+    case PROP_SEND_QUEUE_SIZE:
+      g_value_set_uint (value, self->send_queue_size);
+      break;
+
+    case PROP_GOP_CACHE_SIZE:
+      g_value_set_uint (value, self->gop_cache_size);
+      break;
+
+    case PROP_GOP_CACHE_REPLAY:
+      g_value_set_boolean (value, self->gop_cache_replay);
+      break;
+
+    case PROP_RECONNECT_ATTEMPTS:
+      g_value_set_int (value, self->reconnect_attempts);
+      break;
+
+    case PROP_RECONNECT_BACKOFF_MIN:
+      g_value_set_uint64 (value, self->reconnect_backoff_min);
+      break;
+
+    case PROP_RECONNECT_BACKOFF_MAX:
+      g_value_set_uint64 (value, self->reconnect_backoff_max);
+      break;
+
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint64 (value, self->stats_interval);
+      break;
+
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_ftl_sink_get_stats (self));
+      break;
+
+    case PROP_ADAPTIVE_BITRATE:
+      g_value_set_boolean (value, self->adaptive_bitrate);
+      break;
+
+    case PROP_MIN_KBPS:
+      g_value_set_uint (value, self->min_kbps);
+      break;
+
+    case PROP_MAX_KBPS:
+      g_value_set_uint (value, self->max_kbps);
+      break;
+
+    case PROP_BITRATE_HYSTERESIS:
+      g_value_set_uint (value, self->bitrate_hysteresis);
+      break;
+
+    case PROP_ENCODER_BITRATE_PROPERTY:
+      g_value_set_string (value, self->encoder_bitrate_property);
+      break;
+
+    case PROP_ENCODER_BITRATE_DIVISOR:
+      g_value_set_uint (value, self->encoder_bitrate_divisor);
+      break;
+
+    case PROP_NAL_DROP_POLICY:
+      g_value_set_flags (value, g_atomic_int_get (&self->nal_drop_policy));
+      break;
+
+    case PROP_NAL_DROP_THRESHOLD:
+      g_value_set_uint (value, g_atomic_int_get (&self->nal_drop_threshold));
+      break;
+
+    case PROP_NAL_SKIP_THRESHOLD:
+      g_value_set_uint (value, g_atomic_int_get (&self->nal_skip_threshold));
+      break;
+
+    case PROP_MIRRORS:
+      for (guint i = 0; i < self->mirror_targets->len; i++) {
+        GValue target = G_VALUE_INIT;
+
+        g_value_init (&target, GST_TYPE_STRUCTURE);
+        g_value_set_boxed (&target,
+            g_ptr_array_index (self->mirror_targets, i));
+        gst_value_array_append_and_take_value (value, &target);
+      }
+      break;
+
+    case PROP_MEDIA_TRANSPORT:
+      g_value_set_enum (value, self->media_transport);
+      break;
+
+    case PROP_MEDIA_PORT:
+      g_value_set_uint (value, self->media_port);
+      break;
+
+    case PROP_RETRANSMIT_TIME:
+      g_value_set_uint64 (value, self->retransmit_time);
+      break;
+
+    case PROP_RETRANSMIT_SIZE:
+      g_value_set_uint (value, self->retransmit_size);
+      break;
+
+    case PROP_PACING_FRACTION:
+      g_value_set_double (value, self->pacing_fraction);
+      break;
+
+    case PROP_FEC_PERCENTAGE:
+      g_value_set_int (value, self->fec_percentage);
+      break;
+
     default:
       /* We don't have any other property... */
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -311,109 +905,871 @@ gst_ftl_sink_get_property (GObject * object, guint prop_id,
   GST_OBJECT_UNLOCK (self);
 }
 
+/* Returns the hostname to hand to libftl */
+static gchar *
+gst_ftl_sink_select_ingest (GstFtlSink * self, GstClockTime * rtt)
+{
+  gchar *hostname, **candidates, *selected = NULL;
+  GstClockTime ttl, start;
+
+  GST_OBJECT_LOCK (self);
+  hostname = g_strdup (self->ingest_hostname);
+  candidates = g_strdupv (self->ingest_candidates);
+  ttl = self->ingest_probe_ttl;
+  GST_OBJECT_UNLOCK (self);
+
+  *rtt = GST_CLOCK_TIME_NONE;
+
+  if (g_strcmp0 (hostname, "auto") != 0 || candidates == NULL ||
+      candidates[0] == NULL) {
+    g_strfreev (candidates);
+    return hostname;
+  }
+
+  start = gst_util_get_timestamp ();
+  selected = gst_ftl_probe_select_ingest ((const gchar * const *) candidates,
+      GST_FTL_PROBE_PORT, INGEST_PROBE_TIMEOUT, ttl, rtt);
+
+  if (selected != NULL) {
+    GST_INFO_OBJECT (self, "selected ingest %s, RTT %" GST_TIME_FORMAT
+        " (took %" GST_TIME_FORMAT ")", selected, GST_TIME_ARGS (*rtt),
+        GST_TIME_ARGS (gst_util_get_timestamp () - start));
+  } else {
+    /* Connecting will tell what's wrong with it */
+    GST_WARNING_OBJECT (self, "No ingest candidate reachable, using %s",
+        candidates[0]);
+    selected = g_strdup (candidates[0]);
+  }
+
+  g_free (hostname);
+  g_strfreev (candidates);
+  return selected;
+}
+
+/* Without video caps yet, which is the case when connecting on PAUSED,
+ * asks upstream whether it settled on a framerate already */
+static void
+gst_ftl_sink_query_framerate (GstFtlSink * self, gint * fps_n, gint * fps_d)
+{
+  GstCaps *caps = gst_pad_peer_query_caps (self->videosinkpad, NULL);
+  const GValue *value;
+
+  if (!gst_caps_is_empty (caps) && !gst_caps_is_any (caps)) {
+    value = gst_structure_get_value (gst_caps_get_structure (caps, 0),
+        "framerate");
+    if (value != NULL && GST_VALUE_HOLDS_FRACTION (value) &&
+        gst_value_get_fraction_numerator (value) > 0) {
+      *fps_n = gst_value_get_fraction_numerator (value);
+      *fps_d = gst_value_get_fraction_denominator (value);
+      GST_DEBUG_OBJECT (self, "upstream framerate %d/%d", *fps_n, *fps_d);
+    }
+  }
+
+  gst_caps_unref (caps);
+}
+
+/* Call with connect_lock held */
 static ftl_status_t
 gst_ftl_sink_create_ingest (GstFtlSink * self)
 {
   ftl_ingest_params_t params;
   ftl_status_t status_code;
+  GstClockTime rtt;
+  gchar *hostname;
+  gint fps_n, fps_d;
+
+  if (g_atomic_int_get (&self->handle_created))
+    return FTL_SUCCESS;
+
+  GST_OBJECT_LOCK (self);
+  fps_n = self->fps_n;
+  fps_d = self->fps_d;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Probing and querying block, don't hold the object lock meanwhile */
+  if (fps_n == 0)
+    gst_ftl_sink_query_framerate (self, &fps_n, &fps_d);
+  hostname = gst_ftl_sink_select_ingest (self, &rtt);
 
   GST_OBJECT_LOCK (self);
-  params.ingest_hostname = self->ingest_hostname;
+  g_free (self->selected_ingest);
+  self->selected_ingest = hostname;
+  self->selected_ingest_rtt = rtt;
+
+  params.ingest_hostname = hostname;
   params.stream_key = self->stream_key;
   params.video_codec = FTL_VIDEO_H264;
   params.audio_codec = FTL_AUDIO_OPUS;
   params.peak_kbps = self->peak_kbps;
-  params.fps_num = 0;
-  params.fps_den = 1;
+  /* Still 0 if neither the caps nor upstream told */
+  params.fps_num = fps_n;
+  params.fps_den = fps_d;
   params.vendor_name = PACKAGE_NAME;
   params.vendor_version = VERSION;
 
   status_code = ftl_ingest_create (&self->handle, &params);
   GST_OBJECT_UNLOCK (self);
 
+  if (status_code == FTL_SUCCESS) {
+    GST_DEBUG_OBJECT (self, "created ingest handle, %d/%d fps", fps_n, fps_d);
+    g_atomic_int_set (&self->handle_created, TRUE);
+  }
+
   return status_code;
 }
 
-gboolean
-gst_ftl_sink_connect (GstFtlSink * self)
+/* Only after the status dispatcher and all connecting stopped */
+static gboolean
+gst_ftl_sink_destroy_ingest (GstFtlSink * self)
 {
-  gboolean connected;
+  ftl_status_t status_code;
 
-  g_mutex_lock (&self->connect_lock);
+  if (!g_atomic_int_get (&self->handle_created))
+    return TRUE;
 
-  connected = self->connected;
-  if (!connected) {
-    ftl_status_t status_code = ftl_ingest_connect (&self->handle);
-    if (status_code == FTL_SUCCESS)
-      connected = self->connected = TRUE;
-    else
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE,
-          ("Failed to connect to ingest: %s",
-              ftl_status_code_to_string (status_code)), ("status code %d",
-              status_code));
+  status_code = ftl_ingest_destroy (&self->handle);
+  g_atomic_int_set (&self->handle_created, FALSE);
+  if (status_code != FTL_SUCCESS) {
+    GST_ERROR_OBJECT (self, "Failed to destroy ingest handle: %s",
+        ftl_status_code_to_string (status_code));
+    return FALSE;
   }
 
-  g_mutex_unlock (&self->connect_lock);
-  return connected;
+  return TRUE;
 }
 
-static gboolean
-gst_ftl_sink_disconnect (GstFtlSink * self)
+/* Only while nothing is streaming */
+static void
+gst_ftl_sink_close_transport (GstFtlSink * self)
 {
-  gboolean connected;
+  GST_OBJECT_LOCK (self);
+  if (self->transport != NULL) {
+    gst_ftl_transport_free (self->transport);
+    self->transport = NULL;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
 
-  g_mutex_lock (&self->connect_lock);
+/* Call with cache_lock held */
+static void
+gst_ftl_sink_set_connection_state_unlocked (GstFtlSink * self,
+    GstFtlSinkConnectionState state)
+{
+  gboolean need_keyframe = FALSE;
 
-  connected = self->connected;
-  if (connected) {
-    ftl_status_t status_code = ftl_ingest_disconnect (&self->handle);
-    if (status_code == FTL_SUCCESS)
-      connected = self->connected = FALSE;
-    else
-      GST_ERROR_OBJECT (self, "Failed to disconnect from ingest: %s",
-          ftl_status_code_to_string (status_code));
+  g_atomic_int_set (&self->connection_state, state);
+
+  if (state == GST_FTL_SINK_CONNECTED) {
+    /* Resend the whole GOP, the ingest didn't see any of it. If we don't
+     * have its start, skip ahead to the next one. */
+    gst_ftl_gop_cache_rewind (self->gop_cache);
+    need_keyframe = !gst_ftl_gop_cache_has_keyframe (self->gop_cache);
+
+    /* The mirrors already got what was sent before reconnecting */
+    if (self->gop_cache_retain && self->mirrors != NULL) {
+      for (guint i = 0; i < self->mirrors->len; i++)
+        gst_ftl_mirror_begin_replay (g_ptr_array_index (self->mirrors, i));
+    }
+  } else if (state != GST_FTL_SINK_RECONNECTING) {
+    gst_ftl_gop_cache_clear (self->gop_cache);
   }
 
-  g_mutex_unlock (&self->connect_lock);
-  return !connected;
+  g_atomic_int_set (&self->video_need_keyframe, need_keyframe);
 }
 
-static GstStateChangeReturn
-gst_ftl_sink_change_state (GstElement * element, GstStateChange transition)
+static void
+gst_ftl_sink_set_connection_state (GstFtlSink * self,
+    GstFtlSinkConnectionState state)
 {
-  GstFtlSink *self = GST_FTL_SINK (element);
-  GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
-  ftl_status_t status_code;
-  gboolean async;
+  gboolean need_keyframe;
+
+  g_mutex_lock (&self->cache_lock);
+  gst_ftl_sink_set_connection_state_unlocked (self, state);
+  need_keyframe = g_atomic_int_get (&self->video_need_keyframe);
+  g_mutex_unlock (&self->cache_lock);
+
+  /* Without a cached keyframe, video would stay dropped for up to a GOP */
+  if (state == GST_FTL_SINK_CONNECTED && need_keyframe) {
+    GST_DEBUG_OBJECT (self, "No keyframe cached, requesting one");
+    gst_ftl_video_sink_request_keyframe (GST_FTL_VIDEO_SINK
+        (self->ftlvideosink));
+  }
+}
 
-  GST_DEBUG_OBJECT (self, "changing state: %s => %s",
-      gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
-      gst_element_state_get_name (GST_STATE_TRANSITION_NEXT (transition)));
+/* Sets up the native transport after connecting, or reopens it towards the
+ * ingest we reconnected to. Call with connect_lock held. */
+static gboolean
+gst_ftl_sink_open_transport (GstFtlSink * self, GError ** error)
+{
+  GstFtlTransport *transport;
+  GstFtlTransportMode mode;
+  gchar *hostname, *stream_key;
+  guint port, rtx_size;
+  gint fec_percentage;
+  GstClockTime rtx_time;
+  gboolean ret;
+  gint fd;
 
-  switch (transition) {
-    case GST_STATE_CHANGE_NULL_TO_READY:
-      status_code = gst_ftl_sink_create_ingest (self);
-      if (status_code != FTL_SUCCESS) {
-        GST_ERROR_OBJECT (self, "Failed to create ingest handle: %s\n",
-            ftl_status_code_to_string (status_code));
-        return GST_STATE_CHANGE_FAILURE;
-      }
-      break;
+  GST_OBJECT_LOCK (self);
+  mode = self->media_transport;
+  rtx_time = self->retransmit_time;
+  rtx_size = self->retransmit_size;
+  fec_percentage = self->fec_percentage;
+  hostname = g_strdup (self->selected_ingest);
+  stream_key = g_strdup (self->stream_key);
+  port = self->media_port;
+  transport = self->transport;
+  GST_OBJECT_UNLOCK (self);
 
-    case GST_STATE_CHANGE_READY_TO_PAUSED:
-      /* Start retrieving status messages */
-      if (!gst_task_start (self->status_task)) {
-        GST_ERROR_OBJECT (self, "Failed to start status task");
-        return GST_STATE_CHANGE_FAILURE;
+  if (mode == GST_FTL_TRANSPORT_LIBFTL) {
+    g_free (hostname);
+    g_free (stream_key);
+    return TRUE;
+  }
+
+  /* Only libftl knows which ingest it picked */
+  if (g_strcmp0 (hostname, "auto") == 0) {
+    g_set_error (error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_SETTINGS,
+        "No ingest to send to, set ingest-hostname or ingest-candidates");
+    g_free (hostname);
+    g_free (stream_key);
+    return FALSE;
+  }
+
+  /* Resolving blocks, don't hold any lock meanwhile */
+  fd = gst_ftl_transport_connect_socket (hostname, port, error);
+  if (fd < 0) {
+    ret = FALSE;
+  } else if (transport != NULL) {
+    /* A streaming thread may still be in the middle of a frame */
+    g_rw_lock_writer_lock (&self->send_lock);
+    ret = gst_ftl_transport_open (transport, fd, stream_key, error);
+    g_rw_lock_writer_unlock (&self->send_lock);
+  } else {
+    transport = gst_ftl_transport_new (GST_OBJECT (self), mode,
+        &self->counters, &self->pacing_error, rtx_time, rtx_size,
+        fec_percentage);
+    ret = gst_ftl_transport_open (transport, fd, stream_key, error);
+    if (ret) {
+      GST_OBJECT_LOCK (self);
+      self->transport = transport;
+      GST_OBJECT_UNLOCK (self);
+    } else {
+      gst_ftl_transport_free (transport);
+    }
+  }
+
+  g_free (hostname);
+  g_free (stream_key);
+  return ret;
+}
+
+static gboolean
+gst_ftl_sink_connect (GstFtlSink * self)
+{
+  ftl_status_t status_code;
+  gboolean connected;
+  GError *error = NULL;
+
+  g_mutex_lock (&self->connect_lock);
+
+  status_code = gst_ftl_sink_create_ingest (self);
+  if (status_code != FTL_SUCCESS) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("Failed to create ingest handle: %s",
+            ftl_status_code_to_string (status_code)), ("status code %d",
+            status_code));
+    gst_ftl_sink_set_connection_state (self, GST_FTL_SINK_CONNECT_FAILED);
+    g_mutex_unlock (&self->connect_lock);
+    return FALSE;
+  }
+
+  status_code = ftl_ingest_connect (&self->handle);
+  connected = status_code == FTL_SUCCESS;
+
+  if (connected) {
+    GST_DEBUG_OBJECT (self, "connected to ingest");
+    connected = gst_ftl_sink_open_transport (self, &error);
+    if (!connected) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE,
+          ("Failed to set up media transport: %s", error->message), (NULL));
+      g_error_free (error);
+      ftl_ingest_disconnect (&self->handle);
+    }
+  } else {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE,
+        ("Failed to connect to ingest: %s",
+            ftl_status_code_to_string (status_code)), ("status code %d",
+            status_code));
+  }
+
+  gst_ftl_sink_set_connection_state (self, connected ?
+      GST_FTL_SINK_CONNECTED : GST_FTL_SINK_CONNECT_FAILED);
+
+  g_mutex_unlock (&self->connect_lock);
+  return connected;
+}
+
+static gpointer
+gst_ftl_sink_connect_thread (gpointer user_data)
+{
+  gst_ftl_sink_connect (user_data);
+  return NULL;
+}
+
+/* Returns FALSE if we got cancelled */
+static gboolean
+gst_ftl_sink_reconnect_wait (GstFtlSink * self, GstClockTime delay)
+{
+  gint64 end_time = g_get_monotonic_time () + delay / GST_USECOND;
+  gboolean cancelled;
+
+  g_mutex_lock (&self->cache_lock);
+  while (!(cancelled = self->connect_cancelled) &&
+      g_cond_wait_until (&self->connect_cond, &self->cache_lock, end_time));
+  g_mutex_unlock (&self->cache_lock);
+
+  return !cancelled;
+}
+
+static gpointer
+gst_ftl_sink_reconnect_thread (gpointer user_data)
+{
+  GstFtlSink *self = user_data;
+  GstClockTime start = gst_util_get_timestamp ();
+  GstClockTime delay, backoff_max;
+  GstStructure *message;
+  ftl_status_t status_code = FTL_SUCCESS;
+  GError *error = NULL;
+  gboolean connected = FALSE, cancelled = FALSE;
+  gint max_attempts;
+  guint attempt;
+
+  GST_OBJECT_LOCK (self);
+  max_attempts = self->reconnect_attempts;
+  delay = self->reconnect_backoff_min;
+  backoff_max = self->reconnect_backoff_max;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Whatever was still queued went nowhere. With gop-cache-replay the
+   * cache has it, otherwise video resumes at the next keyframe. */
+  gst_ftl_sink_drain (self);
+
+  for (attempt = 1; max_attempts < 0 || attempt <= max_attempts; attempt++) {
+    GST_INFO_OBJECT (self, "reconnect attempt %u in %" GST_TIME_FORMAT,
+        attempt, GST_TIME_ARGS (delay));
+
+    message = gst_structure_new_id_empty (ftl_reconnecting_id);
+    gst_structure_set (message,
+        "attempt", G_TYPE_UINT, attempt,
+        "delay", GST_TYPE_CLOCK_TIME, delay, NULL);
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self), message));
+
+    if (!gst_ftl_sink_reconnect_wait (self, delay)) {
+      cancelled = TRUE;
+      break;
+    }
+
+    g_clear_error (&error);
+
+    g_mutex_lock (&self->connect_lock);
+    ftl_ingest_disconnect (&self->handle);
+    status_code = ftl_ingest_connect (&self->handle);
+    if (status_code == FTL_SUCCESS) {
+      /* The ingest may hand out a new media port, and the old socket's
+       * sequence numbers and retransmissions mean nothing to it */
+      connected = gst_ftl_sink_open_transport (self, &error);
+      if (!connected)
+        ftl_ingest_disconnect (&self->handle);
+    }
+    g_mutex_unlock (&self->connect_lock);
+
+    if (connected)
+      break;
+
+    if (error != NULL)
+      GST_WARNING_OBJECT (self, "Failed to set up media transport: %s",
+          error->message);
+    else
+      GST_WARNING_OBJECT (self, "Failed to reconnect to ingest: %s",
+          ftl_status_code_to_string (status_code));
+
+    delay = MIN (delay * 2, backoff_max);
+  }
+
+  if (connected) {
+    gst_ftl_sink_set_connection_state (self, GST_FTL_SINK_CONNECTED);
+    gst_ftl_counters_inc (&self->counters, GST_FTL_COUNTER_RECONNECTS);
+
+    GST_INFO_OBJECT (self, "reconnected after %u attempts", attempt);
+
+    message = gst_structure_new_id_empty (ftl_reconnected_id);
+    gst_structure_set (message,
+        "attempts", G_TYPE_UINT, attempt,
+        "downtime", GST_TYPE_CLOCK_TIME, gst_util_get_timestamp () - start,
+        NULL);
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self), message));
+  } else if (!cancelled) {
+    gst_ftl_sink_set_connection_state (self, GST_FTL_SINK_CONNECT_FAILED);
+
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE,
+        ("Failed to reconnect to ingest: %s", error != NULL ? error->message :
+            ftl_status_code_to_string (status_code)),
+        ("gave up after %d attempts", max_attempts));
+  }
+
+  g_clear_error (&error);
+
+  return NULL;
+}
+
+/* Called from the status loop after losing the connection. Returns
+ * FALSE if we shouldn't try to reconnect. */
+static gboolean
+gst_ftl_sink_start_reconnect (GstFtlSink * self)
+{
+  GThread *old_thread = NULL;
+  gint max_attempts;
+
+  GST_OBJECT_LOCK (self);
+  max_attempts = self->reconnect_attempts;
+  GST_OBJECT_UNLOCK (self);
+
+  if (max_attempts == 0)
+    return FALSE;
+
+  g_mutex_lock (&self->cache_lock);
+  if (!self->connect_cancelled &&
+      g_atomic_int_get (&self->connection_state) == GST_FTL_SINK_CONNECTED) {
+    gst_ftl_sink_set_connection_state_unlocked (self,
+        GST_FTL_SINK_RECONNECTING);
+    /* Any earlier thread has finished by now */
+    old_thread = self->connect_thread;
+    self->connect_thread = g_thread_new ("ftlsink-reconnect",
+        gst_ftl_sink_reconnect_thread, self);
+  }
+  g_mutex_unlock (&self->cache_lock);
+
+  if (old_thread != NULL)
+    g_thread_join (old_thread);
+
+  return TRUE;
+}
+
+/* Stops a background (re)connect and keeps new ones from starting */
+static void
+gst_ftl_sink_stop_connecting (GstFtlSink * self)
+{
+  GThread *thread;
+
+  g_mutex_lock (&self->cache_lock);
+  self->connect_cancelled = TRUE;
+  g_cond_signal (&self->connect_cond);
+  thread = self->connect_thread;
+  self->connect_thread = NULL;
+  g_mutex_unlock (&self->cache_lock);
+
+  /* A handshake in progress can't be cancelled */
+  if (thread != NULL)
+    g_thread_join (thread);
+}
+
+static gboolean
+gst_ftl_sink_disconnect (GstFtlSink * self)
+{
+  gboolean disconnected = TRUE;
+
+  g_mutex_lock (&self->connect_lock);
+
+  if (g_atomic_int_get (&self->connection_state) == GST_FTL_SINK_CONNECTED) {
+    ftl_status_t status_code = ftl_ingest_disconnect (&self->handle);
+    if (status_code != FTL_SUCCESS) {
+      GST_ERROR_OBJECT (self, "Failed to disconnect from ingest: %s",
+          ftl_status_code_to_string (status_code));
+      disconnected = FALSE;
+    }
+  }
+
+  if (disconnected) {
+    gst_ftl_sink_set_connection_state (self, GST_FTL_SINK_DISCONNECTED);
+    gst_ftl_sink_close_transport (self);
+    self->cache_pending[FTL_AUDIO_DATA] = FALSE;
+    self->cache_pending[FTL_VIDEO_DATA] = FALSE;
+  }
+
+  g_mutex_unlock (&self->connect_lock);
+  return disconnected;
+}
+
+static GstFlowReturn
+gst_ftl_sink_dispatch (ftl_media_type_t media_type, GstBuffer * buffer,
+    GstClockTime time, gpointer user_data)
+{
+  GstFtlSink *self = user_data;
+  GstFlowReturn ret;
+
+  gst_ftl_sink_begin_send (self);
+  if (media_type == FTL_VIDEO_DATA)
+    ret = gst_ftl_video_sink_send_buffer (GST_FTL_VIDEO_SINK
+        (self->ftlvideosink), buffer, time);
+  else
+    ret = gst_ftl_audio_sink_send_buffer (GST_FTL_AUDIO_SINK
+        (self->ftlaudiosink), buffer, time);
+  gst_ftl_sink_end_send (self);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_ftl_sink_deliver (GstFtlSink * self, ftl_media_type_t media_type,
+    GstBuffer * buffer, GstClockTime time)
+{
+  if (self->sender != NULL)
+    return gst_ftl_sender_push (self->sender, media_type, buffer, time);
+
+  return gst_ftl_sink_dispatch (media_type, buffer, time, self);
+}
+
+static const gchar *
+gst_ftl_sink_media_type_name (ftl_media_type_t media_type)
+{
+  return media_type == FTL_VIDEO_DATA ? "video" : "audio";
+}
+
+/* Entry point of the internal sinks once they have a running time for
+ * @buffer. With async-send, this only queues a reference. */
+GstFlowReturn
+gst_ftl_sink_send_buffer (GstFtlSink * self, ftl_media_type_t media_type,
+    GstBuffer * buffer, GstClockTime time)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GQueue items = G_QUEUE_INIT;
+  GstFtlGopCacheItem *item;
+  gboolean cached;
+
+  if (media_type == FTL_VIDEO_DATA &&
+      G_UNLIKELY (g_atomic_int_get (&self->video_need_keyframe))) {
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+      GST_LOG_OBJECT (self, "waiting for keyframe, dropping %" GST_PTR_FORMAT,
+          buffer);
+      gst_ftl_counters_inc (&self->counters, GST_FTL_COUNTER_BUFFERS_DROPPED);
+      return GST_FLOW_OK;
+    }
+    g_atomic_int_set (&self->video_need_keyframe, FALSE);
+  }
+
+  if (G_LIKELY (g_atomic_int_get (&self->connection_state) ==
+          GST_FTL_SINK_CONNECTED && !self->cache_pending[media_type] &&
+          !self->gop_cache_retain))
+    return gst_ftl_sink_deliver (self, media_type, buffer, time);
+
+  g_mutex_lock (&self->cache_lock);
+
+  switch (g_atomic_int_get (&self->connection_state)) {
+    case GST_FTL_SINK_DISCONNECTED:
+      GST_DEBUG_OBJECT (self, "connecting in the background");
+      g_atomic_int_set (&self->connection_state, GST_FTL_SINK_CONNECTING);
+      self->connect_thread = g_thread_new ("ftlsink-connect",
+          gst_ftl_sink_connect_thread, self);
+      /* fallthrough */
+
+    case GST_FTL_SINK_CONNECTING:
+    case GST_FTL_SINK_RECONNECTING:
+      cached = gst_ftl_gop_cache_push (self->gop_cache, media_type, buffer,
+          time);
+      self->cache_pending[media_type] |= cached;
+      g_mutex_unlock (&self->cache_lock);
+
+      if (!cached) {
+        GST_LOG_OBJECT (self, "dropped %s buffer while connecting: %"
+            GST_PTR_FORMAT, gst_ftl_sink_media_type_name (media_type), buffer);
+        gst_ftl_counters_inc (&self->counters,
+            GST_FTL_COUNTER_BUFFERS_DROPPED);
+      }
+      return GST_FLOW_OK;
+
+    case GST_FTL_SINK_CONNECT_FAILED:
+      g_mutex_unlock (&self->cache_lock);
+      return GST_FLOW_ERROR;
+
+    case GST_FTL_SINK_CONNECTED:
+    default:
+      break;
+  }
+
+  /* Send whatever this stream cached before along with @buffer. Each
+   * stream takes only its own buffers so the sender only ever sees one
+   * producer per stream. */
+  cached = self->gop_cache_retain &&
+      gst_ftl_gop_cache_push (self->gop_cache, media_type, buffer, time);
+  gst_ftl_gop_cache_take (self->gop_cache, media_type, &items);
+  self->cache_pending[media_type] = FALSE;
+
+  g_mutex_unlock (&self->cache_lock);
+
+  if (items.length > 1 || (items.length > 0 && !cached))
+    GST_DEBUG_OBJECT (self, "sending %u cached %s buffers", items.length,
+        gst_ftl_sink_media_type_name (media_type));
+
+  while ((item = g_queue_pop_head (&items)) != NULL) {
+    if (ret == GST_FLOW_OK)
+      ret = gst_ftl_sink_deliver (self, media_type, item->buffer, item->time);
+    gst_ftl_gop_cache_item_free (item);
+  }
+
+  if (!cached && ret == GST_FLOW_OK)
+    ret = gst_ftl_sink_deliver (self, media_type, buffer, time);
+
+  return ret;
+}
+
+/* Like gst_ftl_sink_send_buffer() for every buffer of @list, with the
+ * running times in @times. While connected, the connection state is only
+ * checked once for the whole list. */
+GstFlowReturn
+gst_ftl_sink_send_list (GstFtlSink * self, ftl_media_type_t media_type,
+    GstBufferList * list, const GstClockTime * times)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint length = gst_buffer_list_length (list);
+
+  if (G_LIKELY (g_atomic_int_get (&self->connection_state) ==
+          GST_FTL_SINK_CONNECTED && !self->cache_pending[media_type] &&
+          !self->gop_cache_retain && (media_type != FTL_VIDEO_DATA ||
+              !g_atomic_int_get (&self->video_need_keyframe)))) {
+    if (media_type == FTL_AUDIO_DATA && self->sender == NULL) {
+      gst_ftl_sink_begin_send (self);
+      ret = gst_ftl_audio_sink_send_list (GST_FTL_AUDIO_SINK
+          (self->ftlaudiosink), list, times);
+      gst_ftl_sink_end_send (self);
+      return ret;
+    }
+
+    if (media_type == FTL_VIDEO_DATA && self->sender == NULL) {
+      gst_ftl_sink_begin_send (self);
+      ret = gst_ftl_video_sink_send_list (GST_FTL_VIDEO_SINK
+          (self->ftlvideosink), list, times);
+      gst_ftl_sink_end_send (self);
+      return ret;
+    }
+
+    for (guint i = 0; i < length && ret == GST_FLOW_OK; i++)
+      ret = gst_ftl_sink_deliver (self, media_type,
+          gst_buffer_list_get (list, i), times[i]);
+    return ret;
+  }
+
+  for (guint i = 0; i < length && ret == GST_FLOW_OK; i++)
+    ret = gst_ftl_sink_send_buffer (self, media_type,
+        gst_buffer_list_get (list, i), times[i]);
+
+  return ret;
+}
+
+/* Waits until all queued buffers have been sent */
+void
+gst_ftl_sink_drain (GstFtlSink * self)
+{
+  if (self->sender != NULL)
+    gst_ftl_sender_drain (self->sender);
+}
+
+static void
+gst_ftl_sink_start_sender (GstFtlSink * self)
+{
+  GstFtlSender *sender = NULL;
+
+  GST_OBJECT_LOCK (self);
+  if (self->async_send)
+    sender = self->sender = gst_ftl_sender_new (GST_OBJECT (self),
+        self->send_queue_size, gst_ftl_sink_dispatch, self,
+        self->latency[GST_FTL_LATENCY_QUEUE]);
+  GST_OBJECT_UNLOCK (self);
+
+  if (sender != NULL)
+    GST_DEBUG_OBJECT (self, "started sender thread");
+}
+
+static void
+gst_ftl_sink_stop_sender (GstFtlSink * self)
+{
+  GstFtlSender *sender;
+
+  GST_OBJECT_LOCK (self);
+  sender = self->sender;
+  self->sender = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (sender != NULL) {
+    gst_ftl_sender_free (sender);
+    GST_DEBUG_OBJECT (self, "stopped sender thread");
+  }
+}
+
+/* Creates a GstFtlMirror for every valid entry of the mirrors property.
+ * They start connecting right away. */
+static void
+gst_ftl_sink_start_mirrors (GstFtlSink * self)
+{
+  GPtrArray *mirrors =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_ftl_mirror_free);
+  GPtrArray *targets =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+  GstClockTime backoff_min, backoff_max;
+  guint peak_kbps;
+
+  GST_OBJECT_LOCK (self);
+  for (guint i = 0; i < self->mirror_targets->len; i++)
+    g_ptr_array_add (targets,
+        gst_structure_copy (g_ptr_array_index (self->mirror_targets, i)));
+  peak_kbps = self->peak_kbps;
+  backoff_min = self->reconnect_backoff_min;
+  backoff_max = self->reconnect_backoff_max;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Creating a handle may resolve, don't hold the object lock meanwhile */
+  for (guint i = 0; i < targets->len; i++) {
+    GstStructure *target = g_ptr_array_index (targets, i);
+    const gchar *hostname = gst_structure_get_string (target, "hostname");
+    const gchar *stream_key = gst_structure_get_string (target, "stream-key");
+    GstFtlMirror *mirror;
+
+    if (hostname == NULL || stream_key == NULL) {
+      GST_WARNING_OBJECT (self, "Ignoring mirror without hostname or "
+          "stream-key: %" GST_PTR_FORMAT, target);
+      continue;
+    }
+
+    mirror = gst_ftl_mirror_new (GST_OBJECT (self), hostname, stream_key,
+        peak_kbps, backoff_min, backoff_max);
+    if (mirror != NULL)
+      g_ptr_array_add (mirrors, mirror);
+  }
+
+  g_ptr_array_unref (targets);
+
+  GST_OBJECT_LOCK (self);
+  self->mirrors = mirrors;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_ftl_sink_stop_mirrors (GstFtlSink * self)
+{
+  GPtrArray *mirrors;
+
+  GST_OBJECT_LOCK (self);
+  mirrors = self->mirrors;
+  self->mirrors = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (mirrors != NULL)
+    g_ptr_array_unref (mirrors);
+}
+
+/* Call with the object lock held */
+static void
+gst_ftl_sink_add_ingest_stats (GstFtlSink * self, GstStructure * structure)
+{
+  if (self->selected_ingest != NULL)
+    gst_structure_set (structure, "ingest-hostname", G_TYPE_STRING,
+        self->selected_ingest, NULL);
+
+  if (GST_CLOCK_TIME_IS_VALID (self->selected_ingest_rtt))
+    gst_structure_set (structure, "ingest-rtt", GST_TYPE_CLOCK_TIME,
+        self->selected_ingest_rtt, NULL);
+}
+
+/* Call with the object lock held */
+static void
+gst_ftl_sink_add_mirror_stats (GstFtlSink * self, GstStructure * structure)
+{
+  GValue array = G_VALUE_INIT;
+
+  if (self->mirrors == NULL || self->mirrors->len == 0)
+    return;
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+
+  for (guint i = 0; i < self->mirrors->len; i++) {
+    GValue stats = G_VALUE_INIT;
+
+    g_value_init (&stats, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&stats,
+        gst_ftl_mirror_get_stats (g_ptr_array_index (self->mirrors, i)));
+    gst_value_array_append_and_take_value (&array, &stats);
+  }
+
+  gst_structure_take_value (structure, "mirrors", &array);
+}
+
+static GstStateChangeReturn
+gst_ftl_sink_change_state (GstElement * element, GstStateChange transition)
+{
+  GstFtlSink *self = GST_FTL_SINK (element);
+  GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+  gboolean async, replay;
+  guint gop_cache_size;
+  gint reconnect_attempts;
+
+  GST_DEBUG_OBJECT (self, "changing state: %s => %s",
+      gst_element_state_get_name (GST_STATE_TRANSITION_CURRENT (transition)),
+      gst_element_state_get_name (GST_STATE_TRANSITION_NEXT (transition)));
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      GST_OBJECT_LOCK (self);
+      self->next_stats_time = GST_CLOCK_TIME_NONE;
+      GST_OBJECT_UNLOCK (self);
+
+      gst_ftl_counters_reset (&self->counters);
+      for (guint i = 0; i < GST_FTL_N_LATENCY_STAGES; i++) {
+        gst_ftl_histogram_reset (&self->latency[i][FTL_AUDIO_DATA]);
+        gst_ftl_histogram_reset (&self->latency[i][FTL_VIDEO_DATA]);
       }
+      gst_ftl_histogram_reset (&self->pacing_error);
+
+      memset (self->status_base, 0, sizeof (self->status_base));
+      memset (self->status_last, 0, sizeof (self->status_last));
+      self->bitrate_changes = 0;
+      self->target_bitrate = 0;
+      g_atomic_int_set (&self->ftl_queue_level, 0);
+      self->frames_dropped_reports = 0;
+      self->network_reports = 0;
+
+      /* Start retrieving status messages */
+      self->status_entry =
+          gst_ftl_dispatcher_add (gst_ftl_sink_dispatch_status, self);
 
       GST_OBJECT_LOCK (self);
       async = self->async_connect;
+      gop_cache_size = self->gop_cache_size;
+      reconnect_attempts = self->reconnect_attempts;
+      replay = self->gop_cache_replay;
       GST_OBJECT_UNLOCK (self);
 
+      g_mutex_lock (&self->cache_lock);
+      self->connect_cancelled = FALSE;
+      self->gop_cache_retain = replay && reconnect_attempts != 0;
+      gst_ftl_gop_cache_set_max_bytes (self->gop_cache, gop_cache_size);
+      gst_ftl_gop_cache_set_retain (self->gop_cache, self->gop_cache_retain);
+      gst_ftl_sink_set_connection_state_unlocked (self,
+          GST_FTL_SINK_DISCONNECTED);
+      g_mutex_unlock (&self->cache_lock);
+
+      /* Let them handshake in parallel with the main ingest */
+      gst_ftl_sink_start_mirrors (self);
+
       if (async && !gst_ftl_sink_connect (self)) {
+        gst_ftl_sink_stop_mirrors (self);
+        gst_ftl_sink_stop_status (self);
+        gst_ftl_sink_destroy_ingest (self);
         return GST_STATE_CHANGE_FAILURE;
       }
+
+      gst_ftl_sink_start_sender (self);
       break;
 
     default:
@@ -429,22 +1785,31 @@ gst_ftl_sink_change_state (GstElement * element, GstStateChange transition)
 
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_ftl_sink_stop_connecting (self);
+      gst_ftl_sink_stop_sender (self);
+      gst_ftl_sink_stop_mirrors (self);
+
       if (!gst_ftl_sink_disconnect (self)) {
         return GST_STATE_CHANGE_FAILURE;
       }
 
-      if (!gst_task_join (self->status_task)) {
-        GST_ERROR_OBJECT (self, "Failed to join status task");
+      gst_ftl_sink_stop_status (self);
+
+      if (!gst_ftl_sink_destroy_ingest (self))
         return GST_STATE_CHANGE_FAILURE;
+
+      if (self->stats_message != NULL) {
+        gst_structure_free (self->stats_message);
+        self->stats_message = NULL;
       }
       break;
 
     case GST_STATE_CHANGE_READY_TO_NULL:
-      if ((status_code = ftl_ingest_destroy (&self->handle)) != FTL_SUCCESS) {
-        GST_ERROR_OBJECT (self, "Failed to destroy ingest handle: %s",
-            ftl_status_code_to_string (status_code));
+      /* In case READY_TO_PAUSED failed after registering */
+      gst_ftl_sink_stop_status (self);
+
+      if (!gst_ftl_sink_destroy_ingest (self))
         return GST_STATE_CHANGE_FAILURE;
-      }
 
     default:
       break;
@@ -453,136 +1818,563 @@ gst_ftl_sink_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
+/* Names of the latency fields in ftl-stats, indexed by GstFtlLatencyStage
+ * and ftl_media_type_t */
+static const gchar *const latency_names[GST_FTL_N_LATENCY_STAGES][2] = {
+  [GST_FTL_LATENCY_SYNC] = {
+        [FTL_AUDIO_DATA] = "audio-sync-latency",
+        [FTL_VIDEO_DATA] = "video-sync-latency"},
+  [GST_FTL_LATENCY_QUEUE] = {
+        [FTL_AUDIO_DATA] = "audio-queue-latency",
+        [FTL_VIDEO_DATA] = "video-queue-latency"},
+  [GST_FTL_LATENCY_SEND] = {
+        [FTL_AUDIO_DATA] = "audio-send-latency",
+        [FTL_VIDEO_DATA] = "video-send-latency"},
+};
+
+/* Adds the latency and pacing error distributions since the last call to
+ * @structure */
 static void
-gst_ftl_sink_status_loop (gpointer user_data)
+gst_ftl_sink_take_latency (GstFtlSink * self, GstStructure * structure)
 {
-  GstFtlSink *self = user_data;
-  ftl_status_t status_code;
-  ftl_status_msg_t message = { FTL_STATUS_NONE, };
-  GstStructure *stats_message = NULL;
+  GstStructure *pacing_error;
 
-  GST_TRACE_OBJECT (self, "Getting status");
-  status_code = ftl_ingest_get_status (&self->handle, &message,
-      STATUS_POLL_RATE_MS);
+  for (guint i = 0; i < GST_FTL_N_LATENCY_STAGES; i++) {
+    for (guint j = 0; j < 2; j++) {
+      GstStructure *latency = gst_ftl_histogram_take (&self->latency[i][j],
+          latency_names[i][j]);
 
-  while (status_code == FTL_SUCCESS) {
-    switch (message.type) {
-      case FTL_STATUS_LOG:{
-        ftl_status_log_msg_t *msg = &message.msg.log;
-        GstDebugLevel level;
+      gst_structure_set (structure, latency_names[i][j], GST_TYPE_STRUCTURE,
+          latency, NULL);
+      gst_structure_free (latency);
+    }
+  }
 
-        level = gst_ftl_log_severity_to_level (msg->log_level);
-        g_strchomp (msg->string);
+  pacing_error = gst_ftl_histogram_take (&self->pacing_error,
+      "video-pacing-error");
+  gst_structure_set (structure, "video-pacing-error", GST_TYPE_STRUCTURE,
+      pacing_error, NULL);
+  gst_structure_free (pacing_error);
+}
 
-        GST_CAT_LEVEL_LOG (GST_CAT_DEFAULT, level, self, "%s", msg->string);
-        break;
-      }
+/* Collects statistics until the next ftl-stats message is due */
+static GstStructure *
+gst_ftl_sink_get_stats_message (GstFtlSink * self)
+{
+  if (self->stats_message == NULL)
+    self->stats_message = gst_structure_new_id_empty (ftl_stats_id);
+  return self->stats_message;
+}
 
-      case FTL_STATUS_EVENT:
-        gst_ftl_sink_handle_event (self, &message.msg.event);
-        break;
+static void
+gst_ftl_sink_post_stats (GstFtlSink * self, GstClockTime now)
+{
+  GstStructure *stats_message;
+  GstClockTime interval;
 
-        /* Really for both streams */
-      case FTL_STATUS_VIDEO_PACKETS:{
-        ftl_packet_stats_msg_t *msg = &message.msg.pkt_stats;
+  GST_OBJECT_LOCK (self);
+  interval = self->stats_interval;
 
-        GST_LOG_OBJECT (self, "Packet stats: period %" PRId64 " ms, %" PRId64
-            " packets sent, %" PRId64 " NACK requests, %" PRId64
-            " packets lost, %" PRId64 " packets recovered, %" PRId64
-            " packets late", msg->period, msg->sent, msg->nack_reqs, msg->lost,
-            msg->recovered, msg->late);
+  if (interval > 0 && GST_CLOCK_TIME_IS_VALID (self->next_stats_time) &&
+      now < self->next_stats_time) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  if (self->sender != NULL && (interval > 0 || self->stats_message != NULL))
+    gst_ftl_sender_take_stats (self->sender,
+        gst_ftl_sink_get_stats_message (self));
+
+  stats_message = self->stats_message;
+  self->stats_message = NULL;
+  if (stats_message != NULL) {
+    gst_ftl_counters_snapshot (&self->counters, stats_message);
+    gst_ftl_sink_take_latency (self, stats_message);
+    gst_ftl_sink_add_ingest_stats (self, stats_message);
+    gst_ftl_sink_add_mirror_stats (self, stats_message);
+    if (self->transport != NULL)
+      gst_ftl_transport_add_stats (self->transport, stats_message);
+  }
+  self->next_stats_time = interval > 0 ? now + interval : GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (self);
 
-        if (stats_message == NULL)
-          stats_message = gst_structure_new_id_empty (ftl_stats_id);
+  if (stats_message != NULL)
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self), stats_message));
+}
 
-        gst_structure_set (stats_message,
-            "time-total", GST_TYPE_CLOCK_TIME, msg->period * GST_MSECOND,
-            "packets-sent", G_TYPE_INT64, msg->sent,
-            "nacks-received", G_TYPE_INT64, msg->nack_reqs, NULL);
-        break;
-      }
+static void
+gst_ftl_sink_set_int64_stat (GstStructure * structure, const gchar * prefix,
+    const gchar * name, gint64 value)
+{
+  gchar *field = g_strconcat (prefix, name, NULL);
+  gst_structure_set (structure, field, G_TYPE_INT64, value, NULL);
+  g_free (field);
+}
+
+/* libftl counts packets and frames since connecting. Carry what the last
+ * connection reported over to the totals. */
+static void
+gst_ftl_sink_fold_status_totals (GstFtlSink * self)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (self->status_last); i++) {
+    GstFtlSinkStatusTotals *base = &self->status_base[i];
+    GstFtlSinkStatusTotals *last = &self->status_last[i];
+
+    base->packets.sent += last->packets.sent;
+    base->packets.nack_reqs += last->packets.nack_reqs;
+    base->packets.lost += last->packets.lost;
+    base->packets.recovered += last->packets.recovered;
+    base->packets.late += last->packets.late;
+
+    base->frames.frames_queued += last->frames.frames_queued;
+    base->frames.frames_sent += last->frames.frames_sent;
+    base->frames.bytes_queued += last->frames.bytes_queued;
+    base->frames.bytes_sent += last->frames.bytes_sent;
+    base->frames.bw_throttling_count += last->frames.bw_throttling_count;
+  }
+
+  memset (self->status_last, 0, sizeof (self->status_last));
+}
 
-        /* Really for both streams */
-      case FTL_STATUS_VIDEO_PACKETS_INSTANT:{
-        ftl_packet_stats_instant_msg_t *msg = &message.msg.ipkt_stats;
-
-        GST_LOG_OBJECT (self, "Instant packet stats: period %" PRId64
-            " ms, RTT %d ms (min %d ms, max %d ms), delay %d ms (min %d"
-            " ms, max %d ms)", msg->period, msg->avg_rtt, msg->min_rtt,
-            msg->max_rtt, msg->avg_xmit_delay, msg->min_xmit_delay,
-            msg->max_xmit_delay);
-
-        if (stats_message == NULL)
-          stats_message = gst_structure_new_id_empty (ftl_stats_id);
-
-        gst_structure_set (stats_message,
-            "time-interval", GST_TYPE_CLOCK_TIME, msg->period * GST_MSECOND,
-            "rtt-min", G_TYPE_INT, msg->min_rtt,
-            "rtt-max", G_TYPE_INT, msg->max_rtt,
-            "rtt-avg", G_TYPE_INT, msg->avg_rtt,
-            "xmit-delay-min", G_TYPE_INT, msg->min_xmit_delay,
-            "xmit-delay-max", G_TYPE_INT, msg->max_xmit_delay,
-            "xmit-delay-avg", G_TYPE_INT, msg->avg_xmit_delay, NULL);
-        break;
+static void
+gst_ftl_sink_handle_packet_stats (GstFtlSink * self,
+    ftl_media_type_t media_type, ftl_packet_stats_msg_t * msg)
+{
+  GstStructure *stats_message = gst_ftl_sink_get_stats_message (self);
+  ftl_packet_stats_msg_t *base = &self->status_base[media_type].packets;
+  /* The video fields predate the audio ones */
+  const gchar *prefix = media_type == FTL_VIDEO_DATA ? "" : "audio-";
+
+  GST_LOG_OBJECT (self, "%s packet stats: period %" PRId64 " ms, %" PRId64
+      " packets sent, %" PRId64 " NACK requests, %" PRId64
+      " packets lost, %" PRId64 " packets recovered, %" PRId64
+      " packets late", gst_ftl_sink_media_type_name (media_type),
+      msg->period, msg->sent, msg->nack_reqs, msg->lost, msg->recovered,
+      msg->late);
+
+  self->status_last[media_type].packets = *msg;
+
+  if (media_type == FTL_VIDEO_DATA)
+    gst_structure_set (stats_message,
+        "time-total", GST_TYPE_CLOCK_TIME, msg->period * GST_MSECOND, NULL);
+
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-sent",
+      msg->sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "nacks-received",
+      msg->nack_reqs);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-lost",
+      msg->lost);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-recovered",
+      msg->recovered);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-late",
+      msg->late);
+
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-sent-total",
+      base->sent + msg->sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "nacks-received-total",
+      base->nack_reqs + msg->nack_reqs);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-lost-total",
+      base->lost + msg->lost);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix,
+      "packets-recovered-total", base->recovered + msg->recovered);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "packets-late-total",
+      base->late + msg->late);
+}
+
+static void
+gst_ftl_sink_update_queue_level (GstFtlSink * self,
+    ftl_video_frame_stats_msg_t * msg)
+{
+  ftl_video_frame_stats_msg_t *last = &self->status_last[FTL_VIDEO_DATA].frames;
+  gint level = CLAMP (msg->queue_fullness, 0, 100);
+
+  /* The throttle count only grows during a connection */
+  if (msg->bw_throttling_count > last->bw_throttling_count)
+    level = MAX (level, g_atomic_int_get (&self->nal_drop_threshold));
+
+  g_atomic_int_set (&self->ftl_queue_level, level);
+}
+
+static void
+gst_ftl_sink_handle_frame_stats (GstFtlSink * self,
+    ftl_media_type_t media_type, ftl_video_frame_stats_msg_t * msg)
+{
+  GstStructure *stats_message = gst_ftl_sink_get_stats_message (self);
+  ftl_video_frame_stats_msg_t *base = &self->status_base[media_type].frames;
+  const gchar *prefix = media_type == FTL_VIDEO_DATA ? "video-" : "audio-";
+  gchar *field;
+
+  GST_LOG_OBJECT (self, "%s frame stats: period %" PRId64
+      " ms, %" PRId64 " frames queued, %" PRId64 " frames sent, %" PRId64
+      " bytes queued, %" PRId64 " bytes sent, %" PRId64
+      " bandwidth throttles, queue fill level %d, max frame size %d",
+      gst_ftl_sink_media_type_name (media_type), msg->period,
+      msg->frames_queued, msg->frames_sent, msg->bytes_queued,
+      msg->bytes_sent, msg->bw_throttling_count, msg->queue_fullness,
+      msg->max_frame_size);
+
+  if (media_type == FTL_VIDEO_DATA)
+    gst_ftl_sink_update_queue_level (self, msg);
+
+  self->status_last[media_type].frames = *msg;
+
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "frames-queued",
+      msg->frames_queued);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "frames-sent",
+      msg->frames_sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bytes-queued",
+      msg->bytes_queued);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bytes-sent",
+      msg->bytes_sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bw-throttles",
+      msg->bw_throttling_count);
+
+  field = g_strconcat (prefix, "queue-level", NULL);
+  gst_structure_set (stats_message, field, G_TYPE_INT, msg->queue_fullness,
+      NULL);
+  g_free (field);
+
+  field = g_strconcat (prefix, "max-frame-size", NULL);
+  gst_structure_set (stats_message, field, G_TYPE_INT, msg->max_frame_size,
+      NULL);
+  g_free (field);
+
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "frames-queued-total",
+      base->frames_queued + msg->frames_queued);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "frames-sent-total",
+      base->frames_sent + msg->frames_sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bytes-queued-total",
+      base->bytes_queued + msg->bytes_queued);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bytes-sent-total",
+      base->bytes_sent + msg->bytes_sent);
+  gst_ftl_sink_set_int64_stat (stats_message, prefix, "bw-throttles-total",
+      base->bw_throttling_count + msg->bw_throttling_count);
+}
+
+/* Returns the pad @pad is linked to, looking through ghost pads */
+static GstPad *
+gst_ftl_sink_get_real_peer (GstPad * pad)
+{
+  GstPad *peer = gst_pad_get_peer (pad);
+
+  while (peer != NULL) {
+    GstPad *next;
+
+    if (GST_IS_GHOST_PAD (peer)) {
+      /* Source pad of a bin, go inside */
+      next = gst_ghost_pad_get_target (GST_GHOST_PAD (peer));
+    } else if (GST_IS_PROXY_PAD (peer)) {
+      /* Inside of a bin's sink pad, go outside */
+      GstProxyPad *ghost = gst_proxy_pad_get_internal (GST_PROXY_PAD (peer));
+      next = NULL;
+      if (ghost != NULL) {
+        next = gst_pad_get_peer (GST_PAD (ghost));
+        gst_object_unref (ghost);
       }
+    } else {
+      break;
+    }
+
+    gst_object_unref (peer);
+    peer = next;
+  }
+
+  return peer;
+}
+
+/* Finds the closest element upstream of our video pad that has
+ * @property, usually the encoder */
+static GstElement *
+gst_ftl_sink_find_upstream_with_property (GstFtlSink * self,
+    const gchar * property)
+{
+  GstPad *pad = gst_object_ref (self->videosinkpad);
+
+  for (guint depth = 0; pad != NULL && depth < MAX_ENCODER_SEARCH_DEPTH;
+      depth++) {
+    GstPad *peer = gst_ftl_sink_get_real_peer (pad);
+    GstElement *element;
+
+    gst_object_unref (pad);
+    pad = NULL;
+
+    if (peer == NULL)
+      break;
+
+    element = gst_pad_get_parent_element (peer);
+    gst_object_unref (peer);
+
+    if (element == NULL)
+      break;
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), property))
+      return element;
 
-        /* Really just video, this time */
-      case FTL_STATUS_VIDEO:{
-        ftl_video_frame_stats_msg_t *msg = &message.msg.video_stats;
-
-        GST_LOG_OBJECT (self, "Video frame stats: period %" PRId64
-            " ms, %" PRId64 " frames queued, %" PRId64 " frames sent, %" PRId64
-            " bytes queued, %" PRId64 " bytes sent, %" PRId64
-            " bandwidth throttles, queue fill level %d, max frame size %d",
-            msg->period, msg->frames_queued, msg->frames_sent,
-            msg->bytes_queued, msg->bytes_sent, msg->bw_throttling_count,
-            msg->queue_fullness, msg->max_frame_size);
-
-        if (stats_message == NULL)
-          stats_message = gst_structure_new_id_empty (ftl_stats_id);
-
-        gst_structure_set (stats_message,
-            "video-frames-queued", G_TYPE_INT64, msg->frames_queued,
-            "video-frames-sent", G_TYPE_INT64, msg->frames_sent,
-            "video-bytes-queued", G_TYPE_INT64, msg->bytes_queued,
-            "video-bytes-sent", G_TYPE_INT64, msg->bytes_sent,
-            "video-queue-level", G_TYPE_INT, msg->queue_fullness,
-            "video-max-frame-size", G_TYPE_INT, msg->max_frame_size, NULL);
-        break;
+    pad = gst_element_get_static_pad (element, "sink");
+    gst_object_unref (element);
+  }
+
+  if (pad != NULL)
+    gst_object_unref (pad);
+  return NULL;
+}
+
+static void
+gst_ftl_sink_set_encoder_bitrate (GstFtlSink * self, const gchar * property,
+    guint64 bitrate, guint divisor)
+{
+  GstElement *encoder;
+  GParamSpec *pspec;
+  GValue value = G_VALUE_INIT, converted = G_VALUE_INIT;
+
+  encoder = gst_ftl_sink_find_upstream_with_property (self, property);
+  if (encoder == NULL) {
+    GST_DEBUG_OBJECT (self, "no upstream element has a '%s' property",
+        property);
+    return;
+  }
+
+  pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (encoder),
+      property);
+
+  g_value_init (&value, G_TYPE_UINT64);
+  g_value_set_uint64 (&value, bitrate / divisor);
+  g_value_init (&converted, pspec->value_type);
+
+  if ((pspec->flags & G_PARAM_WRITABLE) &&
+      g_value_transform (&value, &converted)) {
+    g_param_value_validate (pspec, &converted);
+    GST_INFO_OBJECT (self, "setting %" GST_PTR_FORMAT " %s to %"
+        G_GUINT64_FORMAT, encoder, property, bitrate / divisor);
+    g_object_set_property (G_OBJECT (encoder), property, &converted);
+  } else {
+    GST_WARNING_OBJECT (self, "can't set %s of %" GST_PTR_FORMAT, property,
+        encoder);
+  }
+
+  g_value_unset (&converted);
+  g_value_unset (&value);
+  gst_object_unref (encoder);
+}
+
+/* Passes libftl's new bitrate on upstream, within our limits */
+static void
+gst_ftl_sink_adapt_bitrate (GstFtlSink * self, ftl_bitrate_changed_msg_t * msg)
+{
+  guint64 bitrate = msg->current_encoding_bitrate;
+  guint64 min_bitrate, max_bitrate, previous, change;
+  guint hysteresis, divisor;
+  gchar *property;
+  GstPad *pad;
+
+  GST_OBJECT_LOCK (self);
+  if (!self->adaptive_bitrate) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+  min_bitrate = self->min_kbps * G_GUINT64_CONSTANT (1000);
+  max_bitrate = self->max_kbps * G_GUINT64_CONSTANT (1000);
+  hysteresis = self->bitrate_hysteresis;
+  property = g_strdup (self->encoder_bitrate_property);
+  divisor = self->encoder_bitrate_divisor;
+  GST_OBJECT_UNLOCK (self);
+
+  if (max_bitrate > 0)
+    bitrate = MIN (bitrate, max_bitrate);
+  bitrate = MAX (bitrate, min_bitrate);
+
+  previous = self->target_bitrate;
+  change = bitrate > previous ? bitrate - previous : previous - bitrate;
+
+  /* Stabilizing is libftl settling on a bitrate, always follow that */
+  if (previous > 0 && change * 100 < previous * hysteresis &&
+      msg->bitrate_changed_type != FTL_BITRATE_STABILIZED) {
+    GST_DEBUG_OBJECT (self, "ignoring bitrate change from %" G_GUINT64_FORMAT
+        " to %" G_GUINT64_FORMAT " bps", previous, bitrate);
+    goto done;
+  }
+
+  if (bitrate == previous)
+    goto done;
+
+  GST_INFO_OBJECT (self, "adapting bitrate from %" G_GUINT64_FORMAT " to %"
+      G_GUINT64_FORMAT " bps", previous, bitrate);
+  self->target_bitrate = bitrate;
+
+  pad = gst_element_get_static_pad (self->ftlvideosink, "sink");
+  gst_pad_push_event (pad,
+      gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+          gst_structure_new ("ftl-bitrate-changed",
+              "bitrate", G_TYPE_UINT64, bitrate,
+              "previous-bitrate", G_TYPE_UINT64, previous,
+              "type", G_TYPE_STRING,
+              gst_ftl_bitrate_changed_type_get_nick (msg->bitrate_changed_type),
+              "reason", G_TYPE_STRING,
+              gst_ftl_bitrate_changed_reason_get_nick
+              (msg->bitrate_changed_reason), NULL)));
+  gst_object_unref (pad);
+
+  if (property != NULL && property[0] != '\0')
+    gst_ftl_sink_set_encoder_bitrate (self, property, bitrate, divisor);
+
+  gst_structure_set (gst_ftl_sink_get_stats_message (self),
+      "bitrate-target", G_TYPE_UINT64, bitrate, NULL);
+
+done:
+  g_free (property);
+}
+
+static void
+gst_ftl_sink_handle_status (GstFtlSink * self, ftl_status_msg_t * message)
+{
+  switch (message->type) {
+    case FTL_STATUS_LOG:{
+      ftl_status_log_msg_t *msg = &message->msg.log;
+      GstDebugLevel level;
+
+      level = gst_ftl_log_severity_to_level (msg->log_level);
+      g_strchomp (msg->string);
+
+      GST_CAT_LEVEL_LOG (GST_CAT_DEFAULT, level, self, "%s", msg->string);
+      break;
+    }
+
+    case FTL_STATUS_EVENT:
+      if (message->msg.event.type == FTL_STATUS_EVENT_TYPE_DISCONNECTED) {
+        gst_ftl_sink_fold_status_totals (self);
+        g_atomic_int_set (&self->ftl_queue_level, 0);
       }
 
-      case FTL_BITRATE_CHANGED:{
-        ftl_bitrate_changed_msg_t *msg = &message.msg.bitrate_changed_msg;
-        gdouble nack_value = msg->nacks_to_frames_ratio;
-        const gchar *nack_unit = "nacks per frame";
-
-        if (msg->nacks_to_frames_ratio > 0 && msg->nacks_to_frames_ratio < 1) {
-          nack_value = 1 / nack_value;
-          nack_unit = "frames per nack";
-        }
-
-        GST_LOG_OBJECT (self, "Bitrate change: type %s, reason %s, %" PRIu64
-            " bps current, %" PRIu64 " bps previous, %.3f %s, RTT %.3f ms,"
-            " %" PRIu64 " frames dropped, queue fill level %.3f",
-            gst_ftl_bitrate_changed_type_get_nick (msg->bitrate_changed_type),
-            gst_ftl_bitrate_changed_reason_get_nick
-            (msg->bitrate_changed_reason), msg->current_encoding_bitrate,
-            msg->previous_encoding_bitrate, nack_value, nack_unit, msg->avg_rtt,
-            msg->avg_frames_dropped, msg->queue_fullness);
-        break;
+      gst_ftl_sink_handle_event (self, &message->msg.event);
+      break;
+
+      /* Really for both streams */
+    case FTL_STATUS_VIDEO_PACKETS:
+      gst_ftl_sink_handle_packet_stats (self, FTL_VIDEO_DATA,
+          &message->msg.pkt_stats);
+      break;
+
+    case FTL_STATUS_AUDIO_PACKETS:
+      gst_ftl_sink_handle_packet_stats (self, FTL_AUDIO_DATA,
+          &message->msg.pkt_stats);
+      break;
+
+      /* Really for both streams */
+    case FTL_STATUS_VIDEO_PACKETS_INSTANT:{
+      ftl_packet_stats_instant_msg_t *msg = &message->msg.ipkt_stats;
+
+      GST_LOG_OBJECT (self, "Instant packet stats: period %" PRId64
+          " ms, RTT %d ms (min %d ms, max %d ms), delay %d ms (min %d"
+          " ms, max %d ms)", msg->period, msg->avg_rtt, msg->min_rtt,
+          msg->max_rtt, msg->avg_xmit_delay, msg->min_xmit_delay,
+          msg->max_xmit_delay);
+
+      gst_structure_set (gst_ftl_sink_get_stats_message (self),
+          "time-interval", GST_TYPE_CLOCK_TIME, msg->period * GST_MSECOND,
+          "rtt-min", G_TYPE_INT, msg->min_rtt,
+          "rtt-max", G_TYPE_INT, msg->max_rtt,
+          "rtt-avg", G_TYPE_INT, msg->avg_rtt,
+          "xmit-delay-min", G_TYPE_INT, msg->min_xmit_delay,
+          "xmit-delay-max", G_TYPE_INT, msg->max_xmit_delay,
+          "xmit-delay-avg", G_TYPE_INT, msg->avg_xmit_delay, NULL);
+      break;
+    }
+
+      /* Really just video, this time */
+    case FTL_STATUS_VIDEO:
+      gst_ftl_sink_handle_frame_stats (self, FTL_VIDEO_DATA,
+          &message->msg.video_stats);
+      break;
+
+    case FTL_STATUS_AUDIO:
+      gst_ftl_sink_handle_frame_stats (self, FTL_AUDIO_DATA,
+          &message->msg.video_stats);
+      break;
+
+    case FTL_BITRATE_CHANGED:{
+      ftl_bitrate_changed_msg_t *msg = &message->msg.bitrate_changed_msg;
+      gdouble nack_value = msg->nacks_to_frames_ratio;
+      const gchar *nack_unit = "nacks per frame";
+
+      if (msg->nacks_to_frames_ratio > 0 && msg->nacks_to_frames_ratio < 1) {
+        nack_value = 1 / nack_value;
+        nack_unit = "frames per nack";
       }
 
-      case FTL_STATUS_NONE:
-      case FTL_STATUS_AUDIO_PACKETS:
-      case FTL_STATUS_AUDIO:
-      case FTL_STATUS_FRAMES_DROPPED:
-      case FTL_STATUS_NETWORK:
-      default:
-        GST_WARNING_OBJECT (self, "Unhandled status message type: %s (%d)",
-            gst_ftl_status_type_get_nick (message.type), message.type);
-        break;
+      GST_LOG_OBJECT (self, "Bitrate change: type %s, reason %s, %" PRIu64
+          " bps current, %" PRIu64 " bps previous, %.3f %s, RTT %.3f ms,"
+          " %" PRIu64 " frames dropped, queue fill level %.3f",
+          gst_ftl_bitrate_changed_type_get_nick (msg->bitrate_changed_type),
+          gst_ftl_bitrate_changed_reason_get_nick
+          (msg->bitrate_changed_reason), msg->current_encoding_bitrate,
+          msg->previous_encoding_bitrate, nack_value, nack_unit, msg->avg_rtt,
+          msg->avg_frames_dropped, msg->queue_fullness);
+
+      self->bitrate_changes++;
+
+      gst_structure_set (gst_ftl_sink_get_stats_message (self),
+          "bitrate-change-type", G_TYPE_STRING,
+          gst_ftl_bitrate_changed_type_get_nick (msg->bitrate_changed_type),
+          "bitrate-change-reason", G_TYPE_STRING,
+          gst_ftl_bitrate_changed_reason_get_nick
+          (msg->bitrate_changed_reason),
+          "bitrate-current", G_TYPE_UINT64, msg->current_encoding_bitrate,
+          "bitrate-previous", G_TYPE_UINT64, msg->previous_encoding_bitrate,
+          "bitrate-nacks-per-frame", G_TYPE_DOUBLE,
+          (gdouble) msg->nacks_to_frames_ratio,
+          "bitrate-rtt-avg", G_TYPE_DOUBLE, (gdouble) msg->avg_rtt,
+          "bitrate-frames-dropped-avg", G_TYPE_UINT64, msg->avg_frames_dropped,
+          "bitrate-queue-level", G_TYPE_DOUBLE, (gdouble) msg->queue_fullness,
+          "bitrate-changes-total", G_TYPE_UINT64, self->bitrate_changes, NULL);
+
+      gst_ftl_sink_adapt_bitrate (self, msg);
+      break;
     }
 
+      /* libftl defines no payload for these, so all we have is their count */
+    case FTL_STATUS_FRAMES_DROPPED:
+      GST_INFO_OBJECT (self, "libftl dropped frames");
+      gst_structure_set (gst_ftl_sink_get_stats_message (self),
+          "frames-dropped-reports-total", G_TYPE_UINT64,
+          ++self->frames_dropped_reports, NULL);
+      break;
+
+    case FTL_STATUS_NETWORK:
+      GST_INFO_OBJECT (self, "libftl reported a network condition");
+      gst_structure_set (gst_ftl_sink_get_stats_message (self),
+          "network-reports-total", G_TYPE_UINT64, ++self->network_reports,
+          NULL);
+      break;
+
+    case FTL_STATUS_NONE:
+    default:
+      GST_WARNING_OBJECT (self, "Unhandled status message type: %s (%d)",
+          gst_ftl_status_type_get_nick (message->type), message->type);
+      break;
+  }
+}
+
+/* Called periodically from a dispatcher thread, so it must not block */
+static void
+gst_ftl_sink_dispatch_status (gpointer user_data)
+{
+  GstFtlSink *self = user_data;
+  ftl_status_t status_code;
+  ftl_status_msg_t message = { FTL_STATUS_NONE, };
+
+  /* Nothing to report before the first connect */
+  if (!g_atomic_int_get (&self->handle_created)) {
+    gst_ftl_sink_post_stats (self, gst_util_get_timestamp ());
+    return;
+  }
+
+  GST_TRACE_OBJECT (self, "Getting status");
+  status_code = ftl_ingest_get_status (&self->handle, &message, 0);
+
+  while (status_code == FTL_SUCCESS) {
+    gst_ftl_sink_handle_status (self, &message);
+
     GST_TRACE_OBJECT (self, "Getting more status");
     status_code = ftl_ingest_get_status (&self->handle, &message, 0);
   }
@@ -597,9 +2389,7 @@ gst_ftl_sink_status_loop (gpointer user_data)
       break;
   }
 
-  if (stats_message != NULL)
-    gst_element_post_message (GST_ELEMENT (self),
-        gst_message_new_element (GST_OBJECT (self), stats_message));
+  gst_ftl_sink_post_stats (self, gst_util_get_timestamp ());
 }
 
 static void
@@ -611,7 +2401,8 @@ gst_ftl_sink_handle_event (GstFtlSink * self, ftl_status_event_msg_t * event)
       ftl_status_code_to_string (event->error_code));
 
   if (event->type == FTL_STATUS_EVENT_TYPE_DISCONNECTED &&
-      event->reason != FTL_STATUS_EVENT_REASON_API_REQUEST)
+      event->reason != FTL_STATUS_EVENT_REASON_API_REQUEST &&
+      !gst_ftl_sink_start_reconnect (self))
     GST_ELEMENT_ERROR_WITH_DETAILS (self, RESOURCE, FAILED,
         ("FTL connection unexpectedly terminated"),
         ("Reason %s: %s",
@@ -621,8 +2412,176 @@ gst_ftl_sink_handle_event (GstFtlSink * self, ftl_status_event_msg_t * event)
             "error-code", G_TYPE_INT, event->error_code, NULL));
 }
 
+static void
+gst_ftl_sink_stop_status (GstFtlSink * self)
+{
+  if (self->status_entry != NULL) {
+    gst_ftl_dispatcher_remove (self->status_entry);
+    self->status_entry = NULL;
+  }
+}
+
+/* Only takes the object lock, so it's safe to call as often as needed */
+static GstStructure *
+gst_ftl_sink_get_stats (GstFtlSink * self)
+{
+  GstStructure *stats = gst_structure_new_id_empty (ftl_stats_id);
+
+  gst_structure_set (stats, "connected", G_TYPE_BOOLEAN,
+      g_atomic_int_get (&self->connection_state) == GST_FTL_SINK_CONNECTED,
+      NULL);
+  gst_ftl_counters_snapshot (&self->counters, stats);
+
+  GST_OBJECT_LOCK (self);
+  gst_ftl_sink_add_ingest_stats (self, stats);
+  gst_ftl_sink_add_mirror_stats (self, stats);
+  if (self->transport != NULL)
+    gst_ftl_transport_add_stats (self->transport, stats);
+  GST_OBJECT_UNLOCK (self);
+
+  return stats;
+}
+
 ftl_handle_t *
 gst_ftl_sink_get_handle (GstFtlSink * self)
 {
   return &self->handle;
 }
+
+/* From the video caps, 0/1 for variable or unknown framerates */
+void
+gst_ftl_sink_set_framerate (GstFtlSink * self, gint fps_n, gint fps_d)
+{
+  GST_OBJECT_LOCK (self);
+  self->fps_n = fps_n;
+  self->fps_d = fps_d;
+  GST_OBJECT_UNLOCK (self);
+}
+
+gboolean
+gst_ftl_sink_is_connected (GstFtlSink * self)
+{
+  return g_atomic_int_get (&self->connection_state) == GST_FTL_SINK_CONNECTED;
+}
+
+/* Keeps the native transport from being reopened until
+ * gst_ftl_sink_end_send(). Wraps everything sent for one buffer, and doesn't
+ * nest. */
+void
+gst_ftl_sink_begin_send (GstFtlSink * self)
+{
+  g_rw_lock_reader_lock (&self->send_lock);
+}
+
+void
+gst_ftl_sink_end_send (GstFtlSink * self)
+{
+  g_rw_lock_reader_unlock (&self->send_lock);
+}
+
+/* Sends one NALU or audio frame to @handle, which is either ours or a
+ * mirror's. Ours may go through the native transport, which holds on to
+ * @data until the end of the frame or gst_ftl_sink_flush_media(), and keeps
+ * a reference to @map's memory for retransmissions if @map isn't NULL. */
+gint
+gst_ftl_sink_send_media (GstFtlSink * self, ftl_handle_t * handle,
+    ftl_media_type_t media_type, gint64 dts_usec, const GstMapInfo * map,
+    const guint8 * data, gsize size, gboolean end_of_frame)
+{
+  if (handle == &self->handle && self->transport != NULL)
+    return gst_ftl_transport_send (self->transport, media_type, dts_usec,
+        map, data, size, end_of_frame);
+
+  return ftl_ingest_send_media_dts (handle, media_type, dts_usec,
+      (guint8 *) data, size, end_of_frame);
+}
+
+/* Paces the video frame about to be sent over the configured part of the
+ * frame interval, if the native transport is in use */
+void
+gst_ftl_sink_pace_frame (GstFtlSink * self, gsize size)
+{
+  GstClockTime span = 0;
+
+  if (self->transport == NULL)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  if (self->fps_n > 0 && self->pacing_fraction > 0)
+    span = gst_util_uint64_scale (GST_SECOND * self->pacing_fraction,
+        self->fps_d, self->fps_n);
+  GST_OBJECT_UNLOCK (self);
+
+  if (span > 0)
+    gst_ftl_transport_pace_frame (self->transport, FTL_VIDEO_DATA, size,
+        span);
+}
+
+/* Sends whatever the native transport holds on to */
+void
+gst_ftl_sink_flush_media (GstFtlSink * self, ftl_media_type_t media_type)
+{
+  if (self->transport != NULL)
+    gst_ftl_transport_flush (self->transport, media_type);
+}
+
+/* Lets the native transport send several frames of @media_type at once,
+ * see gst_ftl_transport_set_batching() */
+void
+gst_ftl_sink_set_batching (GstFtlSink * self, ftl_media_type_t media_type,
+    gboolean batching)
+{
+  if (self->transport != NULL)
+    gst_ftl_transport_set_batching (self->transport, media_type, batching);
+}
+
+GstFtlCounters *
+gst_ftl_sink_get_counters (GstFtlSink * self)
+{
+  return &self->counters;
+}
+
+/* Called by the child sinks while streaming */
+guint
+gst_ftl_sink_get_n_mirrors (GstFtlSink * self)
+{
+  return self->mirrors != NULL ? self->mirrors->len : 0;
+}
+
+GstFtlMirror *
+gst_ftl_sink_get_mirror (GstFtlSink * self, guint index)
+{
+  return g_ptr_array_index (self->mirrors, index);
+}
+
+/* Returns the NAL drop actions to apply to the next video buffer. Called
+ * by ftlvideosink, from render() or from the sender thread. */
+GstFtlNalDropFlags
+gst_ftl_sink_get_nal_drop_flags (GstFtlSink * self)
+{
+  GstFtlNalDropFlags flags = g_atomic_int_get (&self->nal_drop_policy);
+  gint level;
+
+  if (flags == 0)
+    return 0;
+
+  level = g_atomic_int_get (&self->ftl_queue_level);
+  if (self->sender != NULL)
+    level = MAX (level, (gint) gst_ftl_sender_get_fill_level (self->sender,
+            FTL_VIDEO_DATA));
+
+  if (level < g_atomic_int_get (&self->nal_drop_threshold))
+    flags &= ~GST_FTL_NAL_DROP_NON_REFERENCE;
+  if (level < g_atomic_int_get (&self->nal_skip_threshold))
+    flags &= ~GST_FTL_NAL_DROP_SKIP_TO_IDR;
+
+  return flags;
+}
+
+/* Safe to call from any thread */
+void
+gst_ftl_sink_record_latency (GstFtlSink * self, GstFtlLatencyStage stage,
+    ftl_media_type_t media_type, GstClockTime latency)
+{
+  gst_ftl_histogram_record (&self->latency[stage][media_type], latency);
+}
@@ -26,14 +26,48 @@
 
 #include <gst/gst.h>
 #include "ftl.h"
+#include "gstftlcounters.h"
+#include "gstftlenums.h"
+#include "gstftlmirror.h"
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  GST_FTL_LATENCY_SYNC,         /* waiting for the clock */
+  GST_FTL_LATENCY_QUEUE,        /* waiting for the sender thread */
+  GST_FTL_LATENCY_SEND,         /* inside ftl_ingest_send_media_dts() */
+  GST_FTL_N_LATENCY_STAGES,
+} GstFtlLatencyStage;
+
 #define GST_TYPE_FTL_SINK gst_ftl_sink_get_type ()
 G_DECLARE_FINAL_TYPE (GstFtlSink, gst_ftl_sink, GST, FTL_SINK, GstBin)
 
 ftl_handle_t * gst_ftl_sink_get_handle (GstFtlSink * sink);
-gboolean gst_ftl_sink_connect (GstFtlSink * self);
+gboolean gst_ftl_sink_is_connected (GstFtlSink * sink);
+void gst_ftl_sink_set_framerate (GstFtlSink * sink, gint fps_n, gint fps_d);
+void gst_ftl_sink_begin_send (GstFtlSink * sink);
+void gst_ftl_sink_end_send (GstFtlSink * sink);
+gint gst_ftl_sink_send_media (GstFtlSink * sink, ftl_handle_t * handle,
+    ftl_media_type_t media_type, gint64 dts_usec, const GstMapInfo * map,
+    const guint8 * data, gsize size, gboolean end_of_frame);
+void gst_ftl_sink_pace_frame (GstFtlSink * sink, gsize size);
+void gst_ftl_sink_flush_media (GstFtlSink * sink,
+    ftl_media_type_t media_type);
+void gst_ftl_sink_set_batching (GstFtlSink * sink,
+    ftl_media_type_t media_type, gboolean batching);
+GstFtlCounters * gst_ftl_sink_get_counters (GstFtlSink * sink);
+GstFtlNalDropFlags gst_ftl_sink_get_nal_drop_flags (GstFtlSink * sink);
+guint gst_ftl_sink_get_n_mirrors (GstFtlSink * sink);
+GstFtlMirror * gst_ftl_sink_get_mirror (GstFtlSink * sink, guint index);
+void gst_ftl_sink_record_latency (GstFtlSink * sink, GstFtlLatencyStage stage,
+    ftl_media_type_t media_type, GstClockTime latency);
+GstFlowReturn gst_ftl_sink_send_buffer (GstFtlSink * self,
+    ftl_media_type_t media_type, GstBuffer * buffer, GstClockTime time);
+GstFlowReturn gst_ftl_sink_send_list (GstFtlSink * self,
+    ftl_media_type_t media_type, GstBufferList * list,
+    const GstClockTime * times);
+void gst_ftl_sink_drain (GstFtlSink * self);
 
 G_END_DECLS
 
@@ -0,0 +1,1024 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Native media transport for the main ingest. libftl still does the
+ * handshake and keeps the control connection, but media bypasses it: each
+ * NALU or audio frame is packetized here, with the RTP headers kept apart
+ * from the payload so nothing gets copied out of the mapped buffers, and
+ * the packets of a frame go out together.
+ *
+ * In sendmmsg mode that is one sendmmsg() per frame (or per
+ * BATCH_PACKETS packets). In gso mode, runs of equally sized packets,
+ * which is what FU-A fragmentation produces, each become one
+ * UDP_SEGMENT message that the kernel splits, and the runs of a frame
+ * still share one sendmmsg(). GSO falls back to sendmmsg mode if the
+ * kernel rejects it.
+ *
+ * Packets follow libftl's layout: payload types 96 (H.264) and 97 (Opus),
+ * SSRCs channel ID + 1 and channel ID, single NALU or FU-A packets of at
+ * most MAX_PACKET_SIZE bytes.
+ *
+ * Sent packets go into a GstFtlRtxRing per stream. The socket is
+ * registered with the shared reactor, whose thread reads the NACKs the
+ * ingest sends back as they arrive and resends the packets from the ring,
+ * unchanged like libftl does.
+ *
+ * While a frame is being paced, see gstftlpacer.c, the packets go out in
+ * slices of PACING_SLICE_PACKETS instead.
+ *
+ * With FEC, every group of video packets is followed by an XOR parity
+ * packet, see gstftlfec.c. Groups end with their frame, so parity never
+ * waits for the next one. Parity packets have a random SSRC of their own
+ * and carry the video SSRC as their only CSRC. In automatic mode, the
+ * group size follows the share of video packets the ingest NACKs.
+ */
+
+/* For sendmmsg() */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstftltransport.h"
+#include "gstftlfec.h"
+#include "gstftlpacer.h"
+#include "gstftlreactor.h"
+#include "gstftlrtxring.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+GST_DEBUG_CATEGORY_STATIC (gst_ftl_transport_debug);
+#define GST_CAT_DEFAULT gst_ftl_transport_debug
+
+/* Same as libftl, leaves room for tunnels below the usual 1500 byte MTU */
+#define MAX_PACKET_SIZE 1392
+#define RTP_HEADER_SIZE 12
+#define FU_A_HEADER_SIZE 2
+#define MAX_PAYLOAD_SIZE (MAX_PACKET_SIZE - RTP_HEADER_SIZE)
+
+#define VIDEO_PAYLOAD_TYPE 96
+#define AUDIO_PAYLOAD_TYPE 97
+#define VIDEO_CLOCK_RATE 90000
+#define AUDIO_CLOCK_RATE 48000
+
+#define NALU_TYPE_FU_A 28
+
+/* With the protected SSRC as CSRC */
+#define FEC_RTP_HEADER_SIZE (RTP_HEADER_SIZE + 4)
+/* Video payloads shrink by this with FEC, so parity fits in
+ * MAX_PACKET_SIZE too */
+#define FEC_OVERHEAD (FEC_RTP_HEADER_SIZE + GST_FTL_FEC_HEADER_SIZE - \
+    RTP_HEADER_SIZE)
+/* Automatic FEC sends twice as many parity packets as packets get
+ * lost, and none below this loss rate */
+#define FEC_AUTO_MIN_LOSS 0.001
+
+/* Packets queued before a flush is forced */
+#define BATCH_PACKETS 64
+/* Packets sent at once while pacing, about 11 kB */
+#define PACING_SLICE_PACKETS 8
+/* Parity packets queued before a flush is forced */
+#define FEC_BATCH_PACKETS (BATCH_PACKETS / 2)
+/* Limits of one UDP_SEGMENT message */
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+
+#define SENDER_REPORT_INTERVAL G_USEC_PER_SEC
+#define SENDER_REPORT_SIZE 28
+
+#define RTCP_RTPFB 205
+#define RTCP_RTPFB_NACK 1
+#define MAX_FEEDBACK_SIZE 1500
+
+typedef struct
+{
+  /* Room for FU-A or a CSRC */
+  guint8 header[RTP_HEADER_SIZE + 4];
+  /* Header and payload */
+  struct iovec iov[2];
+  gsize size;
+} GstFtlTransportPacket;
+
+typedef struct
+{
+  guint32 ssrc;
+  guint8 payload_type;
+  guint clock_rate;
+  guint16 seq;
+  guint32 timestamp;
+
+  GstFtlTransportPacket packets[BATCH_PACKETS];
+  guint n_packets;
+  /* Ends of frames don't flush while set */
+  gboolean batching;
+  /* Scratch space for flushing */
+  struct mmsghdr messages[BATCH_PACKETS];
+  struct iovec iov[2 * BATCH_PACKETS];
+  guint first_packet[BATCH_PACKETS];
+  union
+  {
+    gchar data[CMSG_SPACE (sizeof (guint16))];
+    struct cmsghdr align;
+  } control[BATCH_PACKETS];
+
+  GstFtlPacer pacer;
+
+  /* Forward error correction, only for video. Percentage -1 for
+   * automatic, group size 0 while off. */
+  gint fec_percentage;
+  guint fec_group_size;
+  gsize max_payload;
+  guint32 fec_ssrc;
+  guint16 fec_seq;
+  GstFtlFecGroup fec;
+  /* Parity of the queued packets */
+  guint8 (*fec_payloads)[GST_FTL_FEC_HEADER_SIZE +
+      GST_FTL_FEC_MAX_PROTECTED_SIZE];
+  guint n_fec;
+  /* Sequence numbers NACKed so far, updated atomically by the reactor,
+   * and what automatic FEC last looked at */
+  guint nacked;
+  guint last_nacked;
+  guint32 last_sent_packets;
+  gdouble loss;
+
+  /* For sender reports */
+  guint32 sent_packets;
+  guint32 sent_octets;
+  gint64 next_report;
+
+  /* Protects the ring and the scratch space for resending, which the
+   * reactor thread does. NULL ring if retransmissions are off. Starts a
+   * cache line of its own, and so does each stream, so the threads don't
+   * contend for lines they never share data on. */
+  GMutex rtx_lock __attribute__ ((aligned (GST_FTL_CACHE_LINE_SIZE)));
+  GstFtlRtxRing *rtx;
+  GstMapInfo rtx_maps[BATCH_PACKETS];
+  struct mmsghdr rtx_messages[BATCH_PACKETS];
+  struct iovec rtx_iov[2 * BATCH_PACKETS];
+  guint n_rtx;
+} GstFtlTransportStream;
+
+struct _GstFtlTransport
+{
+  GstObject *parent;
+  GstFtlCounters *counters;
+  GstFtlTransportMode mode;
+  gint fd;
+  GstFtlReactorSource *source;
+
+  /* Indexed by ftl_media_type_t. Only used by that stream's thread, except
+   * for the retransmission parts. */
+  GstFtlTransportStream streams[2];
+};
+
+static void receive_feedback (gint fd, gpointer user_data);
+
+static inline void
+write_uint16 (guint8 * data, guint16 value)
+{
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+static inline void
+write_uint32 (guint8 * data, guint32 value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static inline guint16
+read_uint16 (const guint8 * data)
+{
+  return (data[0] << 8) | data[1];
+}
+
+static inline guint32
+read_uint32 (const guint8 * data)
+{
+  return ((guint32) data[0] << 24) | (data[1] << 16) | (data[2] << 8) |
+      data[3];
+}
+
+/* Packets per parity packet for @percentage parity */
+static guint
+fec_group_size_for_percentage (guint percentage)
+{
+  if (percentage == 0)
+    return 0;
+
+  return CLAMP ((100 + percentage / 2) / percentage, 2,
+      GST_FTL_FEC_MAX_GROUP_SIZE);
+}
+
+/* Keeps sent packets for @rtx_time, but at most @rtx_bytes of them. Either
+ * one 0 disables retransmissions. Paced slices record how late they went
+ * out in @pacing_error. @fec_percentage is how many parity packets to send
+ * per 100 video packets, or -1 to adapt to losses. */
+GstFtlTransport *
+gst_ftl_transport_new (GstObject * parent, GstFtlTransportMode mode,
+    GstFtlCounters * counters, GstFtlHistogram * pacing_error,
+    GstClockTime rtx_time, gsize rtx_bytes, gint fec_percentage)
+{
+  GstFtlTransportStream *video;
+  static gsize initialized = 0;
+  GstFtlTransport *transport;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ftl_transport_debug, "ftltransport", 0,
+        "debug category for ftlsink native media transport");
+    g_once_init_leave (&initialized, 1);
+  }
+
+  g_return_val_if_fail (mode != GST_FTL_TRANSPORT_LIBFTL, NULL);
+
+  /* For the alignment of the streams */
+  if (posix_memalign ((gpointer *) & transport, GST_FTL_CACHE_LINE_SIZE,
+          sizeof (GstFtlTransport)) != 0)
+    g_error ("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+        sizeof (GstFtlTransport));
+  memset (transport, 0, sizeof (GstFtlTransport));
+
+  transport->parent = parent;
+  transport->counters = counters;
+  transport->mode = mode;
+  transport->fd = -1;
+
+  transport->streams[FTL_VIDEO_DATA].payload_type = VIDEO_PAYLOAD_TYPE;
+  transport->streams[FTL_VIDEO_DATA].clock_rate = VIDEO_CLOCK_RATE;
+  transport->streams[FTL_AUDIO_DATA].payload_type = AUDIO_PAYLOAD_TYPE;
+  transport->streams[FTL_AUDIO_DATA].clock_rate = AUDIO_CLOCK_RATE;
+
+  for (guint i = 0; i < G_N_ELEMENTS (transport->streams); i++) {
+    GstFtlTransportStream *stream = &transport->streams[i];
+
+    gst_ftl_pacer_init (&stream->pacer, pacing_error);
+    stream->max_payload = MAX_PAYLOAD_SIZE;
+    g_mutex_init (&stream->rtx_lock);
+    if (rtx_time > 0 && rtx_bytes > 0)
+      stream->rtx = gst_ftl_rtx_ring_new (rtx_time, rtx_bytes);
+  }
+
+  video = &transport->streams[FTL_VIDEO_DATA];
+  video->fec_percentage = fec_percentage;
+  if (fec_percentage != 0) {
+    video->fec_group_size = fec_percentage > 0 ?
+        fec_group_size_for_percentage (fec_percentage) : 0;
+    video->max_payload -= FEC_OVERHEAD;
+    video->fec_payloads = g_malloc (FEC_BATCH_PACKETS *
+        sizeof (*video->fec_payloads));
+  }
+
+  return transport;
+}
+
+void
+gst_ftl_transport_free (GstFtlTransport * transport)
+{
+  /* Feedback may be handled right now, stop that before freeing the rings
+   * it retransmits from */
+  if (transport->source != NULL)
+    gst_ftl_reactor_remove (transport->source);
+  if (transport->fd >= 0)
+    close (transport->fd);
+
+  for (guint i = 0; i < G_N_ELEMENTS (transport->streams); i++) {
+    GstFtlTransportStream *stream = &transport->streams[i];
+
+    if (stream->rtx != NULL)
+      gst_ftl_rtx_ring_free (stream->rtx);
+    g_mutex_clear (&stream->rtx_lock);
+    g_free (stream->fec_payloads);
+  }
+
+  free (transport);
+}
+
+/* Stream keys look like "<channel ID>-<key>", libftl accepts a comma
+ * too */
+static gboolean
+parse_channel_id (const gchar * stream_key, guint32 * channel_id)
+{
+  gchar *end;
+  guint64 value;
+
+  if (stream_key == NULL)
+    return FALSE;
+
+  value = g_ascii_strtoull (stream_key, &end, 10);
+  if (end == stream_key || (*end != '-' && *end != ',') ||
+      value > G_MAXUINT32 - 1)
+    return FALSE;
+
+  *channel_id = value;
+  return TRUE;
+}
+
+/* Returns a UDP socket connected to the media port of the ingest libftl
+ * connected to, or -1. Resolving blocks, but nothing of a transport is
+ * touched yet. */
+gint
+gst_ftl_transport_connect_socket (const gchar * hostname, guint port,
+    GError ** error)
+{
+  struct addrinfo hints = { 0, }, *addrs;
+  gchar service[8];
+  gint ret, fd;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  g_snprintf (service, sizeof (service), "%u", port);
+
+  ret = getaddrinfo (hostname, service, &hints, &addrs);
+  if (ret != 0) {
+    g_set_error (error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_NOT_FOUND,
+        "Failed to resolve %s: %s", hostname, gai_strerror (ret));
+    return -1;
+  }
+
+  /* libftl sends to the first address too */
+  fd = socket (addrs->ai_family, addrs->ai_socktype | SOCK_CLOEXEC,
+      addrs->ai_protocol);
+  if (fd < 0 || connect (fd, addrs->ai_addr, addrs->ai_addrlen) < 0) {
+    g_set_error (error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_OPEN_WRITE,
+        "Failed to open UDP socket to %s:%u: %s", hostname, port,
+        g_strerror (errno));
+    if (fd >= 0)
+      close (fd);
+    freeaddrinfo (addrs);
+    return -1;
+  }
+
+  freeaddrinfo (addrs);
+  return fd;
+}
+
+/* Starts sending over @fd from gst_ftl_transport_connect_socket(), which
+ * @transport takes over even on failure. Must be called before sending,
+ * not while streaming; if reopening, the old socket's sequence numbers and
+ * retransmissions are dropped. */
+gboolean
+gst_ftl_transport_open (GstFtlTransport * transport, gint fd,
+    const gchar * stream_key, GError ** error)
+{
+  guint32 channel_id;
+  gint segment = MAX_PACKET_SIZE;
+
+  if (!parse_channel_id (stream_key, &channel_id)) {
+    g_set_error (error, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_SETTINGS,
+        "No channel ID in the stream key");
+    close (fd);
+    return FALSE;
+  }
+
+  /* Probe for GSO support, the segment size is set per message */
+  if (transport->mode == GST_FTL_TRANSPORT_GSO &&
+      setsockopt (fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof (segment)) < 0) {
+    GST_WARNING_OBJECT (transport->parent, "No UDP segmentation offload "
+        "(%s), using sendmmsg()", g_strerror (errno));
+    transport->mode = GST_FTL_TRANSPORT_SENDMMSG;
+  }
+
+  /* Stop reading feedback before touching the rings */
+  if (transport->source != NULL) {
+    gst_ftl_reactor_remove (transport->source);
+    transport->source = NULL;
+  }
+  if (transport->fd >= 0)
+    close (transport->fd);
+  transport->fd = fd;
+
+  for (guint i = 0; i < G_N_ELEMENTS (transport->streams); i++) {
+    GstFtlTransportStream *stream = &transport->streams[i];
+
+    stream->seq = g_random_int ();
+    stream->n_packets = 0;
+    gst_ftl_pacer_end_frame (&stream->pacer);
+    stream->sent_packets = 0;
+    stream->sent_octets = 0;
+    stream->next_report = 0;
+
+    stream->fec_ssrc = g_random_int ();
+    stream->fec_seq = g_random_int ();
+    gst_ftl_fec_group_reset (&stream->fec);
+    stream->n_fec = 0;
+    stream->nacked = stream->last_nacked = 0;
+    stream->last_sent_packets = 0;
+    stream->loss = 0;
+    if (stream->fec_percentage < 0)
+      stream->fec_group_size = 0;
+
+    if (stream->rtx != NULL)
+      gst_ftl_rtx_ring_clear (stream->rtx);
+  }
+
+  transport->streams[FTL_AUDIO_DATA].ssrc = channel_id;
+  transport->streams[FTL_VIDEO_DATA].ssrc = channel_id + 1;
+
+  transport->source = gst_ftl_reactor_add (fd, receive_feedback, transport,
+      error);
+  if (transport->source == NULL) {
+    close (transport->fd);
+    transport->fd = -1;
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (transport->parent, "sending media natively with %s",
+      (transport->mode == GST_FTL_TRANSPORT_GSO ? "GSO" : "sendmmsg()"));
+  return TRUE;
+}
+
+static void
+send_sender_report (GstFtlTransport * transport,
+    GstFtlTransportStream * stream)
+{
+  guint8 report[SENDER_REPORT_SIZE] = { 0x80, 200, 0, 6, };
+  gint64 now = g_get_real_time ();
+  /* NTP time starts in 1900 */
+  guint64 seconds = now / G_USEC_PER_SEC + G_GUINT64_CONSTANT (2208988800);
+  guint64 fraction = ((guint64) (now % G_USEC_PER_SEC) << 32) /
+      G_USEC_PER_SEC;
+
+  write_uint32 (report + 4, stream->ssrc);
+  write_uint32 (report + 8, seconds);
+  write_uint32 (report + 12, fraction);
+  write_uint32 (report + 16, stream->timestamp);
+  write_uint32 (report + 20, stream->sent_packets);
+  write_uint32 (report + 24, stream->sent_octets);
+
+  if (send (transport->fd, report, sizeof (report), 0) < 0)
+    GST_DEBUG_OBJECT (transport->parent, "Failed to send sender report: %s",
+        g_strerror (errno));
+}
+
+/* Fills stream->messages with one message per packet, or with one
+ * UDP_SEGMENT message per run of equally sized packets. Returns the
+ * number of messages. */
+static guint
+build_messages (GstFtlTransportStream * stream, guint first, gboolean gso)
+{
+  guint n_messages = 0, n_iov = 0;
+  guint i = first;
+
+  while (i < stream->n_packets) {
+    struct mmsghdr *message = &stream->messages[n_messages];
+    gsize segment = stream->packets[i].size, bytes = 0;
+    guint start = i;
+
+    memset (message, 0, sizeof (*message));
+    message->msg_hdr.msg_iov = &stream->iov[n_iov];
+    stream->first_packet[n_messages] = i;
+
+    /* A run may end with one shorter packet */
+    do {
+      GstFtlTransportPacket *packet = &stream->packets[i++];
+
+      stream->iov[n_iov++] = packet->iov[0];
+      stream->iov[n_iov++] = packet->iov[1];
+      bytes += packet->size;
+
+      if (packet->size < segment)
+        break;
+    } while (gso && i < stream->n_packets && i - start < GSO_MAX_SEGMENTS &&
+        stream->packets[i].size <= segment &&
+        bytes + stream->packets[i].size <= GSO_MAX_BYTES);
+
+    message->msg_hdr.msg_iovlen = 2 * (i - start);
+
+    if (i - start > 1) {
+      struct cmsghdr *cmsg;
+
+      message->msg_hdr.msg_control = stream->control[n_messages].data;
+      message->msg_hdr.msg_controllen = CMSG_SPACE (sizeof (guint16));
+
+      cmsg = CMSG_FIRSTHDR (&message->msg_hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN (sizeof (guint16));
+      *(guint16 *) CMSG_DATA (cmsg) = segment;
+    }
+
+    n_messages++;
+  }
+
+  return n_messages;
+}
+
+/* Call with rtx_lock held */
+static void
+send_retransmissions (GstFtlTransport * transport,
+    GstFtlTransportStream * stream)
+{
+  guint sent = 0;
+
+  while (sent < stream->n_rtx) {
+    gint ret = sendmmsg (transport->fd, stream->rtx_messages + sent,
+        stream->n_rtx - sent, 0);
+
+    gst_ftl_counters_inc (transport->counters,
+        GST_FTL_COUNTER_TRANSPORT_SYSCALLS);
+
+    if (ret > 0) {
+      gst_ftl_counters_add (transport->counters,
+          GST_FTL_COUNTER_TRANSPORT_RETRANSMITS, ret);
+      sent += ret;
+    } else if (errno != EINTR) {
+      GST_DEBUG_OBJECT (transport->parent, "Failed to resend packet: %s",
+          g_strerror (errno));
+      gst_ftl_counters_inc (transport->counters,
+          GST_FTL_COUNTER_TRANSPORT_ERRORS);
+      sent++;
+    }
+  }
+
+  for (guint i = 0; i < stream->n_rtx; i++)
+    gst_memory_unmap (stream->rtx_maps[i].memory, &stream->rtx_maps[i]);
+  stream->n_rtx = 0;
+}
+
+/* Call with rtx_lock held */
+static void
+queue_retransmission (GstFtlTransport * transport,
+    GstFtlTransportStream * stream, guint16 seq)
+{
+  const GstFtlRtxPacket *packet;
+  struct mmsghdr *message;
+  GstMapInfo *map;
+
+  gst_ftl_counters_inc (transport->counters, GST_FTL_COUNTER_TRANSPORT_NACKS);
+
+  packet = gst_ftl_rtx_ring_lookup (stream->rtx, seq);
+  if (packet == NULL) {
+    GST_LOG_OBJECT (transport->parent, "packet %u of SSRC %u NACKed too "
+        "late", seq, stream->ssrc);
+    gst_ftl_counters_inc (transport->counters,
+        GST_FTL_COUNTER_TRANSPORT_NACKS_TOO_LATE);
+    return;
+  }
+
+  if (stream->n_rtx == BATCH_PACKETS)
+    send_retransmissions (transport, stream);
+
+  map = &stream->rtx_maps[stream->n_rtx];
+  if (!gst_memory_map (packet->memory, map, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (transport->parent, "Failed to map packet %u", seq);
+    return;
+  }
+
+  stream->rtx_iov[2 * stream->n_rtx].iov_base = (guint8 *) packet->header;
+  stream->rtx_iov[2 * stream->n_rtx].iov_len = packet->header_size;
+  stream->rtx_iov[2 * stream->n_rtx + 1].iov_base = map->data +
+      packet->offset;
+  stream->rtx_iov[2 * stream->n_rtx + 1].iov_len = packet->size;
+
+  message = &stream->rtx_messages[stream->n_rtx++];
+  memset (message, 0, sizeof (*message));
+  message->msg_hdr.msg_iov = &stream->rtx_iov[2 * (stream->n_rtx - 1)];
+  message->msg_hdr.msg_iovlen = 2;
+}
+
+/* Resends what a generic NACK (RFC 4585) asks for */
+static void
+handle_nack (GstFtlTransport * transport, const guint8 * data, gsize size)
+{
+  GstFtlTransportStream *stream = NULL;
+  guint32 ssrc = read_uint32 (data + 8);
+
+  for (guint i = 0; i < G_N_ELEMENTS (transport->streams); i++)
+    if (transport->streams[i].ssrc == ssrc)
+      stream = &transport->streams[i];
+
+  if (stream == NULL)
+    return;
+
+  /* For automatic FEC, even if we can't resend */
+  for (gsize offset = 12; offset + 4 <= size; offset += 4)
+    __atomic_fetch_add (&stream->nacked,
+        1 + __builtin_popcount (read_uint16 (data + offset + 2)),
+        __ATOMIC_RELAXED);
+
+  if (stream->rtx == NULL)
+    return;
+
+  g_mutex_lock (&stream->rtx_lock);
+
+  for (gsize offset = 12; offset + 4 <= size; offset += 4) {
+    guint16 seq = read_uint16 (data + offset);
+    guint16 mask = read_uint16 (data + offset + 2);
+
+    queue_retransmission (transport, stream, seq);
+    for (guint bit = 0; bit < 16; bit++)
+      if (mask & (1 << bit))
+        queue_retransmission (transport, stream, seq + bit + 1);
+  }
+
+  send_retransmissions (transport, stream);
+  g_mutex_unlock (&stream->rtx_lock);
+}
+
+/* Handles the RTCP the ingest sent, without blocking. Called from the
+ * reactor. */
+static void
+receive_feedback (gint fd, gpointer user_data)
+{
+  GstFtlTransport *transport = user_data;
+  guint8 data[MAX_FEEDBACK_SIZE];
+  gssize size;
+
+  while ((size = recv (fd, data, sizeof (data),
+              MSG_DONTWAIT)) >= 0) {
+    gsize offset = 0;
+
+    /* Compound packets */
+    while (offset + 4 <= (gsize) size) {
+      const guint8 *packet = data + offset;
+      gsize length = 4 * (read_uint16 (packet + 2) + 1);
+
+      if ((packet[0] >> 6) != 2 || offset + length > (gsize) size)
+        break;
+
+      if (packet[1] == RTCP_RTPFB && (packet[0] & 0x1f) == RTCP_RTPFB_NACK &&
+          length >= 16)
+        handle_nack (transport, packet, length);
+
+      offset += length;
+    }
+  }
+}
+
+/* Sizes automatic FEC groups after the share of packets NACKed since the
+ * last call. Ingests that recover from parity NACK less, so the estimate
+ * only halves per call when losses drop. */
+static void
+adapt_fec (GstFtlTransport * transport, GstFtlTransportStream * stream)
+{
+  guint nacked = __atomic_load_n (&stream->nacked, __ATOMIC_RELAXED);
+  guint32 packets = stream->sent_packets - stream->last_sent_packets;
+  gdouble loss = packets > 0 ?
+      (gdouble) (nacked - stream->last_nacked) / packets : 0;
+  guint group_size;
+
+  stream->last_nacked = nacked;
+  stream->last_sent_packets = stream->sent_packets;
+  stream->loss = MAX (MIN (loss, 1.0), stream->loss / 2);
+
+  if (stream->loss < FEC_AUTO_MIN_LOSS)
+    group_size = 0;
+  else
+    group_size = CLAMP (0.5 / stream->loss, 2, GST_FTL_FEC_MAX_GROUP_SIZE);
+
+  if (group_size == stream->fec_group_size)
+    return;
+
+  GST_DEBUG_OBJECT (transport->parent, "%.2f%% loss, FEC group size %u",
+      100 * stream->loss, group_size);
+
+  /* A partial group of the current frame goes unprotected */
+  if (group_size == 0)
+    gst_ftl_fec_group_reset (&stream->fec);
+  g_atomic_int_set (&stream->fec_group_size, group_size);
+}
+
+static void
+send_packets (GstFtlTransport * transport, GstFtlTransportStream * stream)
+{
+  guint sent = 0;
+
+  if (gst_ftl_pacer_is_active (&stream->pacer)) {
+    gsize size = 0;
+
+    for (guint i = 0; i < stream->n_packets; i++)
+      size += stream->packets[i].iov[1].iov_len;
+    gst_ftl_pacer_wait (&stream->pacer, size);
+  }
+
+  while (sent < stream->n_packets) {
+    gboolean gso = transport->mode == GST_FTL_TRANSPORT_GSO;
+    guint n_messages = build_messages (stream, sent, gso);
+    gint ret;
+
+    ret = sendmmsg (transport->fd, stream->messages, n_messages, 0);
+    gst_ftl_counters_inc (transport->counters,
+        GST_FTL_COUNTER_TRANSPORT_SYSCALLS);
+
+    if (ret > 0) {
+      sent = ret < n_messages ? stream->first_packet[ret] : stream->n_packets;
+      continue;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    /* Without checksum offload on the way out, the kernel takes the
+     * socket option but fails the messages */
+    if (gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+      GST_WARNING_OBJECT (transport->parent, "UDP segmentation offload "
+          "failed (%s), using sendmmsg()", g_strerror (errno));
+      transport->mode = GST_FTL_TRANSPORT_SENDMMSG;
+      continue;
+    }
+
+    /* Most likely an ICMP error for an earlier packet, the ingest may
+     * come back. Drop this message's packets and go on. */
+    GST_DEBUG_OBJECT (transport->parent, "Failed to send %u packets: %s",
+        (n_messages > 1 ? stream->first_packet[1] : stream->n_packets) -
+        sent, g_strerror (errno));
+    gst_ftl_counters_inc (transport->counters,
+        GST_FTL_COUNTER_TRANSPORT_ERRORS);
+    sent = n_messages > 1 ? stream->first_packet[1] : stream->n_packets;
+  }
+
+  stream->n_packets = 0;
+  stream->n_fec = 0;
+
+  if (sent > 0 && g_get_monotonic_time () >= stream->next_report) {
+    send_sender_report (transport, stream);
+    if (stream->fec_percentage < 0)
+      adapt_fec (transport, stream);
+    stream->next_report = g_get_monotonic_time () + SENDER_REPORT_INTERVAL;
+  }
+}
+
+/* Sends all queued packets of @media_type. The data passed to
+ * gst_ftl_transport_send() must stay valid until then. */
+void
+gst_ftl_transport_flush (GstFtlTransport * transport,
+    ftl_media_type_t media_type)
+{
+  send_packets (transport, &transport->streams[media_type]);
+}
+
+/* While @batching, whole frames of @media_type stay queued until the
+ * batch is full. Turning it off flushes. The data of those frames must
+ * stay valid until then. */
+void
+gst_ftl_transport_set_batching (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gboolean batching)
+{
+  GstFtlTransportStream *stream = &transport->streams[media_type];
+
+  stream->batching = batching;
+  if (!batching)
+    send_packets (transport, stream);
+}
+
+/* Spreads the packets of the frame about to be sent over @span. @size is
+ * roughly how many bytes it has. */
+void
+gst_ftl_transport_pace_frame (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gsize size, GstClockTime span)
+{
+  gst_ftl_pacer_begin_frame (&transport->streams[media_type].pacer, size,
+      span);
+  gst_ftl_counters_inc (transport->counters,
+      GST_FTL_COUNTER_TRANSPORT_PACED_FRAMES);
+}
+
+static gboolean
+batch_is_full (GstFtlTransportStream * stream)
+{
+  return stream->n_packets == (gst_ftl_pacer_is_active (&stream->pacer) ?
+      PACING_SLICE_PACKETS : BATCH_PACKETS);
+}
+
+/* Queues the parity of the packets added to stream->fec */
+static void
+queue_parity (GstFtlTransport * transport, GstFtlTransportStream * stream)
+{
+  GstFtlTransportPacket *packet;
+  gsize size = gst_ftl_fec_group_finish (&stream->fec);
+  guint8 *payload;
+
+  if (batch_is_full (stream) || stream->n_fec == FEC_BATCH_PACKETS)
+    send_packets (transport, stream);
+
+  payload = stream->fec_payloads[stream->n_fec++];
+  memcpy (payload, stream->fec.data, size);
+  gst_ftl_fec_group_reset (&stream->fec);
+
+  packet = &stream->packets[stream->n_packets++];
+
+  /* One CSRC */
+  packet->header[0] = 0x81;
+  packet->header[1] = GST_FTL_FEC_PAYLOAD_TYPE;
+  write_uint16 (packet->header + 2, stream->fec_seq++);
+  write_uint32 (packet->header + 4, stream->timestamp);
+  write_uint32 (packet->header + 8, stream->fec_ssrc);
+  write_uint32 (packet->header + 12, stream->ssrc);
+
+  packet->iov[0].iov_base = packet->header;
+  packet->iov[0].iov_len = FEC_RTP_HEADER_SIZE;
+  packet->iov[1].iov_base = payload;
+  packet->iov[1].iov_len = size;
+  packet->size = FEC_RTP_HEADER_SIZE + size;
+
+  gst_ftl_counters_inc (transport->counters,
+      GST_FTL_COUNTER_TRANSPORT_PACKETS);
+  gst_ftl_counters_inc (transport->counters,
+      GST_FTL_COUNTER_TRANSPORT_FEC_PACKETS);
+}
+
+/* With a ring, @data is at @offset in @memory */
+static void
+queue_packet (GstFtlTransport * transport, GstFtlTransportStream * stream,
+    const guint8 * data, gsize size, const guint8 * fu_a, gboolean marker,
+    GstMemory * memory, gsize offset, gint64 now)
+{
+  GstFtlTransportPacket *packet;
+  gsize header_size = RTP_HEADER_SIZE;
+
+  if (batch_is_full (stream))
+    send_packets (transport, stream);
+
+  packet = &stream->packets[stream->n_packets++];
+
+  packet->header[0] = 0x80;
+  packet->header[1] = (marker ? 0x80 : 0) | stream->payload_type;
+  write_uint16 (packet->header + 2, stream->seq++);
+  write_uint32 (packet->header + 4, stream->timestamp);
+  write_uint32 (packet->header + 8, stream->ssrc);
+
+  if (fu_a != NULL) {
+    packet->header[RTP_HEADER_SIZE] = fu_a[0];
+    packet->header[RTP_HEADER_SIZE + 1] = fu_a[1];
+    header_size += FU_A_HEADER_SIZE;
+  }
+
+  packet->iov[0].iov_base = packet->header;
+  packet->iov[0].iov_len = header_size;
+  packet->iov[1].iov_base = (guint8 *) data;
+  packet->iov[1].iov_len = size;
+  packet->size = header_size + size;
+
+  /* Only for the push, sending and pacing would keep the reactor from
+   * resending */
+  if (stream->rtx != NULL) {
+    guint evicted;
+
+    g_mutex_lock (&stream->rtx_lock);
+    evicted = gst_ftl_rtx_ring_push (stream->rtx, stream->seq - 1,
+        packet->header, header_size, memory, offset, size, now);
+    g_mutex_unlock (&stream->rtx_lock);
+
+    gst_ftl_counters_add (transport->counters,
+        GST_FTL_COUNTER_TRANSPORT_RTX_EVICTIONS, evicted);
+  }
+
+  stream->sent_packets++;
+  stream->sent_octets += packet->size - RTP_HEADER_SIZE;
+  gst_ftl_counters_inc (transport->counters,
+      GST_FTL_COUNTER_TRANSPORT_PACKETS);
+
+  if (stream->fec_group_size > 0) {
+    gst_ftl_fec_group_add (&stream->fec, packet->header, header_size, data,
+        size);
+    if (stream->fec.n_packets >= stream->fec_group_size || marker)
+      queue_parity (transport, stream);
+  }
+}
+
+/* Queues the packets for one NALU or audio frame, like
+ * ftl_ingest_send_media_dts(). @map is where @data was mapped from, so the
+ * retransmission ring can keep a reference instead of a copy; if NULL, the
+ * ring gets a copy. Sends them along with everything queued before at the
+ * end of a frame; otherwise @data must stay valid until
+ * gst_ftl_transport_flush(). Returns the number of bytes queued. */
+gint
+gst_ftl_transport_send (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gint64 dts_usec, const GstMapInfo * map,
+    const guint8 * data, gsize size, gboolean end_of_frame)
+{
+  GstFtlTransportStream *stream = &transport->streams[media_type];
+  GstMemory *memory = NULL;
+  gsize bytes = 0, base = 0;
+  gint64 now = 0;
+
+  if (size == 0)
+    return 0;
+
+  stream->timestamp = dts_usec * stream->clock_rate / G_USEC_PER_SEC;
+
+  if (stream->rtx != NULL) {
+    if (map != NULL) {
+      memory = gst_memory_ref (map->memory);
+      base = data - map->data;
+    } else {
+      gpointer copy = g_malloc (size);
+
+      memcpy (copy, data, size);
+      memory = gst_memory_new_wrapped (0, copy, size, 0, size, copy, g_free);
+    }
+
+    now = g_get_monotonic_time ();
+  }
+
+  if (media_type == FTL_AUDIO_DATA || size <= stream->max_payload) {
+    queue_packet (transport, stream, data, size, NULL, end_of_frame, memory,
+        base, now);
+    bytes = RTP_HEADER_SIZE + size;
+  } else {
+    /* FU-A: the NALU header turns into the FU indicator and header */
+    guint8 fu_a[FU_A_HEADER_SIZE];
+    gsize offset = 1;
+
+    fu_a[0] = (data[0] & 0xe0) | NALU_TYPE_FU_A;
+
+    while (offset < size) {
+      gsize chunk = MIN (size - offset,
+          stream->max_payload - FU_A_HEADER_SIZE);
+      gboolean last = offset + chunk == size;
+
+      fu_a[1] = (offset == 1 ? 0x80 : 0) | (last ? 0x40 : 0) |
+          (data[0] & 0x1f);
+      queue_packet (transport, stream, data + offset, chunk, fu_a,
+          last && end_of_frame, memory, base + offset, now);
+
+      bytes += RTP_HEADER_SIZE + FU_A_HEADER_SIZE + chunk;
+      offset += chunk;
+    }
+  }
+
+  if (memory != NULL)
+    gst_memory_unref (memory);
+
+  if (end_of_frame) {
+    if (!stream->batching)
+      gst_ftl_transport_flush (transport, media_type);
+    gst_ftl_pacer_end_frame (&stream->pacer);
+  }
+
+  return bytes;
+}
+
+static void
+add_ring_stats (GstFtlTransportStream * stream, GstStructure * structure,
+    const gchar * prefix)
+{
+  gchar *packets = g_strconcat (prefix, "-retransmit-ring-packets", NULL);
+  gchar *bytes = g_strconcat (prefix, "-retransmit-ring-bytes", NULL);
+
+  g_mutex_lock (&stream->rtx_lock);
+  gst_structure_set (structure,
+      packets, G_TYPE_UINT, gst_ftl_rtx_ring_get_n_packets (stream->rtx),
+      bytes, G_TYPE_UINT64, (guint64) gst_ftl_rtx_ring_get_bytes (stream->rtx),
+      NULL);
+  g_mutex_unlock (&stream->rtx_lock);
+
+  g_free (packets);
+  g_free (bytes);
+}
+
+/* Adds the FEC group size and how full the retransmission rings are */
+void
+gst_ftl_transport_add_stats (GstFtlTransport * transport,
+    GstStructure * structure)
+{
+  gst_structure_set (structure, "video-fec-group-size", G_TYPE_UINT,
+      g_atomic_int_get (&transport->streams[FTL_VIDEO_DATA].fec_group_size),
+      NULL);
+
+  if (transport->streams[FTL_VIDEO_DATA].rtx == NULL)
+    return;
+
+  add_ring_stats (&transport->streams[FTL_VIDEO_DATA], structure, "video");
+  add_ring_stats (&transport->streams[FTL_AUDIO_DATA], structure, "audio");
+}
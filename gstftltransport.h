@@ -0,0 +1,66 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GST_FTL_TRANSPORT_H_
+#define _GST_FTL_TRANSPORT_H_
+
+#include <gst/gst.h>
+#include "ftl.h"
+#include "gstftlcounters.h"
+#include "gstftlenums.h"
+#include "gstftlhistogram.h"
+
+G_BEGIN_DECLS
+
+/* UDP port FTL ingests take media on */
+#define GST_FTL_TRANSPORT_DEFAULT_PORT 8082
+
+typedef struct _GstFtlTransport GstFtlTransport;
+
+GstFtlTransport * gst_ftl_transport_new (GstObject * parent,
+    GstFtlTransportMode mode, GstFtlCounters * counters,
+    GstFtlHistogram * pacing_error, GstClockTime rtx_time, gsize rtx_bytes,
+    gint fec_percentage);
+void gst_ftl_transport_free (GstFtlTransport * transport);
+
+gint gst_ftl_transport_connect_socket (const gchar * hostname, guint port,
+    GError ** error);
+gboolean gst_ftl_transport_open (GstFtlTransport * transport, gint fd,
+    const gchar * stream_key, GError ** error);
+
+void gst_ftl_transport_pace_frame (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gsize size, GstClockTime span);
+gint gst_ftl_transport_send (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gint64 dts_usec, const GstMapInfo * map,
+    const guint8 * data, gsize size, gboolean end_of_frame);
+void gst_ftl_transport_flush (GstFtlTransport * transport,
+    ftl_media_type_t media_type);
+void gst_ftl_transport_set_batching (GstFtlTransport * transport,
+    ftl_media_type_t media_type, gboolean batching);
+
+void gst_ftl_transport_add_stats (GstFtlTransport * transport,
+    GstStructure * structure);
+
+G_END_DECLS
+
+#endif
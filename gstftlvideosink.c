@@ -27,6 +27,7 @@
 
 #include "gstftlvideosink.h"
 
+#include "gstftlnalu.h"
 #include "gstftlsink.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_ftl_video_sink_debug_category);
@@ -37,12 +38,84 @@ GST_DEBUG_CATEGORY_STATIC (gst_ftl_video_sink_debug_category);
 struct _GstFtlVideoSink
 {
   GstBaseSink parent_instance;
+
+  /* 0 for byte-stream, otherwise the avc length prefix size */
+  guint nal_length_size;
+  GstBuffer *codec_data;
+  GArray *parameter_sets;
+  gboolean need_parameter_sets;
+
+  GArray *nalus;
+  /* alignment=nal: buffers hold parts of an access unit */
+  gboolean nal_aligned;
+  /* Part of the access unit with DTS au_dts has been sent, but not its
+   * end */
+  gboolean in_au;
+  gint64 au_dts;
+  /* The last NALU sent so far, held back until we know whether it ends
+   * its access unit. Upstream has to set GST_BUFFER_FLAG_MARKER for that
+   * to be right away. */
+  GstBuffer *held_buffer;
+  GstFtlNalu held_nalu;
+  GByteArray *held_span;
+  /* Whether each mirror took the start of the current access unit */
+  GArray *mirror_accepted;
+  /* The memories of the buffer being sent, mapped one by one */
+  GArray *maps;
+  GArray *chunks;
+  /* While sending a buffer list, the maps of earlier buffers whose data
+   * the native transport may still hold on to */
+  gboolean batching;
+  GArray *batch_maps;
+  /* Same for the buffer in prepare(), which may run concurrently with
+   * sending from ftlsink's sender thread */
+  GArray *prepare_maps;
+  GArray *prepare_chunks;
+  /* GstFtlVideoSinkPrepared, oldest first */
+  GQueue prepared;
+  GMutex prepared_lock;
+  /* Copies of the NALUs that span memories */
+  GByteArray *spans;
+  /* Dropping delta units until the next keyframe */
+  gboolean skip_to_idr;
+
+  GstClockTime prepare_time;
+  /* Running times of the buffer list being rendered */
+  GArray *list_times;
 };
 
+/* The NALUs of a buffer, parsed in prepare() before waiting for the
+ * clock. Their data pointers are not valid. */
+typedef struct
+{
+  GstBuffer *buffer;
+  GArray *nalus;
+} GstFtlVideoSinkPrepared;
+
+/* Buffers can be prepared and then dropped without being rendered, and
+ * ftlsink can hold on to many while connecting. Older ones get parsed
+ * again when they are sent. */
+#define MAX_PREPARED 32
+
 /* prototypes */
 
+static void gst_ftl_video_sink_finalize (GObject * object);
+static void gst_ftl_video_sink_clear_prepared (GstFtlVideoSink * self);
+static gboolean gst_ftl_video_sink_start (GstBaseSink * sink);
+static gboolean gst_ftl_video_sink_stop (GstBaseSink * sink);
+static gboolean gst_ftl_video_sink_event (GstBaseSink * sink,
+    GstEvent * event);
+static void gst_ftl_video_sink_end_au (GstFtlVideoSink * self);
+static gboolean gst_ftl_video_sink_set_caps (GstBaseSink * sink,
+    GstCaps * caps);
+static GstFlowReturn gst_ftl_video_sink_prepare (GstBaseSink * sink,
+    GstBuffer * buffer);
 static GstFlowReturn gst_ftl_video_sink_render (GstBaseSink * sink,
     GstBuffer * buffer);
+static GstFlowReturn gst_ftl_video_sink_prepare_list (GstBaseSink * sink,
+    GstBufferList * list);
+static GstFlowReturn gst_ftl_video_sink_render_list (GstBaseSink * sink,
+    GstBufferList * list);
 
 enum
 {
@@ -65,6 +138,7 @@ G_DEFINE_TYPE (GstFtlVideoSink, gst_ftl_video_sink, GST_TYPE_BASE_SINK);
 static void
 gst_ftl_video_sink_class_init (GstFtlVideoSinkClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstBaseSinkClass *base_sink_class = GST_BASE_SINK_CLASS (klass);
 
   GST_DEBUG_CATEGORY_INIT (gst_ftl_video_sink_debug_category, "ftlvideosink", 0,
@@ -77,48 +151,699 @@ gst_ftl_video_sink_class_init (GstFtlVideoSinkClass * klass)
   gst_element_class_add_static_pad_template (GST_ELEMENT_CLASS (klass),
       &gst_ftl_video_sink_template);
 
+  gobject_class->finalize = gst_ftl_video_sink_finalize;
+
+  base_sink_class->start = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_start);
+  base_sink_class->stop = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_stop);
+  base_sink_class->event = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_event);
+  base_sink_class->set_caps = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_set_caps);
+  base_sink_class->prepare = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_prepare);
   base_sink_class->render = GST_DEBUG_FUNCPTR (gst_ftl_video_sink_render);
+  base_sink_class->prepare_list =
+      GST_DEBUG_FUNCPTR (gst_ftl_video_sink_prepare_list);
+  base_sink_class->render_list =
+      GST_DEBUG_FUNCPTR (gst_ftl_video_sink_render_list);
 }
 
 static void
 gst_ftl_video_sink_init (GstFtlVideoSink * self)
 {
+  self->parameter_sets = g_array_new (FALSE, FALSE, sizeof (GstFtlNalu));
+  self->nalus = g_array_new (FALSE, FALSE, sizeof (GstFtlNalu));
+  self->maps = g_array_new (FALSE, FALSE, sizeof (GstMapInfo));
+  self->chunks = g_array_new (FALSE, FALSE, sizeof (GstFtlNaluChunk));
+  self->batch_maps = g_array_new (FALSE, FALSE, sizeof (GstMapInfo));
+  self->prepare_maps = g_array_new (FALSE, FALSE, sizeof (GstMapInfo));
+  self->prepare_chunks = g_array_new (FALSE, FALSE, sizeof (GstFtlNaluChunk));
+  g_queue_init (&self->prepared);
+  self->list_times = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  g_mutex_init (&self->prepared_lock);
+  self->spans = g_byte_array_new ();
+  self->held_span = g_byte_array_new ();
+  self->mirror_accepted = g_array_new (FALSE, TRUE, sizeof (gboolean));
+}
+
+static void
+gst_ftl_video_sink_finalize (GObject * object)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (object);
+
+  gst_buffer_replace (&self->codec_data, NULL);
+  g_array_free (self->parameter_sets, TRUE);
+  g_array_free (self->nalus, TRUE);
+  g_array_free (self->maps, TRUE);
+  g_array_free (self->chunks, TRUE);
+  g_array_free (self->batch_maps, TRUE);
+  g_array_free (self->prepare_maps, TRUE);
+  g_array_free (self->prepare_chunks, TRUE);
+  gst_ftl_video_sink_clear_prepared (self);
+  g_mutex_clear (&self->prepared_lock);
+  g_array_free (self->list_times, TRUE);
+  g_byte_array_unref (self->spans);
+  gst_buffer_replace (&self->held_buffer, NULL);
+  g_byte_array_unref (self->held_span);
+  g_array_free (self->mirror_accepted, TRUE);
+
+  G_OBJECT_CLASS (gst_ftl_video_sink_parent_class)->finalize (object);
+}
+
+static gboolean
+gst_ftl_video_sink_start (GstBaseSink * sink)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+
+  /* Whatever we sent before went to an earlier connection */
+  self->need_parameter_sets = TRUE;
+  self->skip_to_idr = FALSE;
+  self->in_au = FALSE;
+  return TRUE;
+}
+
+static gboolean
+gst_ftl_video_sink_stop (GstBaseSink * sink)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+
+  /* Don't keep buffers that were prepared but never sent */
+  gst_ftl_video_sink_clear_prepared (self);
+  gst_buffer_replace (&self->held_buffer, NULL);
+  return TRUE;
+}
+
+static gboolean
+gst_ftl_video_sink_event (GstBaseSink * sink, GstEvent * event)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+
+  /* Nothing follows the held NALU */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+    gst_ftl_sink_drain (parent);
+    gst_ftl_sink_begin_send (parent);
+    gst_ftl_video_sink_end_au (self);
+    gst_ftl_sink_end_send (parent);
+  }
+
+  return GST_BASE_SINK_CLASS (gst_ftl_video_sink_parent_class)->event (sink,
+      event);
+}
+
+static gboolean
+gst_ftl_video_sink_set_caps (GstBaseSink * sink, GstCaps * caps)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  GstStructure *structure = gst_caps_get_structure (caps, 0);
+  const gchar *stream_format;
+  const GValue *value;
+  GstBuffer *codec_data;
+  GstMapInfo map;
+  gint fps_n, fps_d;
+  gboolean ret;
+
+  GST_DEBUG_OBJECT (self, "caps: %" GST_PTR_FORMAT, caps);
+
+  /* Queued buffers still need the old codec_data */
+  gst_ftl_sink_drain (parent);
+  gst_ftl_sink_begin_send (parent);
+  gst_ftl_video_sink_end_au (self);
+  gst_ftl_sink_end_send (parent);
+
+  self->nal_aligned = g_strcmp0 (gst_structure_get_string (structure,
+          "alignment"), "nal") == 0;
+
+  if (gst_structure_get_fraction (structure, "framerate", &fps_n, &fps_d) &&
+      fps_n > 0 && fps_d > 0)
+    gst_ftl_sink_set_framerate (parent, fps_n, fps_d);
+  else
+    gst_ftl_sink_set_framerate (parent, 0, 1);
+
+  gst_buffer_replace (&self->codec_data, NULL);
+  g_array_set_size (self->parameter_sets, 0);
+  self->nal_length_size = 0;
+
+  stream_format = gst_structure_get_string (structure, "stream-format");
+  if (g_strcmp0 (stream_format, "avc") != 0)
+    return TRUE;
+
+  value = gst_structure_get_value (structure, "codec_data");
+  if (value == NULL || !GST_VALUE_HOLDS_BUFFER (value)) {
+    GST_ERROR_OBJECT (self, "avc caps without codec_data");
+    return FALSE;
+  }
+
+  codec_data = gst_value_get_buffer (value);
+  if (!gst_buffer_map (codec_data, &map, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (self, "Failed to map codec_data");
+    return FALSE;
+  }
+
+  ret = gst_ftl_nalu_parse_avc_codec_data (map.data, map.size,
+      &self->nal_length_size, self->parameter_sets);
+  gst_buffer_unmap (codec_data, &map);
+
+  if (!ret) {
+    GST_ERROR_OBJECT (self, "Invalid codec_data");
+    g_array_set_size (self->parameter_sets, 0);
+    self->nal_length_size = 0;
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "NAL length size %u, %u parameter sets",
+      self->nal_length_size, self->parameter_sets->len);
+
+  self->codec_data = gst_buffer_ref (codec_data);
+  self->need_parameter_sets = TRUE;
+  return TRUE;
+}
+
+static gint
+gst_ftl_video_sink_send_parameter_sets (GstFtlVideoSink * self,
+    ftl_handle_t * handle, gint64 dts_usec)
+{
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  GstMapInfo map;
+  gint bytes_sent = 0;
+
+  if (!gst_buffer_map (self->codec_data, &map, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (self, "Failed to map codec_data");
+    return 0;
+  }
+
+  for (guint i = 0; i < self->parameter_sets->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (self->parameter_sets, GstFtlNalu, i);
+    gint sent = gst_ftl_sink_send_media (parent, handle, FTL_VIDEO_DATA,
+        dts_usec, &map, map.data + nalu->offset, nalu->size, FALSE);
+
+    GST_LOG_OBJECT (self, "sent %d bytes (NALU type %u, size %"
+        G_GSIZE_FORMAT ") from codec_data", sent, nalu->type, nalu->size);
+
+    bytes_sent += sent;
+  }
+
+  gst_ftl_sink_flush_media (parent, FTL_VIDEO_DATA);
+  gst_buffer_unmap (self->codec_data, &map);
+  return bytes_sent;
 }
 
-static guint8 *
-get_next_nalu (guint8 * input, gsize len, gsize * last_len)
+/* In avc, SPS and PPS only travel in the caps, so put them in front of
+ * the first frame and of every keyframe that doesn't carry its own */
+static gboolean
+gst_ftl_video_sink_needs_parameter_sets (GstFtlVideoSink * self,
+    GstBuffer * buffer, gboolean first)
 {
-  guint32 start_code = 0xFFFFFFFF;
+  if (self->codec_data == NULL || self->parameter_sets->len == 0)
+    return FALSE;
 
-  for (gsize pos = 0; pos < len; pos++) {
-    start_code = (start_code << 8) | input[pos];
+  if (!first && GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    return FALSE;
+
+  for (guint i = 0; i < self->nalus->len; i++) {
+    if (g_array_index (self->nalus, GstFtlNalu, i).type == 7)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Asks upstream for a keyframe instead of waiting for the next one */
+void
+gst_ftl_video_sink_request_keyframe (GstFtlVideoSink * self)
+{
+  GstEvent *event;
 
-    if ((start_code & 0xFFFFFF) == 1) {
-      if (last_len)
-        *last_len = pos - (start_code == 1 ? 3 : 2);
-      return input + pos + 1;
+  /* Same as gst_video_event_new_upstream_force_key_unit(), without
+   * linking gstvideo */
+  event = gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new ("GstForceKeyUnit",
+          "running-time", GST_TYPE_CLOCK_TIME, GST_CLOCK_TIME_NONE,
+          "all-headers", G_TYPE_BOOLEAN, TRUE,
+          "count", G_TYPE_UINT, 0, NULL));
+
+  if (!gst_pad_push_event (GST_BASE_SINK_PAD (self), event))
+    GST_DEBUG_OBJECT (self, "Nobody upstream handled the keyframe request");
+}
+
+/* Applies the drop actions in @flags to the NALUs in self->nalus. Returns
+ * FALSE if the whole access unit should be dropped. */
+static gboolean
+gst_ftl_video_sink_filter_nalus (GstFtlVideoSink * self,
+    GstFtlNalDropFlags flags, GstBuffer * buffer, GstFtlCounters * counters)
+{
+  gboolean had_slices = FALSE, has_slices = FALSE;
+  guint64 bytes_shed = 0;
+  guint kept = 0;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    if (!self->skip_to_idr && (flags & GST_FTL_NAL_DROP_SKIP_TO_IDR)) {
+      GST_INFO_OBJECT (self, "Congested, skipping to the next keyframe");
+      self->skip_to_idr = TRUE;
+      gst_ftl_counters_inc (counters, GST_FTL_COUNTER_VIDEO_IDR_SKIPS);
+      gst_ftl_video_sink_request_keyframe (self);
+    }
+
+    if (self->skip_to_idr) {
+      gst_ftl_counters_inc (counters, GST_FTL_COUNTER_VIDEO_FRAMES_SKIPPED);
+      gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES_SHED,
+          gst_buffer_get_size (buffer));
+      return FALSE;
+    }
+  } else {
+    self->skip_to_idr = FALSE;
+  }
+
+  /* Compact the NALUs we keep to the front */
+  for (guint i = 0; i < self->nalus->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (self->nalus, GstFtlNalu, i);
+    GstFtlCounter counter = GST_FTL_N_COUNTERS;
+
+    switch (nalu->type) {
+      case 9:                  /* AU delimiter, never sent */
+        GST_LOG_OBJECT (self, "skipping AU delimiter (size %" G_GSIZE_FORMAT
+            ")", nalu->size);
+        continue;
+      case 1:                  /* non-IDR slice */
+        had_slices = TRUE;
+        if (nalu->ref_idc == 0 && (flags & GST_FTL_NAL_DROP_NON_REFERENCE))
+          counter = GST_FTL_COUNTER_VIDEO_NON_REF_DROPPED;
+        else
+          has_slices = TRUE;
+        break;
+      case 2:                  /* slice data partitions */
+      case 3:
+      case 4:
+      case 5:                  /* IDR slice */
+        had_slices = has_slices = TRUE;
+        break;
+      case 6:                  /* SEI */
+        if ((flags & GST_FTL_NAL_DROP_SEI) &&
+            gst_ftl_nalu_sei_is_optional (nalu->data, nalu->size))
+          counter = GST_FTL_COUNTER_VIDEO_SEI_DROPPED;
+        break;
+      case 12:                 /* filler data */
+        if (flags & GST_FTL_NAL_DROP_FILLER)
+          counter = GST_FTL_COUNTER_VIDEO_FILLER_DROPPED;
+        break;
+      default:
+        break;
     }
+
+    if (counter != GST_FTL_N_COUNTERS) {
+      GST_LOG_OBJECT (self, "dropping NALU type %u (size %" G_GSIZE_FORMAT
+          ")", nalu->type, nalu->size);
+      gst_ftl_counters_inc (counters, counter);
+      bytes_shed += nalu->size;
+      continue;
+    }
+
+    g_array_index (self->nalus, GstFtlNalu, kept++) = *nalu;
+  }
+
+  g_array_set_size (self->nalus, kept);
+
+  /* Without its slices, the rest of the access unit is useless */
+  if (had_slices && !has_slices) {
+    GST_LOG_OBJECT (self, "dropping non-reference frame %" GST_PTR_FORMAT,
+        buffer);
+    for (guint i = 0; i < kept; i++)
+      bytes_shed += g_array_index (self->nalus, GstFtlNalu, i).size;
+    g_array_set_size (self->nalus, 0);
+  }
+
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES_SHED,
+      bytes_shed);
+  return self->nalus->len > 0;
+}
+
+/* Returns the mapping of the current buffer that @nalu lies in, or NULL if
+ * it spanned memories and got copied */
+static const GstMapInfo *
+gst_ftl_video_sink_find_map (GstFtlVideoSink * self, const GstFtlNalu * nalu)
+{
+  for (guint i = 0; i < self->maps->len; i++) {
+    const GstMapInfo *map = &g_array_index (self->maps, GstMapInfo, i);
+
+    if (nalu->data >= map->data && nalu->data < map->data + map->size)
+      return map;
   }
 
-  if (last_len)
-    *last_len = len;
   return NULL;
 }
 
+/* Sends the first @n_nalus NALUs in self->nalus to one ingest, ending the
+ * frame with the last one if @end_of_frame is set. The same parsed NALUs
+ * go to the main ingest and every mirror. */
+static gint
+gst_ftl_video_sink_send_nalus (GstFtlVideoSink * self, ftl_handle_t * handle,
+    gint64 dts_usec, gboolean parameter_sets, guint n_nalus,
+    gboolean end_of_frame)
+{
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  gint bytes_sent = 0;
+
+  if (parameter_sets)
+    bytes_sent += gst_ftl_video_sink_send_parameter_sets (self, handle,
+        dts_usec);
+
+  for (guint i = 0; i < n_nalus; i++) {
+    GstFtlNalu *nalu = &g_array_index (self->nalus, GstFtlNalu, i);
+    gboolean last = end_of_frame && i == n_nalus - 1;
+    gint sent = gst_ftl_sink_send_media (parent, handle, FTL_VIDEO_DATA,
+        dts_usec, gst_ftl_video_sink_find_map (self, nalu), nalu->data,
+        nalu->size, last);
+
+    GST_LOG_OBJECT (self, "sent %d bytes (NALU type %u, size %"
+        G_GSIZE_FORMAT "%s)", sent, nalu->type, nalu->size,
+        (last ? ", last" : ""));
+
+    bytes_sent += sent;
+  }
+
+  return bytes_sent;
+}
+
+/* Sends the held NALU to the main ingest and to the mirrors that took the
+ * start of its access unit */
+static void
+gst_ftl_video_sink_send_held (GstFtlVideoSink * self, gboolean end_of_frame)
+{
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  GstFtlCounters *counters = gst_ftl_sink_get_counters (parent);
+  GstFtlNalu *nalu = &self->held_nalu;
+  GstMemory *memory = NULL;
+  GstMapInfo map;
+  const guint8 *data;
+  guint index, length;
+  gsize skip;
+  gint bytes_sent;
+
+  if (self->held_buffer == NULL)
+    return;
+
+  if (gst_buffer_find_memory (self->held_buffer, nalu->offset, nalu->size,
+          &index, &length, &skip) && length == 1 &&
+      gst_memory_map (memory = gst_buffer_peek_memory (self->held_buffer,
+              index), &map, GST_MAP_READ)) {
+    data = map.data + skip;
+  } else {
+    memory = NULL;
+    g_byte_array_set_size (self->held_span, nalu->size);
+    gst_buffer_extract (self->held_buffer, nalu->offset,
+        self->held_span->data, nalu->size);
+    data = self->held_span->data;
+    gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES_COPIED,
+        nalu->size);
+  }
+
+  bytes_sent = gst_ftl_sink_send_media (parent,
+      gst_ftl_sink_get_handle (parent), FTL_VIDEO_DATA, self->au_dts,
+      (memory != NULL ? &map : NULL), data, nalu->size, end_of_frame);
+
+  GST_LOG_OBJECT (self, "sent %d bytes (held NALU type %u, size %"
+      G_GSIZE_FORMAT "%s)", bytes_sent, nalu->type, nalu->size,
+      (end_of_frame ? ", last" : ""));
+
+  for (guint i = 0; i < self->mirror_accepted->len &&
+      i < gst_ftl_sink_get_n_mirrors (parent); i++) {
+    GstFtlMirror *mirror = gst_ftl_sink_get_mirror (parent, i);
+    ftl_handle_t *handle;
+
+    if (!g_array_index (self->mirror_accepted, gboolean, i))
+      continue;
+
+    handle = gst_ftl_mirror_continue_frame (mirror, FTL_VIDEO_DATA,
+        self->au_dts);
+    if (handle != NULL)
+      gst_ftl_mirror_end_frame (mirror, FTL_VIDEO_DATA, self->au_dts,
+          ftl_ingest_send_media_dts (handle, FTL_VIDEO_DATA, self->au_dts,
+              (guint8 *) data, nalu->size, end_of_frame));
+  }
+
+  gst_ftl_sink_flush_media (parent, FTL_VIDEO_DATA);
+  if (memory != NULL)
+    gst_memory_unmap (memory, &map);
+  gst_buffer_replace (&self->held_buffer, NULL);
+
+  gst_ftl_counters_inc (counters, GST_FTL_COUNTER_VIDEO_NALUS);
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES, bytes_sent);
+}
+
+/* With alignment=nal, ends the access unit in progress. Called from
+ * send_buffer() on a buffer with GST_BUFFER_FLAG_MARKER or with the DTS of
+ * the next access unit, and on EOS and caps changes. Nothing flushes on
+ * idle, so without markers the last NALU of every access unit waits for
+ * the next one. */
+static void
+gst_ftl_video_sink_end_au (GstFtlVideoSink * self)
+{
+  if (gst_ftl_sink_is_connected ((GstFtlSink *) GST_OBJECT_PARENT (self)))
+    gst_ftl_video_sink_send_held (self, TRUE);
+  else
+    gst_buffer_replace (&self->held_buffer, NULL);
+  self->in_au = FALSE;
+}
+
+static void
+gst_ftl_video_sink_unmap (GArray * maps, GArray * chunks)
+{
+  for (guint i = 0; i < maps->len; i++) {
+    GstMapInfo *map = &g_array_index (maps, GstMapInfo, i);
+    gst_memory_unmap (map->memory, map);
+  }
+
+  g_array_set_size (maps, 0);
+  if (chunks != NULL)
+    g_array_set_size (chunks, 0);
+}
+
+/* Maps the memories of @buffer one by one. gst_buffer_map() would merge
+ * them into a copy of the whole access unit. */
+static gboolean
+gst_ftl_video_sink_map (GstBuffer * buffer, GArray * maps, GArray * chunks)
+{
+  guint n_memory = gst_buffer_n_memory (buffer);
+
+  for (guint i = 0; i < n_memory; i++) {
+    GstMemory *memory = gst_buffer_peek_memory (buffer, i);
+    GstFtlNaluChunk chunk;
+    GstMapInfo map;
+
+    if (!gst_memory_map (memory, &map, GST_MAP_READ)) {
+      gst_ftl_video_sink_unmap (maps, chunks);
+      return FALSE;
+    }
+
+    g_array_append_val (maps, map);
+    chunk.data = map.data;
+    chunk.size = map.size;
+    g_array_append_val (chunks, chunk);
+  }
+
+  return TRUE;
+}
+
+/* Finds the NALUs of @buffer, whose memories are mapped as @chunks */
+static GstFlowReturn
+gst_ftl_video_sink_parse (GstFtlVideoSink * self, GstBuffer * buffer,
+    GArray * chunks, GArray * nalus)
+{
+  const GstFtlNaluChunk *data =
+      &g_array_index (chunks, GstFtlNaluChunk, 0);
+  gboolean parsed;
+
+  if (self->nal_length_size > 0)
+    parsed = gst_ftl_nalu_parse_avc_chunks (data, chunks->len,
+        self->nal_length_size, nalus);
+  else
+    parsed = gst_ftl_nalu_parse_byte_stream_chunks (data, chunks->len, nalus);
+
+  if (!parsed) {
+    GST_ELEMENT_ERROR (self, STREAM, DECODE, ("Truncated NALU"),
+        ("%" GST_PTR_FORMAT, buffer));
+    return GST_FLOW_ERROR;
+  }
+
+  if (nalus->len == 0) {
+    GST_ELEMENT_ERROR (self, STREAM, DECODE, ("No NALU in buffer"),
+        ("%" GST_PTR_FORMAT, buffer));
+    return GST_FLOW_ERROR;
+  }
+
+  for (guint i = 0; i < nalus->len; i++) {
+    if (g_array_index (nalus, GstFtlNalu, i).type == 0) {
+      GST_ELEMENT_ERROR (self, STREAM, DECODE, ("Invalid NALU type 0"),
+          ("%" GST_PTR_FORMAT, buffer));
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_ftl_video_sink_prepared_free (GstFtlVideoSinkPrepared * prepared)
+{
+  gst_buffer_unref (prepared->buffer);
+  g_array_free (prepared->nalus, TRUE);
+  g_free (prepared);
+}
+
+static void
+gst_ftl_video_sink_clear_prepared (GstFtlVideoSink * self)
+{
+  GstFtlVideoSinkPrepared *prepared;
+
+  g_mutex_lock (&self->prepared_lock);
+  while ((prepared = g_queue_pop_head (&self->prepared)) != NULL)
+    gst_ftl_video_sink_prepared_free (prepared);
+  g_mutex_unlock (&self->prepared_lock);
+}
+
+/* Moves the NALUs parsed in prepare() for @buffer to self->nalus. Buffers
+ * are sent in the order they were prepared, so anything prepared earlier
+ * was dropped or has been sent already. */
+static gboolean
+gst_ftl_video_sink_take_prepared (GstFtlVideoSink * self, GstBuffer * buffer)
+{
+  GstFtlVideoSinkPrepared *prepared = NULL;
+  GList *link;
+
+  g_mutex_lock (&self->prepared_lock);
+
+  for (link = self->prepared.head; link != NULL; link = link->next) {
+    if (((GstFtlVideoSinkPrepared *) link->data)->buffer == buffer)
+      break;
+  }
+
+  if (link != NULL) {
+    while ((prepared = g_queue_pop_head (&self->prepared))->buffer != buffer)
+      gst_ftl_video_sink_prepared_free (prepared);
+  }
+
+  g_mutex_unlock (&self->prepared_lock);
+
+  if (prepared == NULL)
+    return FALSE;
+
+  g_array_free (self->nalus, TRUE);
+  self->nalus = prepared->nalus;
+  prepared->nalus = NULL;
+
+  gst_buffer_unref (prepared->buffer);
+  g_free (prepared);
+  return TRUE;
+}
+
+/* Copies the NALUs that span memories, which libftl needs in one piece.
+ * Returns the number of bytes copied. */
+static gsize
+gst_ftl_video_sink_gather_nalus (GstFtlVideoSink * self, GstBuffer * buffer,
+    GstFtlCounters * counters)
+{
+  gsize total = 0, pos = 0;
+
+  for (guint i = 0; i < self->nalus->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (self->nalus, GstFtlNalu, i);
+
+    if (nalu->data == NULL)
+      total += nalu->size;
+  }
+
+  if (total == 0)
+    return 0;
+
+  g_byte_array_set_size (self->spans, total);
+
+  for (guint i = 0; i < self->nalus->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (self->nalus, GstFtlNalu, i);
+
+    if (nalu->data != NULL)
+      continue;
+
+    gst_buffer_extract (buffer, nalu->offset, self->spans->data + pos,
+        nalu->size);
+    nalu->data = self->spans->data + pos;
+    pos += nalu->size;
+  }
+
+  GST_LOG_OBJECT (self, "copied %" G_GSIZE_FORMAT " bytes of NALUs spanning "
+      "memories", total);
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES_COPIED, total);
+  return total;
+}
+
+static GstFlowReturn
+gst_ftl_video_sink_prepare_buffer (GstFtlVideoSink * self, GstBuffer * buffer)
+{
+  GstFtlVideoSinkPrepared *prepared;
+  GstFlowReturn ret;
+  GArray *nalus;
+
+  if (!gst_ftl_video_sink_map (buffer, self->prepare_maps,
+          self->prepare_chunks)) {
+    GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Failed to map buffer"),
+        ("%" GST_PTR_FORMAT, buffer));
+    return GST_FLOW_ERROR;
+  }
+
+  nalus = g_array_new (FALSE, FALSE, sizeof (GstFtlNalu));
+  ret = gst_ftl_video_sink_parse (self, buffer, self->prepare_chunks, nalus);
+  gst_ftl_video_sink_unmap (self->prepare_maps, self->prepare_chunks);
+
+  if (ret != GST_FLOW_OK) {
+    g_array_free (nalus, TRUE);
+    return ret;
+  }
+
+  prepared = g_new (GstFtlVideoSinkPrepared, 1);
+  prepared->buffer = gst_buffer_ref (buffer);
+  prepared->nalus = nalus;
+
+  g_mutex_lock (&self->prepared_lock);
+  g_queue_push_tail (&self->prepared, prepared);
+  if (self->prepared.length > MAX_PREPARED)
+    gst_ftl_video_sink_prepared_free (g_queue_pop_head (&self->prepared));
+  g_mutex_unlock (&self->prepared_lock);
+
+  return GST_FLOW_OK;
+}
+
+/* Called before waiting for the clock. Parsing here keeps it off the
+ * path from the deadline to the network. */
+static GstFlowReturn
+gst_ftl_video_sink_prepare (GstBaseSink * sink, GstBuffer * buffer)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+
+  self->prepare_time = gst_util_get_timestamp ();
+  return gst_ftl_video_sink_prepare_buffer (self, buffer);
+}
+
+static GstFlowReturn
+gst_ftl_video_sink_prepare_list (GstBaseSink * sink, GstBufferList * list)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint length = gst_buffer_list_length (list);
+
+  self->prepare_time = gst_util_get_timestamp ();
+
+  for (guint i = 0; i < length && ret == GST_FLOW_OK; i++)
+    ret = gst_ftl_video_sink_prepare_buffer (self,
+        gst_buffer_list_get (list, i));
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_ftl_video_sink_render (GstBaseSink * sink, GstBuffer * buffer)
 {
   GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
   GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
   GstClockTime time;
-  GstMapInfo map;
-  gint bytes_sent = 0;
-  guint num_nalus = 0;
-  guint8 *data, *end;
 
-  if (!gst_ftl_sink_connect (parent)) {
-    return GST_FLOW_ERROR;
-  }
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SYNC, FTL_VIDEO_DATA,
+      gst_util_get_timestamp () - self->prepare_time);
 
   time = GST_BUFFER_DTS (buffer);
   if (!GST_CLOCK_TIME_IS_VALID (time)) {
@@ -129,61 +854,203 @@ gst_ftl_video_sink_render (GstBaseSink * sink, GstBuffer * buffer)
 
   time = gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME, time);
 
-  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+  return gst_ftl_sink_send_buffer (parent, FTL_VIDEO_DATA, buffer, time);
+}
+
+static GstFlowReturn
+gst_ftl_video_sink_render_list (GstBaseSink * sink, GstBufferList * list)
+{
+  GstFtlVideoSink *self = GST_FTL_VIDEO_SINK (sink);
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  guint length = gst_buffer_list_length (list);
+
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SYNC, FTL_VIDEO_DATA,
+      gst_util_get_timestamp () - self->prepare_time);
+
+  g_array_set_size (self->list_times, length);
+
+  for (guint i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+    GstClockTime time = GST_BUFFER_DTS (buffer);
+
+    if (!GST_CLOCK_TIME_IS_VALID (time)) {
+      GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Got buffer without DTS"),
+          ("%" GST_PTR_FORMAT, buffer));
+      return GST_FLOW_ERROR;
+    }
+
+    g_array_index (self->list_times, GstClockTime, i) =
+        gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME, time);
+  }
+
+  return gst_ftl_sink_send_list (parent, FTL_VIDEO_DATA, list,
+      (const GstClockTime *) self->list_times->data);
+}
+
+/* Sends one access unit with the given running time. Called by ftlsink,
+ * either from render() or from its sender thread. */
+GstFlowReturn
+gst_ftl_video_sink_send_buffer (GstFtlVideoSink * self, GstBuffer * buffer,
+    GstClockTime time)
+{
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  gint64 dts_usec;
+  gint bytes_sent;
+  GstFtlCounters *counters;
+  GstClockTime start;
+  GstFlowReturn ret;
+  gboolean keyframe, marker, new_au, hold, request_keyframe = FALSE;
+  guint n_nalus;
+  gsize copied;
+
+  dts_usec = gst_util_uint64_scale_round (time, 1, GST_USECOND);
+
+  if (!gst_ftl_video_sink_map (buffer, self->maps, self->chunks)) {
     GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Failed to map buffer"),
         ("%" GST_PTR_FORMAT, buffer));
     return GST_FLOW_ERROR;
   }
 
-  data = get_next_nalu (map.data, map.size, NULL);
-  end = map.data + map.size;
+  if (gst_ftl_video_sink_take_prepared (self, buffer)) {
+    gst_ftl_nalu_set_chunk_data (&g_array_index (self->chunks,
+            GstFtlNaluChunk, 0), self->chunks->len, self->nalus);
+  } else {
+    g_array_set_size (self->nalus, 0);
+    ret = gst_ftl_video_sink_parse (self, buffer, self->chunks, self->nalus);
+    if (ret != GST_FLOW_OK) {
+      gst_ftl_video_sink_unmap (self->maps, self->chunks);
+      return ret;
+    }
+  }
 
-  while (data != NULL) {
-    gsize nalu_len;
-    guint8 *next = get_next_nalu (data, end - data, &nalu_len);
-    guint8 nalu_type = data[0] & 0x1f;
+  counters = gst_ftl_sink_get_counters (parent);
+  copied = gst_ftl_video_sink_gather_nalus (self, buffer, counters);
 
-    num_nalus++;
+  /* With alignment=nal, a new DTS means the access unit before it is
+   * complete. Upstream may also mark the end with GST_BUFFER_FLAG_MARKER,
+   * like h264parse does. */
+  marker = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_MARKER);
+  new_au = !self->in_au || dts_usec != self->au_dts;
+  if (self->nal_aligned && new_au)
+    gst_ftl_video_sink_end_au (self);
 
-    switch (nalu_type) {
-      case 0:
-        GST_ELEMENT_ERROR (self, STREAM, DECODE, ("Invalid NALU type 0"),
-            ("%" GST_PTR_FORMAT, buffer));
-        gst_buffer_unmap (buffer, &map);
-        return GST_FLOW_ERROR;
-      case 9:                  /* AU delimiter */
-        GST_LOG_OBJECT (self, "skipping AU delimiter (size %" G_GSIZE_FORMAT
-            ")", nalu_len);
-        break;
-      default:
-      {
-        gboolean last = (next == NULL);
-        gint sent = ftl_ingest_send_media_dts (gst_ftl_sink_get_handle (parent),
-            FTL_VIDEO_DATA, gst_util_uint64_scale_round (time, 1, GST_USECOND),
-            data, nalu_len, last);
-
-        GST_LOG_OBJECT (self,
-            "sent %d bytes (NALU type %u, size %" G_GSIZE_FORMAT "%s) at %"
-            GST_TIME_FORMAT, sent, nalu_type, nalu_len, (last ? ", last" : ""),
-            GST_TIME_ARGS (time));
-
-        bytes_sent += sent;
-        break;
-      }
+  if (!gst_ftl_video_sink_filter_nalus (self,
+          gst_ftl_sink_get_nal_drop_flags (parent), buffer, counters)) {
+    if (self->nal_aligned && marker)
+      gst_ftl_video_sink_end_au (self);
+    gst_ftl_video_sink_unmap (self->maps, self->chunks);
+    return GST_FLOW_OK;
+  }
+
+  /* Keep the last NALU until we see whether the access unit goes on */
+  hold = self->nal_aligned && !marker;
+  n_nalus = self->nalus->len - (hold ? 1 : 0);
+
+  keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  start = gst_util_get_timestamp ();
+
+  gst_ftl_video_sink_send_held (self, FALSE);
+
+  /* Whole access units only, parts of one already come spread out */
+  if (!self->nal_aligned)
+    gst_ftl_sink_pace_frame (parent, gst_buffer_get_size (buffer));
+
+  bytes_sent = gst_ftl_video_sink_send_nalus (self,
+      gst_ftl_sink_get_handle (parent), dts_usec, new_au &&
+      gst_ftl_video_sink_needs_parameter_sets (self, buffer,
+          self->need_parameter_sets), n_nalus, !hold);
+  if (new_au)
+    self->need_parameter_sets = FALSE;
+
+  /* Mirrors start at a keyframe, so they only need parameter sets on
+   * keyframes. Later parts of an access unit go to the mirrors that took
+   * its start. */
+  if (new_au)
+    g_array_set_size (self->mirror_accepted,
+        gst_ftl_sink_get_n_mirrors (parent));
+
+  for (guint i = 0; i < self->mirror_accepted->len; i++) {
+    GstFtlMirror *mirror = gst_ftl_sink_get_mirror (parent, i);
+    ftl_handle_t *handle;
+
+    if (new_au) {
+      handle = gst_ftl_mirror_begin_frame (mirror, FTL_VIDEO_DATA, dts_usec,
+          keyframe);
+      g_array_index (self->mirror_accepted, gboolean, i) = handle != NULL;
+      if (handle == NULL && gst_ftl_mirror_take_keyframe_request (mirror))
+        request_keyframe = TRUE;
+    } else if (g_array_index (self->mirror_accepted, gboolean, i)) {
+      handle = gst_ftl_mirror_continue_frame (mirror, FTL_VIDEO_DATA,
+          dts_usec);
+    } else {
+      handle = NULL;
     }
 
-    data = next;
+    if (handle != NULL)
+      gst_ftl_mirror_end_frame (mirror, FTL_VIDEO_DATA, dts_usec,
+          gst_ftl_video_sink_send_nalus (self, handle, dts_usec, new_au &&
+              gst_ftl_video_sink_needs_parameter_sets (self, buffer, FALSE),
+              n_nalus, !hold));
   }
 
-  gst_buffer_unmap (buffer, &map);
+  if (request_keyframe) {
+    GST_INFO_OBJECT (self, "A mirror waits for a keyframe");
+    gst_ftl_video_sink_request_keyframe (self);
+  }
 
-  if (num_nalus == 0) {
-    GST_ELEMENT_ERROR (self, STREAM, DECODE, ("No NALU in buffer"),
-        ("%" GST_PTR_FORMAT, buffer));
-    return GST_FLOW_ERROR;
+  gst_ftl_sink_record_latency (parent, GST_FTL_LATENCY_SEND, FTL_VIDEO_DATA,
+      gst_util_get_timestamp () - start);
+
+  if (hold) {
+    gst_buffer_replace (&self->held_buffer, buffer);
+    self->held_nalu = g_array_index (self->nalus, GstFtlNalu, n_nalus);
   }
+  self->in_au = hold;
+  self->au_dts = dts_usec;
 
-  GST_LOG_OBJECT (self, "sent %u NALUs, %d bytes for %" GST_PTR_FORMAT,
-      num_nalus, bytes_sent, buffer);
+  /* In a list, keep the memories mapped until the batch goes out, unless
+   * the next buffer reuses the copies of this one */
+  if (self->batching && copied == 0) {
+    g_array_append_vals (self->batch_maps, self->maps->data,
+        self->maps->len);
+    g_array_set_size (self->maps, 0);
+    g_array_set_size (self->chunks, 0);
+  } else {
+    gst_ftl_sink_flush_media (parent, FTL_VIDEO_DATA);
+    gst_ftl_video_sink_unmap (self->maps, self->chunks);
+  }
+
+  GST_LOG_OBJECT (self, "sent %u NALUs, %d bytes at %" GST_TIME_FORMAT
+      " for %" GST_PTR_FORMAT "%s", n_nalus, bytes_sent, GST_TIME_ARGS (time),
+      buffer, (hold ? ", holding one" : ""));
+
+  gst_ftl_counters_inc (counters, GST_FTL_COUNTER_VIDEO_BUFFERS);
+  if (keyframe && new_au)
+    gst_ftl_counters_inc (counters, GST_FTL_COUNTER_VIDEO_KEYFRAMES);
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_NALUS, n_nalus);
+  gst_ftl_counters_add (counters, GST_FTL_COUNTER_VIDEO_BYTES, bytes_sent);
   return GST_FLOW_OK;
 }
+
+/* Sends every access unit of @list, with the running times in @times, in
+ * as few syscalls as the native transport manages. Called by ftlsink from
+ * render_list() while connected. */
+GstFlowReturn
+gst_ftl_video_sink_send_list (GstFtlVideoSink * self, GstBufferList * list,
+    const GstClockTime * times)
+{
+  GstFtlSink *parent = (GstFtlSink *) GST_OBJECT_PARENT (self);
+  guint length = gst_buffer_list_length (list);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  self->batching = TRUE;
+  gst_ftl_sink_set_batching (parent, FTL_VIDEO_DATA, TRUE);
+  for (guint i = 0; i < length && ret == GST_FLOW_OK; i++)
+    ret = gst_ftl_video_sink_send_buffer (self, gst_buffer_list_get (list, i),
+        times[i]);
+  gst_ftl_sink_set_batching (parent, FTL_VIDEO_DATA, FALSE);
+  self->batching = FALSE;
+
+  gst_ftl_video_sink_unmap (self->batch_maps, NULL);
+  return ret;
+}
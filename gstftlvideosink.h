@@ -31,7 +31,13 @@ G_BEGIN_DECLS
 #define GST_TYPE_FTL_VIDEO_SINK gst_ftl_video_sink_get_type ()
 G_DECLARE_FINAL_TYPE (GstFtlVideoSink, gst_ftl_video_sink, GST, FTL_VIDEO_SINK, GstBaseSink)
 
-#define GST_FTL_VIDEO_SINK_CAPS "video/x-h264, stream-format=byte-stream, alignment=au"
+GstFlowReturn gst_ftl_video_sink_send_buffer (GstFtlVideoSink * self,
+    GstBuffer * buffer, GstClockTime time);
+GstFlowReturn gst_ftl_video_sink_send_list (GstFtlVideoSink * self,
+    GstBufferList * list, const GstClockTime * times);
+void gst_ftl_video_sink_request_keyframe (GstFtlVideoSink * self);
+
+#define GST_FTL_VIDEO_SINK_CAPS "video/x-h264, stream-format=(string){ avc, byte-stream }, alignment=(string){ au, nal }"
 
 G_END_DECLS
 #endif
@@ -0,0 +1,589 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Loopback benchmark for ftlsink.
+ *
+ * Pushes a live H.264 + Opus test stream through ftlsink to the mock
+ * ingest from mockingest.c, running in the same process, and reports the
+ * latency from a buffer reaching ftlsink's sink pad to its frame arriving
+ * at the ingest, along with the throughput and the CPU time used by each
+ * group of threads.
+ *
+ * Frames are matched by timestamp: the first frame received for a stream
+ * is assumed to be the first one sent, and later frames are matched by
+ * their offset from it. libftl always connects to port 8084, so that port
+ * must be free.
+ */
+
+#include "mockingest.h"
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_CHANNEL_ID 1000
+
+static gchar *plugin_path = "./libgstftl.so";
+static gint duration = 10;
+static gint width = 1280;
+static gint height = 720;
+static gint fps = 30;
+static gint bitrate = 2500;
+static gdouble loss_percent = 0;
+static gint delay_ms = 0;
+static gint media_port = MOCK_INGEST_DEFAULT_MEDIA_PORT;
+static gboolean no_nack = FALSE;
+static gboolean async_send = FALSE;
+static gchar *transport = "libftl";
+static gdouble pacing_fraction = 0;
+static gint fec_percentage = 0;
+
+static GOptionEntry entries[] = {
+  {"plugin", 0, 0, G_OPTION_ARG_FILENAME, &plugin_path,
+      "Path to libgstftl.so", "PATH"},
+  {"duration", 't', 0, G_OPTION_ARG_INT, &duration, "Seconds to run", "S"},
+  {"width", 'w', 0, G_OPTION_ARG_INT, &width, "Video width", "PIXELS"},
+  {"height", 'h', 0, G_OPTION_ARG_INT, &height, "Video height", "PIXELS"},
+  {"fps", 'f', 0, G_OPTION_ARG_INT, &fps, "Video frame rate", "FPS"},
+  {"bitrate", 'b', 0, G_OPTION_ARG_INT, &bitrate, "Video bitrate", "KBPS"},
+  {"loss", 'l', 0, G_OPTION_ARG_DOUBLE, &loss_percent,
+      "Percentage of packets the ingest drops", "PERCENT"},
+  {"delay", 'd', 0, G_OPTION_ARG_INT, &delay_ms,
+      "One-way delay added by the ingest", "MS"},
+  {"media-port", 'm', 0, G_OPTION_ARG_INT, &media_port,
+      "UDP port of the ingest", "PORT"},
+  {"no-nack", 0, 0, G_OPTION_ARG_NONE, &no_nack,
+      "Don't have the ingest ask for retransmissions", NULL},
+  {"async-send", 'a', 0, G_OPTION_ARG_NONE, &async_send,
+      "Set async-send on ftlsink", NULL},
+  {"transport", 0, 0, G_OPTION_ARG_STRING, &transport,
+      "media-transport of ftlsink (libftl, sendmmsg or gso)", "MODE"},
+  {"pacing-fraction", 0, 0, G_OPTION_ARG_DOUBLE, &pacing_fraction,
+      "pacing-fraction of ftlsink", "FRACTION"},
+  {"fec-percentage", 0, 0, G_OPTION_ARG_INT, &fec_percentage,
+      "fec-percentage of ftlsink, -1 to adapt to loss", "PERCENT"},
+  {NULL}
+};
+
+typedef struct
+{
+  gint64 offset_us;
+  gint64 enter_us;
+} BenchSentFrame;
+
+typedef struct
+{
+  const gchar *name;
+  guint clock_rate;
+  gint64 tolerance_us;
+
+  GMutex lock;
+
+  /* Frames that entered ftlsink but haven't been matched yet */
+  GQueue sent;
+  GstClockTime first_dts;
+  guint64 sent_frames;
+  guint64 sent_bytes;
+
+  gboolean have_first_timestamp;
+  guint32 first_timestamp;
+  guint64 received_frames;
+  guint64 received_bytes;
+  guint64 missed;
+  guint64 unmatched;
+  GArray *latencies;
+} BenchTrack;
+
+typedef struct
+{
+  GstElement *sink;
+  BenchTrack video;
+  BenchTrack audio;
+  GMainLoop *loop;
+  /* The pipeline posted an error */
+  gboolean failed;
+} BenchStream;
+
+static void
+bench_track_init (BenchTrack * track, const gchar * name, guint clock_rate,
+    gint64 tolerance_us)
+{
+  track->name = name;
+  track->clock_rate = clock_rate;
+  track->tolerance_us = tolerance_us;
+  g_mutex_init (&track->lock);
+  g_queue_init (&track->sent);
+  track->first_dts = GST_CLOCK_TIME_NONE;
+  track->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+}
+
+static void
+bench_track_clear (BenchTrack * track)
+{
+  g_queue_foreach (&track->sent, (GFunc) g_free, NULL);
+  g_queue_clear (&track->sent);
+  g_array_free (track->latencies, TRUE);
+  g_mutex_clear (&track->lock);
+}
+
+static GstPadProbeReturn
+bench_sink_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BenchTrack *track = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime dts = GST_BUFFER_DTS_OR_PTS (buffer);
+  BenchSentFrame *frame;
+
+  if (!GST_CLOCK_TIME_IS_VALID (dts))
+    return GST_PAD_PROBE_OK;
+
+  frame = g_new (BenchSentFrame, 1);
+  frame->enter_us = g_get_monotonic_time ();
+
+  g_mutex_lock (&track->lock);
+  if (!GST_CLOCK_TIME_IS_VALID (track->first_dts))
+    track->first_dts = dts;
+  frame->offset_us = GST_CLOCK_DIFF (track->first_dts, dts) / GST_USECOND;
+  g_queue_push_tail (&track->sent, frame);
+  track->sent_frames++;
+  track->sent_bytes += gst_buffer_get_size (buffer);
+  g_mutex_unlock (&track->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+bench_track_received (BenchTrack * track, guint32 timestamp,
+    gint64 arrival_us, gsize bytes)
+{
+  BenchSentFrame *frame;
+  gint64 offset_us;
+
+  g_mutex_lock (&track->lock);
+
+  if (!track->have_first_timestamp) {
+    track->first_timestamp = timestamp;
+    track->have_first_timestamp = TRUE;
+  }
+
+  track->received_frames++;
+  track->received_bytes += bytes;
+
+  offset_us = gst_util_uint64_scale_int ((guint32) (timestamp -
+          track->first_timestamp), G_USEC_PER_SEC, track->clock_rate);
+
+  /* Anything older than this frame never made it or was reordered */
+  while ((frame = g_queue_peek_head (&track->sent)) != NULL &&
+      frame->offset_us < offset_us - track->tolerance_us) {
+    g_free (g_queue_pop_head (&track->sent));
+    track->missed++;
+  }
+
+  if (frame != NULL && frame->offset_us <= offset_us + track->tolerance_us) {
+    gint64 latency = arrival_us - frame->enter_us;
+
+    g_array_append_val (track->latencies, latency);
+    g_free (g_queue_pop_head (&track->sent));
+  } else {
+    track->unmatched++;
+  }
+
+  g_mutex_unlock (&track->lock);
+}
+
+static void
+bench_frame_received (guint32 ssrc, MockIngestMedia media,
+    guint32 rtp_timestamp, gint64 arrival_us, gsize bytes, gpointer user_data)
+{
+  BenchStream *stream = user_data;
+
+  /* libftl uses the channel ID as audio SSRC and the next one for video */
+  if (media == MOCK_INGEST_VIDEO && ssrc == BENCH_CHANNEL_ID + 1)
+    bench_track_received (&stream->video, rtp_timestamp, arrival_us, bytes);
+  else if (media == MOCK_INGEST_AUDIO && ssrc == BENCH_CHANNEL_ID)
+    bench_track_received (&stream->audio, rtp_timestamp, arrival_us, bytes);
+}
+
+static gboolean
+bench_add_probe (GstElement * sink, const gchar * pad_name,
+    BenchTrack * track)
+{
+  GstPad *pad = gst_element_get_static_pad (sink, pad_name);
+
+  if (pad == NULL)
+    return FALSE;
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, bench_sink_probe,
+      track, NULL);
+  gst_object_unref (pad);
+  return TRUE;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+static gdouble
+percentile_ms (GArray * sorted, gdouble p)
+{
+  guint index;
+
+  if (sorted->len == 0)
+    return 0;
+
+  index = MIN ((guint) (p * sorted->len), sorted->len - 1);
+  return g_array_index (sorted, gint64, index) / 1000.0;
+}
+
+static void
+bench_track_report (BenchTrack * track, gdouble seconds)
+{
+  g_mutex_lock (&track->lock);
+
+  g_array_sort (track->latencies, compare_int64);
+
+  g_print ("%s: sent %" G_GUINT64_FORMAT " frames (%.0f kbit/s), received %"
+      G_GUINT64_FORMAT " frames (%.0f kbit/s)\n", track->name,
+      track->sent_frames, track->sent_bytes * 8 / seconds / 1000,
+      track->received_frames, track->received_bytes * 8 / seconds / 1000);
+  g_print ("  latency over %u frames: p50 %.2f ms, p99 %.2f ms, "
+      "max %.2f ms\n", track->latencies->len,
+      percentile_ms (track->latencies, 0.5),
+      percentile_ms (track->latencies, 0.99),
+      percentile_ms (track->latencies, 1.0));
+  g_print ("  %" G_GUINT64_FORMAT " missed, %" G_GUINT64_FORMAT
+      " unmatched\n", track->missed, track->unmatched);
+
+  g_mutex_unlock (&track->lock);
+}
+
+/* Returns thread name -> CPU ticks, summed over threads of the same name */
+static GHashTable *
+bench_read_thread_cpu (void)
+{
+  GHashTable *ticks = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  GDir *dir = g_dir_open ("/proc/self/task", 0, NULL);
+  const gchar *tid;
+
+  if (dir == NULL)
+    return ticks;
+
+  while ((tid = g_dir_read_name (dir)) != NULL) {
+    gchar *path = g_build_filename ("/proc/self/task", tid, "stat", NULL);
+    gchar *contents = NULL, *open, *close;
+    gchar **fields;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+      goto next;
+
+    /* pid (comm) state ppid ... utime stime; comm may contain spaces */
+    open = strchr (contents, '(');
+    close = strrchr (contents, ')');
+    if (open == NULL || close == NULL || close < open)
+      goto next;
+
+    *close = '\0';
+    fields = g_strsplit (close + 2, " ", 0);
+    if (g_strv_length (fields) > 12) {
+      guint64 *total = g_hash_table_lookup (ticks, open + 1);
+
+      if (total == NULL) {
+        total = g_new0 (guint64, 1);
+        g_hash_table_insert (ticks, g_strdup (open + 1), total);
+      }
+
+      *total += g_ascii_strtoull (fields[11], NULL, 10) +
+          g_ascii_strtoull (fields[12], NULL, 10);
+    }
+    g_strfreev (fields);
+
+  next:
+    g_free (contents);
+    g_free (path);
+  }
+
+  g_dir_close (dir);
+  return ticks;
+}
+
+static void
+bench_report_cpu (GHashTable * before, GHashTable * after, gdouble seconds)
+{
+  gdouble tick = 1.0 / sysconf (_SC_CLK_TCK);
+  GHashTableIter iter;
+  gpointer key, value;
+  gdouble total = 0;
+
+  /* Threads that exited before the second reading aren't counted */
+  g_print ("CPU time per thread group:\n");
+  g_hash_table_iter_init (&iter, after);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    guint64 *start = g_hash_table_lookup (before, key);
+    guint64 used = *(guint64 *) value - (start ? MIN (*start,
+            *(guint64 *) value) : 0);
+
+    if (used == 0)
+      continue;
+
+    total += used * tick;
+    g_print ("  %-16s %6.1f%%\n", (const gchar *) key,
+        100 * used * tick / seconds);
+  }
+  g_print ("  %-16s %6.1f%%\n", "total", 100 * total / seconds);
+}
+
+static gboolean
+bench_bus_message (GstBus * bus, GstMessage * message, gpointer user_data)
+{
+  BenchStream *stream = user_data;
+
+  switch (GST_MESSAGE_TYPE (message)) {
+    case GST_MESSAGE_ERROR:{
+      GError *err = NULL;
+      gchar *debug = NULL;
+
+      gst_message_parse_error (message, &err, &debug);
+      g_printerr ("%s: %s\n%s\n", GST_MESSAGE_SRC_NAME (message),
+          err->message, debug ? debug : "");
+      g_clear_error (&err);
+      g_free (debug);
+      stream->failed = TRUE;
+      g_main_loop_quit (stream->loop);
+      break;
+    }
+    case GST_MESSAGE_EOS:
+      g_main_loop_quit (stream->loop);
+      break;
+    default:
+      break;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+bench_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const gchar *const required[] = { "videotestsrc", "x264enc",
+    "h264parse", "audiotestsrc", "opusenc", "ftlsink"
+  };
+  MockIngestConfig config;
+  MockIngest *mock = NULL;
+  MockIngestStats mock_stats;
+  GArray *streams;
+  GstStructure *sink_stats = NULL;
+  guint64 packets, syscalls, nacks = 0, retransmits = 0, too_late = 0;
+  guint64 fec_packets = 0;
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline = NULL;
+  GstPlugin *plugin;
+  GstBus *bus;
+  GMainLoop *loop;
+  GHashTable *cpu_before, *cpu_after;
+  BenchStream stream = { NULL };
+  gchar *description, *stream_key;
+  gint64 start_us;
+  gdouble seconds;
+  gint ret = EXIT_FAILURE;
+
+  ctx = g_option_context_new ("- ftlsink loopback benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  plugin = gst_plugin_load_file (plugin_path, &err);
+  if (plugin == NULL) {
+    g_printerr ("Failed to load %s: %s\n", plugin_path, err->message);
+    g_clear_error (&err);
+    return EXIT_FAILURE;
+  }
+  gst_object_unref (plugin);
+
+  for (guint i = 0; i < G_N_ELEMENTS (required); i++) {
+    GstElementFactory *factory = gst_element_factory_find (required[i]);
+
+    if (factory == NULL) {
+      g_printerr ("Missing element %s\n", required[i]);
+      return EXIT_FAILURE;
+    }
+    gst_object_unref (factory);
+  }
+
+  bench_track_init (&stream.video, "video", 90000, G_USEC_PER_SEC / fps / 2);
+  bench_track_init (&stream.audio, "audio", 48000, 5000);
+
+  mock_ingest_config_init (&config);
+  config.media_port = media_port;
+  config.loss = loss_percent / 100;
+  config.delay_us = (gint64) delay_ms * 1000;
+  config.nack = !no_nack;
+
+  mock = mock_ingest_new (&config, bench_frame_received, &stream, &err);
+  if (mock == NULL) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    goto out;
+  }
+
+  description = g_strdup_printf ("videotestsrc is-live=true pattern=ball ! "
+      "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
+      "x264enc tune=zerolatency speed-preset=ultrafast bitrate=%d "
+      "key-int-max=%d ! h264parse ! queue ! ftl.videosink "
+      "audiotestsrc is-live=true wave=ticks ! audioconvert ! audioresample ! "
+      "audio/x-raw,rate=48000 ! opusenc ! queue ! ftl.audiosink "
+      "ftlsink name=ftl ingest-hostname=127.0.0.1",
+      width, height, fps, bitrate, 2 * fps);
+  pipeline = gst_parse_launch (description, &err);
+  g_free (description);
+  if (pipeline == NULL || err != NULL) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    goto out;
+  }
+
+  /* Keep every NALU so frames on both sides match one-to-one */
+  stream.sink = gst_bin_get_by_name (GST_BIN (pipeline), "ftl");
+  stream_key = g_strdup_printf ("%d-mockkey", BENCH_CHANNEL_ID);
+  g_object_set (stream.sink, "stream-key", stream_key, "nal-drop-policy", 0,
+      "async-send", async_send, "media-port", media_port,
+      "pacing-fraction", pacing_fraction, "fec-percentage", fec_percentage,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (stream.sink), "media-transport",
+      transport);
+  g_free (stream_key);
+
+  if (!bench_add_probe (stream.sink, "videosink", &stream.video) ||
+      !bench_add_probe (stream.sink, "audiosink", &stream.audio)) {
+    g_printerr ("ftlsink has no videosink/audiosink pads\n");
+    goto out;
+  }
+
+  loop = stream.loop = g_main_loop_new (NULL, FALSE);
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_add_watch (bus, bench_bus_message, &stream);
+
+  cpu_before = bench_read_thread_cpu ();
+  start_us = g_get_monotonic_time ();
+
+  if (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE) {
+    g_timeout_add_seconds (duration, bench_timeout, loop);
+    g_main_loop_run (loop);
+    /* Still report how far it got */
+    ret = stream.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  cpu_after = bench_read_thread_cpu ();
+  seconds = (g_get_monotonic_time () - start_us) / (gdouble) G_USEC_PER_SEC;
+
+  /* Counters restart with the next connection */
+  g_object_get (stream.sink, "stats", &sink_stats, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_watch (bus);
+  gst_object_unref (bus);
+  g_main_loop_unref (loop);
+
+  mock_ingest_get_stats (mock, &mock_stats);
+  streams = mock_ingest_get_stream_stats (mock);
+  mock_ingest_free (mock);
+  mock = NULL;
+
+  bench_track_report (&stream.video, seconds);
+  bench_track_report (&stream.audio, seconds);
+
+  for (guint i = 0; i < streams->len; i++) {
+    MockIngestStreamStats *s =
+        &g_array_index (streams, MockIngestStreamStats, i);
+
+    g_print ("ingest ssrc %u: %" G_GUINT64_FORMAT " packets, %"
+        G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " late, %"
+        G_GUINT64_FORMAT " NACKs, %" G_GUINT64_FORMAT " parity, %"
+        G_GUINT64_FORMAT " recovered\n", s->ssrc, s->packets, s->lost,
+        s->late, s->nacks_sent, s->fec_packets, s->recovered);
+  }
+  g_print ("ingest: %" G_GUINT64_FORMAT " connections, %" G_GUINT64_FORMAT
+      " pings, %" G_GUINT64_FORMAT " packets dropped\n",
+      mock_stats.connections, mock_stats.pings, mock_stats.dropped);
+  g_array_free (streams, TRUE);
+
+  if (sink_stats != NULL &&
+      gst_structure_get_uint64 (sink_stats, "transport-packets-total",
+          &packets) &&
+      gst_structure_get_uint64 (sink_stats, "transport-syscalls-total",
+          &syscalls) && syscalls > 0) {
+    gst_structure_get_uint64 (sink_stats, "transport-nacks-total", &nacks);
+    gst_structure_get_uint64 (sink_stats, "transport-retransmits-total",
+        &retransmits);
+    gst_structure_get_uint64 (sink_stats, "transport-nacks-too-late-total",
+        &too_late);
+    gst_structure_get_uint64 (sink_stats, "transport-fec-packets-total",
+        &fec_packets);
+
+    g_print ("transport: %" G_GUINT64_FORMAT " packets in %" G_GUINT64_FORMAT
+        " syscalls (%.1f per syscall), %" G_GUINT64_FORMAT " NACKed, %"
+        G_GUINT64_FORMAT " resent, %" G_GUINT64_FORMAT " too late, %"
+        G_GUINT64_FORMAT " parity\n", packets, syscalls,
+        (gdouble) packets / syscalls, nacks, retransmits, too_late,
+        fec_packets);
+  }
+
+  bench_report_cpu (cpu_before, cpu_after, seconds);
+  g_hash_table_unref (cpu_before);
+  g_hash_table_unref (cpu_after);
+
+out:
+  if (sink_stats != NULL)
+    gst_structure_free (sink_stats);
+  if (mock != NULL)
+    mock_ingest_free (mock);
+  if (stream.sink != NULL)
+    gst_object_unref (stream.sink);
+  if (pipeline != NULL)
+    gst_object_unref (pipeline);
+  bench_track_clear (&stream.video);
+  bench_track_clear (&stream.audio);
+  return ret;
+}
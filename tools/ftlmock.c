@@ -0,0 +1,142 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Runs the mock FTL ingest from mockingest.c on its own and prints what it
+ * receives once per second.
+ *
+ * ftlsink always connects to port 8084, so point it at this host with
+ * ingest-hostname and any stream key of the form <channel>-<key>.
+ */
+
+#include "mockingest.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+static gint port = MOCK_INGEST_DEFAULT_PORT;
+static gint media_port = MOCK_INGEST_DEFAULT_MEDIA_PORT;
+static gdouble loss_percent = 0;
+static gint delay_ms = 0;
+static gboolean no_nack = FALSE;
+static gint seed = 1;
+static gint duration = 0;
+
+static GOptionEntry entries[] = {
+  {"port", 'p', 0, G_OPTION_ARG_INT, &port, "TCP handshake port", "PORT"},
+  {"media-port", 'm', 0, G_OPTION_ARG_INT, &media_port,
+      "UDP port for RTP", "PORT"},
+  {"loss", 'l', 0, G_OPTION_ARG_DOUBLE, &loss_percent,
+      "Percentage of received packets to drop", "PERCENT"},
+  {"delay", 'd', 0, G_OPTION_ARG_INT, &delay_ms,
+      "One-way delay added to received packets and replies", "MS"},
+  {"no-nack", 0, 0, G_OPTION_ARG_NONE, &no_nack,
+      "Don't ask for retransmissions", NULL},
+  {"seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed", "SEED"},
+  {"duration", 't', 0, G_OPTION_ARG_INT, &duration,
+      "Seconds to run (0 = until interrupted)", "S"},
+  {NULL}
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void
+handle_sigint (int signum)
+{
+  interrupted = 1;
+}
+
+static void
+print_stats (MockIngest * mock)
+{
+  GArray *streams = mock_ingest_get_stream_stats (mock);
+  MockIngestStats stats;
+
+  mock_ingest_get_stats (mock, &stats);
+  g_print ("connections %" G_GUINT64_FORMAT ", pings %" G_GUINT64_FORMAT
+      ", dropped %" G_GUINT64_FORMAT "\n", stats.connections, stats.pings,
+      stats.dropped);
+
+  for (guint i = 0; i < streams->len; i++) {
+    MockIngestStreamStats *s =
+        &g_array_index (streams, MockIngestStreamStats, i);
+
+    g_print ("  ssrc %-10u %s: %" G_GUINT64_FORMAT " packets, %"
+        G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " frames, %"
+        G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " late, %"
+        G_GUINT64_FORMAT " NACKs, %" G_GUINT64_FORMAT " parity, %"
+        G_GUINT64_FORMAT " recovered\n", s->ssrc,
+        s->media == MOCK_INGEST_VIDEO ? "video" : "audio", s->packets,
+        s->bytes, s->frames, s->lost, s->late, s->nacks_sent,
+        s->fec_packets, s->recovered);
+  }
+
+  g_array_free (streams, TRUE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  MockIngestConfig config;
+  MockIngest *mock;
+  GOptionContext *ctx;
+  GError *err = NULL;
+
+  ctx = g_option_context_new ("- mock FTL ingest");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  mock_ingest_config_init (&config);
+  config.port = port;
+  config.media_port = media_port;
+  config.loss = loss_percent / 100;
+  config.delay_us = (gint64) delay_ms * 1000;
+  config.nack = !no_nack;
+  config.seed = seed;
+
+  mock = mock_ingest_new (&config, NULL, NULL, &err);
+  if (mock == NULL) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    return EXIT_FAILURE;
+  }
+
+  g_print ("listening on TCP port %d, UDP port %d\n", port, media_port);
+  signal (SIGINT, handle_sigint);
+
+  for (gint elapsed = 0; !interrupted && (duration <= 0 ||
+          elapsed < duration); elapsed++) {
+    g_usleep (G_USEC_PER_SEC);
+    print_stats (mock);
+  }
+
+  mock_ingest_free (mock);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,569 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Density benchmark for ftlsink: runs N independent ftlsink pipelines in
+ * one process against the mock ingest from mockingest.c and reports how
+ * threads, memory, context switches and CPU grow with N.
+ *
+ * A short H.264 GOP and an Opus clip are encoded once up front and looped
+ * into every stream through appsrc, so the numbers measure ftlsink and
+ * libftl rather than the encoders. All streams are fed from one thread.
+ * Process-wide numbers include that thread and the mock ingest.
+ */
+
+#include "mockingest.h"
+
+#include <gst/app/app.h>
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define SCALE_CHANNEL_ID 1000
+
+static gchar *plugin_path = "./libgstftl.so";
+static gchar *sink_counts = "1,10,100,500";
+static gint duration = 10;
+static gint warmup = 2;
+static gint width = 640;
+static gint height = 360;
+static gint fps = 30;
+static gint bitrate = 800;
+static gboolean async_send = FALSE;
+static gchar *transport = "libftl";
+
+static GOptionEntry entries[] = {
+  {"plugin", 0, 0, G_OPTION_ARG_FILENAME, &plugin_path,
+      "Path to libgstftl.so", "PATH"},
+  {"sinks", 'n', 0, G_OPTION_ARG_STRING, &sink_counts,
+      "Comma-separated numbers of ftlsinks to run", "N,N,..."},
+  {"duration", 't', 0, G_OPTION_ARG_INT, &duration,
+      "Seconds to measure each step", "S"},
+  {"warmup", 0, 0, G_OPTION_ARG_INT, &warmup,
+      "Seconds to stream before measuring", "S"},
+  {"width", 'w', 0, G_OPTION_ARG_INT, &width, "Video width", "PIXELS"},
+  {"height", 'h', 0, G_OPTION_ARG_INT, &height, "Video height", "PIXELS"},
+  {"fps", 'f', 0, G_OPTION_ARG_INT, &fps, "Video frame rate", "FPS"},
+  {"bitrate", 'b', 0, G_OPTION_ARG_INT, &bitrate, "Video bitrate", "KBPS"},
+  {"async-send", 'a', 0, G_OPTION_ARG_NONE, &async_send,
+      "Set async-send on every ftlsink", NULL},
+  {"transport", 0, 0, G_OPTION_ARG_STRING, &transport,
+      "media-transport of every ftlsink (libftl, sendmmsg or gso)", "MODE"},
+  {NULL}
+};
+
+typedef struct
+{
+  GPtrArray *buffers;
+  GstCaps *caps;
+} ScaleClip;
+
+typedef struct
+{
+  GstElement *pipeline;
+  GstElement *video_src;
+  GstElement *audio_src;
+} ScaleStream;
+
+typedef struct
+{
+  ScaleClip *video;
+  ScaleClip *audio;
+  GPtrArray *streams;
+
+  GThread *thread;
+  GMutex lock;
+  GCond cond;
+  gboolean stop;
+} ScaleFeeder;
+
+typedef struct
+{
+  gint64 time_us;
+  gint64 cpu_us;
+  gint64 context_switches;
+  guint64 received_bytes;
+} ScaleSnapshot;
+
+static gboolean
+scale_encode_clip (ScaleClip * clip, const gchar * description,
+    GError ** error)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  GstMessage *message;
+  GstBus *bus;
+
+  pipeline = gst_parse_launch (description, error);
+  if (pipeline == NULL)
+    return FALSE;
+
+  clip->buffers = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      gst_buffer_unref);
+  clip->caps = NULL;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink))) != NULL) {
+    if (clip->caps == NULL)
+      clip->caps = gst_caps_ref (gst_sample_get_caps (sample));
+    g_ptr_array_add (clip->buffers,
+        gst_buffer_ref (gst_sample_get_buffer (sample)));
+    gst_sample_unref (sample);
+  }
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  if (message != NULL) {
+    gst_message_parse_error (message, error, NULL);
+    gst_message_unref (message);
+  } else if (clip->buffers->len == 0) {
+    g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+        "No buffers from \"%s\"", description);
+  }
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return error == NULL || *error == NULL;
+}
+
+static void
+scale_clip_clear (ScaleClip * clip)
+{
+  if (clip->buffers != NULL)
+    g_ptr_array_unref (clip->buffers);
+  if (clip->caps != NULL)
+    gst_caps_unref (clip->caps);
+}
+
+/* The appsrcs timestamp buffers with their own pipeline's running time */
+static void
+scale_feed (GPtrArray * streams, gboolean video, GstBuffer * buffer)
+{
+  for (guint i = 0; i < streams->len; i++) {
+    ScaleStream *stream = g_ptr_array_index (streams, i);
+    GstBuffer *copy = gst_buffer_copy (buffer);
+
+    GST_BUFFER_PTS (copy) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DTS (copy) = GST_CLOCK_TIME_NONE;
+    gst_app_src_push_buffer (GST_APP_SRC (video ? stream->video_src :
+            stream->audio_src), copy);
+  }
+}
+
+static gpointer
+scale_feeder_thread (gpointer user_data)
+{
+  ScaleFeeder *feeder = user_data;
+  gint64 start = g_get_monotonic_time ();
+  gint64 next_video = start, next_audio = start;
+  guint64 video_frames = 0;
+  gint64 audio_offset = 0;
+  guint audio_index = 0;
+
+  g_mutex_lock (&feeder->lock);
+
+  while (!feeder->stop) {
+    gint64 next = MIN (next_video, next_audio);
+    gint64 now;
+
+    if (g_get_monotonic_time () < next) {
+      g_cond_wait_until (&feeder->cond, &feeder->lock, next);
+      continue;
+    }
+
+    g_mutex_unlock (&feeder->lock);
+    now = g_get_monotonic_time ();
+
+    if (now >= next_video) {
+      GPtrArray *buffers = feeder->video->buffers;
+
+      scale_feed (feeder->streams, TRUE,
+          g_ptr_array_index (buffers, video_frames % buffers->len));
+      video_frames++;
+      next_video = start + gst_util_uint64_scale (video_frames,
+          G_USEC_PER_SEC, fps);
+    }
+
+    if (now >= next_audio) {
+      GPtrArray *buffers = feeder->audio->buffers;
+      GstBuffer *buffer = g_ptr_array_index (buffers, audio_index);
+      GstClockTime length = GST_BUFFER_DURATION (buffer);
+
+      scale_feed (feeder->streams, FALSE, buffer);
+      audio_index = (audio_index + 1) % buffers->len;
+      audio_offset += GST_CLOCK_TIME_IS_VALID (length) ?
+          length / GST_USECOND : 20000;
+      next_audio = start + audio_offset;
+    }
+
+    g_mutex_lock (&feeder->lock);
+  }
+
+  g_mutex_unlock (&feeder->lock);
+  return NULL;
+}
+
+static GstElement *
+scale_make_appsrc (GstBin * bin, const gchar * name, GstCaps * caps)
+{
+  GstElement *src = gst_bin_get_by_name (bin, name);
+
+  g_object_set (src, "caps", caps, "is-live", TRUE, "format",
+      GST_FORMAT_TIME, "do-timestamp", TRUE, NULL);
+  return src;
+}
+
+static ScaleStream *
+scale_stream_new (guint index, ScaleClip * video, ScaleClip * audio,
+    GError ** error)
+{
+  ScaleStream *stream;
+  GstElement *pipeline, *sink;
+  gchar *stream_key;
+
+  pipeline = gst_parse_launch ("appsrc name=video ! queue ! ftl.videosink "
+      "appsrc name=audio ! queue ! ftl.audiosink "
+      "ftlsink name=ftl ingest-hostname=127.0.0.1", error);
+  if (pipeline == NULL)
+    return NULL;
+
+  stream = g_new0 (ScaleStream, 1);
+  stream->pipeline = pipeline;
+  stream->video_src = scale_make_appsrc (GST_BIN (pipeline), "video",
+      video->caps);
+  stream->audio_src = scale_make_appsrc (GST_BIN (pipeline), "audio",
+      audio->caps);
+
+  /* libftl uses the channel ID as audio SSRC and the next one for video */
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "ftl");
+  stream_key = g_strdup_printf ("%u-mockkey", SCALE_CHANNEL_ID + 2 * index);
+  g_object_set (sink, "stream-key", stream_key, "async-send", async_send,
+      NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "media-transport", transport);
+  g_free (stream_key);
+  gst_object_unref (sink);
+
+  return stream;
+}
+
+static void
+scale_stream_free (ScaleStream * stream)
+{
+  gst_element_set_state (stream->pipeline, GST_STATE_NULL);
+  gst_object_unref (stream->video_src);
+  gst_object_unref (stream->audio_src);
+  gst_object_unref (stream->pipeline);
+  g_free (stream);
+}
+
+/* Counts streams whose pipeline posted an error */
+static guint
+scale_count_errors (GPtrArray * streams)
+{
+  guint errors = 0;
+
+  for (guint i = 0; i < streams->len; i++) {
+    ScaleStream *stream = g_ptr_array_index (streams, i);
+    GstBus *bus = gst_element_get_bus (stream->pipeline);
+    GstMessage *message = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+
+    if (message != NULL) {
+      GError *err = NULL;
+
+      gst_message_parse_error (message, &err, NULL);
+      if (errors == 0)
+        g_printerr ("stream %u: %s\n", i, err->message);
+      g_clear_error (&err);
+      gst_message_unref (message);
+      errors++;
+    }
+    gst_object_unref (bus);
+  }
+
+  return errors;
+}
+
+/* Reads a "Key:  value" line of /proc/self/status */
+static guint64
+scale_read_status (const gchar * key)
+{
+  gchar *contents = NULL, *line;
+  guint64 value = 0;
+
+  if (!g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+    return 0;
+
+  for (line = contents; line != NULL && *line != '\0';) {
+    gchar *end = strchr (line, '\n');
+
+    if (g_str_has_prefix (line, key) && line[strlen (key)] == ':') {
+      value = g_ascii_strtoull (line + strlen (key) + 1, NULL, 10);
+      break;
+    }
+
+    line = end ? end + 1 : NULL;
+  }
+
+  g_free (contents);
+  return value;
+}
+
+static void
+scale_snapshot (ScaleSnapshot * snapshot, MockIngest * mock,
+    guint * video_streams)
+{
+  GArray *streams = mock_ingest_get_stream_stats (mock);
+  struct rusage usage;
+
+  /* RUSAGE_SELF covers every thread, including ones that have exited */
+  getrusage (RUSAGE_SELF, &usage);
+  snapshot->time_us = g_get_monotonic_time ();
+  snapshot->cpu_us = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  snapshot->context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+
+  snapshot->received_bytes = 0;
+  if (video_streams != NULL)
+    *video_streams = 0;
+
+  for (guint i = 0; i < streams->len; i++) {
+    MockIngestStreamStats *s =
+        &g_array_index (streams, MockIngestStreamStats, i);
+
+    snapshot->received_bytes += s->bytes;
+    if (video_streams != NULL && s->media == MOCK_INGEST_VIDEO &&
+        s->frames > 0)
+      (*video_streams)++;
+  }
+
+  g_array_free (streams, TRUE);
+}
+
+/* Runs one step with @n sinks; returns FALSE if any stream failed */
+static gboolean
+scale_run (guint n, ScaleClip * video, ScaleClip * audio,
+    guint64 base_threads, guint64 base_rss_kb)
+{
+  MockIngestConfig config;
+  MockIngest *mock;
+  ScaleFeeder feeder = { video, audio };
+  ScaleSnapshot begin, end;
+  GError *err = NULL;
+  guint64 threads, rss_kb;
+  guint video_streams, errors;
+  gint64 setup_us, teardown_us;
+  gdouble seconds;
+
+  mock_ingest_config_init (&config);
+  mock = mock_ingest_new (&config, NULL, NULL, &err);
+  if (mock == NULL) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+
+  feeder.streams = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      scale_stream_free);
+  g_mutex_init (&feeder.lock);
+  g_cond_init (&feeder.cond);
+
+  /* Connecting happens in the state change, one sink after the other */
+  setup_us = g_get_monotonic_time ();
+  for (guint i = 0; i < n; i++) {
+    ScaleStream *stream = scale_stream_new (i, video, audio, &err);
+
+    if (stream == NULL) {
+      g_printerr ("%s\n", err->message);
+      g_clear_error (&err);
+      break;
+    }
+
+    g_ptr_array_add (feeder.streams, stream);
+    gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
+  }
+  setup_us = g_get_monotonic_time () - setup_us;
+
+  feeder.thread = g_thread_new ("feeder", scale_feeder_thread, &feeder);
+
+  g_usleep ((gulong) warmup * G_USEC_PER_SEC);
+  scale_snapshot (&begin, mock, NULL);
+  g_usleep ((gulong) duration * G_USEC_PER_SEC);
+  scale_snapshot (&end, mock, &video_streams);
+
+  threads = scale_read_status ("Threads");
+  rss_kb = scale_read_status ("VmRSS");
+
+  g_mutex_lock (&feeder.lock);
+  feeder.stop = TRUE;
+  g_cond_signal (&feeder.cond);
+  g_mutex_unlock (&feeder.lock);
+  g_thread_join (feeder.thread);
+
+  errors = scale_count_errors (feeder.streams);
+
+  teardown_us = g_get_monotonic_time ();
+  g_ptr_array_unref (feeder.streams);
+  teardown_us = g_get_monotonic_time () - teardown_us;
+
+  mock_ingest_free (mock);
+  g_mutex_clear (&feeder.lock);
+  g_cond_clear (&feeder.cond);
+
+  seconds = (end.time_us - begin.time_us) / (gdouble) G_USEC_PER_SEC;
+
+  g_print ("%6u %8.2f %8.2f %8" G_GUINT64_FORMAT " %8.1f %8.1f %8.0f "
+      "%8.0f %8.1f %8.1f %8.2f %8.0f %6u %6u\n", n,
+      setup_us / (gdouble) G_USEC_PER_SEC,
+      teardown_us / (gdouble) G_USEC_PER_SEC, threads,
+      (gdouble) (threads - MIN (threads, base_threads)) / n,
+      rss_kb / 1024.0, (gdouble) (rss_kb - MIN (rss_kb, base_rss_kb)) / n,
+      (end.context_switches - begin.context_switches) / seconds,
+      (end.context_switches - begin.context_switches) / seconds / n,
+      (end.cpu_us - begin.cpu_us) / seconds / G_USEC_PER_SEC * 100,
+      (end.cpu_us - begin.cpu_us) / seconds / G_USEC_PER_SEC * 100 / n,
+      (end.received_bytes - begin.received_bytes) * 8 / seconds / 1000 / n,
+      n - MIN (n, video_streams), errors);
+
+  return video_streams == n && errors == 0;
+}
+
+static gboolean
+scale_raise_fd_limit (void)
+{
+  struct rlimit limit;
+
+  if (getrlimit (RLIMIT_NOFILE, &limit) < 0)
+    return FALSE;
+
+  limit.rlim_cur = limit.rlim_max;
+  return setrlimit (RLIMIT_NOFILE, &limit) == 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const gchar *const required[] = { "videotestsrc", "x264enc",
+    "h264parse", "audiotestsrc", "opusenc", "appsrc", "appsink", "ftlsink"
+  };
+  ScaleClip video = { NULL }, audio = { NULL };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstPlugin *plugin;
+  gchar **counts = NULL, *description;
+  guint64 base_threads, base_rss_kb;
+  gint ret = EXIT_FAILURE;
+
+  ctx = g_option_context_new ("- ftlsink density benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  if (!scale_raise_fd_limit ())
+    g_printerr ("Failed to raise the file descriptor limit\n");
+
+  plugin = gst_plugin_load_file (plugin_path, &err);
+  if (plugin == NULL) {
+    g_printerr ("Failed to load %s: %s\n", plugin_path, err->message);
+    g_clear_error (&err);
+    return EXIT_FAILURE;
+  }
+  gst_object_unref (plugin);
+
+  for (guint i = 0; i < G_N_ELEMENTS (required); i++) {
+    GstElementFactory *factory = gst_element_factory_find (required[i]);
+
+    if (factory == NULL) {
+      g_printerr ("Missing element %s\n", required[i]);
+      return EXIT_FAILURE;
+    }
+    gst_object_unref (factory);
+  }
+
+  /* One GOP, so looping it starts over at a keyframe */
+  description = g_strdup_printf ("videotestsrc num-buffers=%d pattern=ball ! "
+      "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
+      "x264enc tune=zerolatency speed-preset=ultrafast bitrate=%d "
+      "key-int-max=%d ! h264parse ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "appsink name=sink sync=false", 2 * fps, width, height, fps, bitrate,
+      2 * fps);
+  if (!scale_encode_clip (&video, description, &err))
+    goto clip_error;
+  g_free (description);
+
+  description = g_strdup ("audiotestsrc num-buffers=100 "
+      "samplesperbuffer=960 wave=ticks ! audio/x-raw,rate=48000 ! opusenc ! "
+      "appsink name=sink sync=false");
+  if (!scale_encode_clip (&audio, description, &err))
+    goto clip_error;
+  g_free (description);
+
+  base_threads = scale_read_status ("Threads");
+  base_rss_kb = scale_read_status ("VmRSS");
+
+  g_print ("%6s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %6s %6s\n",
+      "sinks", "setup-s", "stop-s", "threads", "thr/sink", "rss-MiB",
+      "KiB/sink", "ctxsw/s", "/sink", "cpu-%", "/sink", "kbit/s",
+      "silent", "errors");
+
+  ret = EXIT_SUCCESS;
+  counts = g_strsplit (sink_counts, ",", 0);
+  for (gchar ** count = counts; *count != NULL; count++) {
+    guint64 n = g_ascii_strtoull (*count, NULL, 10);
+
+    if (n == 0) {
+      g_printerr ("Invalid number of sinks \"%s\"\n", *count);
+      ret = EXIT_FAILURE;
+      break;
+    }
+
+    if (!scale_run (n, &video, &audio, base_threads, base_rss_kb))
+      ret = EXIT_FAILURE;
+  }
+  g_strfreev (counts);
+
+  goto out;
+
+clip_error:
+  g_printerr ("Failed to encode the test clip: %s\n", err->message);
+  g_clear_error (&err);
+  g_free (description);
+
+out:
+  scale_clip_clear (&video);
+  scale_clip_clear (&audio);
+  return ret;
+}
@@ -0,0 +1,810 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For accept4() and pipe2() */
+#define _GNU_SOURCE
+
+#include "mockingest.h"
+#include "../gstftlfec.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PING_HEADER 250         /* second byte of libftl's ping packets */
+#define VIDEO_PAYLOAD_TYPE 96
+#define AUDIO_PAYLOAD_TYPE 97
+#define NONCE_SIZE 64
+#define MAX_PACKET_SIZE 2048
+/* Received video packets kept for rebuilding lost ones from parity */
+#define HISTORY_SIZE 64
+/* How long lost packets wait for parity before getting NACKed */
+#define FEC_WAIT_PACKETS 32
+
+typedef struct
+{
+  gint fd;
+  GString *buffer;
+} MockIngestClient;
+
+typedef struct
+{
+  MockIngestStreamStats stats;
+
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  gboolean have_seq;
+  guint16 next_seq;
+
+  gboolean have_frame;
+  guint32 frame_timestamp;
+  gsize frame_bytes;
+
+  /* Allocated on the first parity packet, indexed by seq % HISTORY_SIZE.
+   * A size of 0 marks a free slot. */
+  guint8 (*history)[MAX_PACKET_SIZE];
+  gsize history_sizes[HISTORY_SIZE];
+  /* Lost sequence numbers waiting for parity, oldest first */
+  GArray *pending;
+} MockIngestStream;
+
+/* A received packet or a reply held back by the injected delay */
+typedef struct
+{
+  gint64 due;
+  gboolean reply;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  gsize size;
+  guint8 data[];
+} MockIngestPacket;
+
+struct _MockIngest
+{
+  MockIngestConfig config;
+  MockIngestFrameFunc func;
+  gpointer user_data;
+
+  gint listen_fd;
+  gint media_fd;
+  gint wake_fds[2];
+  GThread *thread;
+
+  GPtrArray *clients;
+  GQueue delayed;
+  GRand *rand;
+
+  /* Protects stats and the stream stats */
+  GMutex lock;
+  MockIngestStats stats;
+  /* ssrc => MockIngestStream */
+  GHashTable *streams;
+};
+
+static gpointer mock_ingest_thread (gpointer user_data);
+
+static guint16
+read_uint16 (const guint8 * data)
+{
+  return (data[0] << 8) | data[1];
+}
+
+static guint32
+read_uint32 (const guint8 * data)
+{
+  return ((guint32) read_uint16 (data) << 16) | read_uint16 (data + 2);
+}
+
+static void
+write_uint16 (guint8 * data, guint16 value)
+{
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+static void
+write_uint32 (guint8 * data, guint32 value)
+{
+  write_uint16 (data, value >> 16);
+  write_uint16 (data + 2, value);
+}
+
+void
+mock_ingest_config_init (MockIngestConfig * config)
+{
+  memset (config, 0, sizeof (*config));
+  config->port = MOCK_INGEST_DEFAULT_PORT;
+  config->media_port = MOCK_INGEST_DEFAULT_MEDIA_PORT;
+  config->nack = TRUE;
+  config->seed = 1;
+}
+
+static gint
+open_socket (gint type, guint port, GError ** error)
+{
+  struct sockaddr_in addr = { 0, };
+  gint fd, one = 1;
+
+  fd = socket (AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    goto error;
+
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_ANY);
+  addr.sin_port = htons (port);
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    goto error;
+
+  if (type == SOCK_STREAM && listen (fd, 16) < 0)
+    goto error;
+
+  return fd;
+
+error:
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+      "Failed to open %s port %u: %s", type == SOCK_STREAM ? "TCP" : "UDP",
+      port, g_strerror (errno));
+  if (fd >= 0)
+    close (fd);
+  return -1;
+}
+
+static void
+client_free (MockIngestClient * client)
+{
+  close (client->fd);
+  g_string_free (client->buffer, TRUE);
+  g_free (client);
+}
+
+static void
+stream_free (MockIngestStream * stream)
+{
+  g_free (stream->history);
+  if (stream->pending != NULL)
+    g_array_free (stream->pending, TRUE);
+  g_free (stream);
+}
+
+MockIngest *
+mock_ingest_new (const MockIngestConfig * config, MockIngestFrameFunc func,
+    gpointer user_data, GError ** error)
+{
+  MockIngest *mock = g_new0 (MockIngest, 1);
+
+  mock->config = *config;
+  mock->func = func;
+  mock->user_data = user_data;
+  mock->listen_fd = mock->media_fd = -1;
+  mock->wake_fds[0] = mock->wake_fds[1] = -1;
+
+  mock->listen_fd = open_socket (SOCK_STREAM, config->port, error);
+  if (mock->listen_fd < 0)
+    goto error;
+
+  mock->media_fd = open_socket (SOCK_DGRAM, config->media_port, error);
+  if (mock->media_fd < 0)
+    goto error;
+
+  if (pipe2 (mock->wake_fds, O_CLOEXEC) < 0) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Failed to create pipe: %s", g_strerror (errno));
+    goto error;
+  }
+
+  mock->clients = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      client_free);
+  g_queue_init (&mock->delayed);
+  mock->rand = g_rand_new_with_seed (config->seed);
+  g_mutex_init (&mock->lock);
+  mock->streams = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) stream_free);
+
+  mock->thread = g_thread_new ("mockingest", mock_ingest_thread, mock);
+  return mock;
+
+error:
+  if (mock->listen_fd >= 0)
+    close (mock->listen_fd);
+  if (mock->media_fd >= 0)
+    close (mock->media_fd);
+  g_free (mock);
+  return NULL;
+}
+
+void
+mock_ingest_free (MockIngest * mock)
+{
+  if (write (mock->wake_fds[1], "x", 1) < 0)
+    g_warning ("Failed to wake mock ingest: %s", g_strerror (errno));
+  g_thread_join (mock->thread);
+
+  close (mock->listen_fd);
+  close (mock->media_fd);
+  close (mock->wake_fds[0]);
+  close (mock->wake_fds[1]);
+
+  g_ptr_array_unref (mock->clients);
+  g_queue_clear_full (&mock->delayed, g_free);
+  g_rand_free (mock->rand);
+  g_mutex_clear (&mock->lock);
+  g_hash_table_unref (mock->streams);
+  g_free (mock);
+}
+
+void
+mock_ingest_get_stats (MockIngest * mock, MockIngestStats * stats)
+{
+  g_mutex_lock (&mock->lock);
+  *stats = mock->stats;
+  g_mutex_unlock (&mock->lock);
+}
+
+/* Returns an array of MockIngestStreamStats */
+GArray *
+mock_ingest_get_stream_stats (MockIngest * mock)
+{
+  GArray *array = g_array_new (FALSE, FALSE, sizeof (MockIngestStreamStats));
+  GHashTableIter iter;
+  MockIngestStream *stream;
+
+  g_mutex_lock (&mock->lock);
+  g_hash_table_iter_init (&iter, mock->streams);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & stream))
+    g_array_append_val (array, stream->stats);
+  g_mutex_unlock (&mock->lock);
+
+  return array;
+}
+
+/* Sends @data to @addr now, or after the injected delay */
+static void
+send_reply (MockIngest * mock, const guint8 * data, gsize size,
+    const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+  MockIngestPacket *packet;
+
+  if (mock->config.delay_us <= 0) {
+    sendto (mock->media_fd, data, size, 0, (const struct sockaddr *) addr,
+        addr_len);
+    return;
+  }
+
+  packet = g_malloc (sizeof (MockIngestPacket) + size);
+  packet->due = g_get_monotonic_time () + mock->config.delay_us;
+  packet->reply = TRUE;
+  packet->addr = *addr;
+  packet->addr_len = addr_len;
+  packet->size = size;
+  memcpy (packet->data, data, size);
+  g_queue_push_tail (&mock->delayed, packet);
+}
+
+/* Asks for the @count packets starting at @seq, 17 per feedback item */
+static void
+send_nack (MockIngest * mock, MockIngestStream * stream, guint16 seq,
+    guint count)
+{
+  while (count > 0) {
+    guint8 nack[16] = { 0x81, 205, 0, 3, };
+    guint n = MIN (count, 17);
+    guint16 blp = 0;
+
+    for (guint i = 1; i < n; i++)
+      blp |= 1 << (i - 1);
+
+    write_uint32 (nack + 8, stream->stats.ssrc);
+    write_uint16 (nack + 12, seq);
+    write_uint16 (nack + 14, blp);
+
+    send_reply (mock, nack, sizeof (nack), &stream->addr, stream->addr_len);
+    stream->stats.nacks_sent++;
+
+    seq += n;
+    count -= n;
+  }
+}
+
+static MockIngestStream *
+get_stream (MockIngest * mock, guint32 ssrc, MockIngestMedia media)
+{
+  MockIngestStream *stream = g_hash_table_lookup (mock->streams,
+      GUINT_TO_POINTER (ssrc));
+
+  if (stream == NULL) {
+    stream = g_new0 (MockIngestStream, 1);
+    stream->stats.ssrc = ssrc;
+    stream->stats.media = media;
+    g_hash_table_insert (mock->streams, GUINT_TO_POINTER (ssrc), stream);
+  }
+
+  return stream;
+}
+
+static const guint8 *
+history_lookup (MockIngestStream * stream, guint16 seq, gsize * size)
+{
+  guint slot = seq % HISTORY_SIZE;
+
+  if (stream->history_sizes[slot] == 0 ||
+      read_uint16 (stream->history[slot] + 2) != seq)
+    return NULL;
+
+  *size = stream->history_sizes[slot];
+  return stream->history[slot];
+}
+
+static void
+history_store (MockIngestStream * stream, const guint8 * data, gsize size)
+{
+  guint slot = read_uint16 (data + 2) % HISTORY_SIZE;
+
+  memcpy (stream->history[slot], data, size);
+  stream->history_sizes[slot] = size;
+}
+
+/* Returns whether @seq was waiting for parity, and stops waiting */
+static gboolean
+take_pending (MockIngestStream * stream, guint16 seq)
+{
+  for (guint i = 0; i < stream->pending->len; i++) {
+    if (g_array_index (stream->pending, guint16, i) == seq) {
+      g_array_remove_index (stream->pending, i);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* NACKs what waited too long, in case the parity got lost too */
+static void
+expire_pending (MockIngest * mock, MockIngestStream * stream)
+{
+  while (stream->pending->len > 0) {
+    guint16 seq = g_array_index (stream->pending, guint16, 0);
+
+    if ((gint16) (stream->next_seq - seq) <= FEC_WAIT_PACKETS)
+      break;
+
+    g_array_remove_index (stream->pending, 0);
+    if (mock->config.nack)
+      send_nack (mock, stream, seq, 1);
+  }
+}
+
+/* Rebuilds the lost packet of a group if it's the only one, otherwise
+ * NACKs the lost ones. Call with the lock held. */
+static void
+handle_parity (MockIngest * mock, const guint8 * data, gsize size)
+{
+  const guint8 *packets[GST_FTL_FEC_MAX_GROUP_SIZE];
+  gsize sizes[GST_FTL_FEC_MAX_GROUP_SIZE];
+  guint16 missing[GST_FTL_FEC_MAX_GROUP_SIZE];
+  guint8 packet[12 + GST_FTL_FEC_MAX_PROTECTED_SIZE];
+  guint n_packets = 0, n_missing = 0;
+  MockIngestStream *stream;
+  guint16 seq_base, mask;
+  gsize packet_size;
+
+  /* The protected SSRC is the only CSRC */
+  if ((data[0] & 0x0f) != 1 || size < 16)
+    return;
+
+  stream = g_hash_table_lookup (mock->streams,
+      GUINT_TO_POINTER (read_uint32 (data + 12)));
+  if (stream == NULL || stream->stats.media != MOCK_INGEST_VIDEO)
+    return;
+
+  stream->stats.fec_packets++;
+
+  /* Only the next groups can be rebuilt */
+  if (stream->history == NULL) {
+    stream->history = g_malloc (HISTORY_SIZE * sizeof (*stream->history));
+    stream->pending = g_array_new (FALSE, FALSE, sizeof (guint16));
+    return;
+  }
+
+  if (!gst_ftl_fec_parse (data + 16, size - 16, &seq_base, &mask))
+    return;
+
+  for (guint i = 0; i < GST_FTL_FEC_MAX_GROUP_SIZE; i++) {
+    guint16 seq = seq_base + i;
+
+    if (!(mask & (0x8000 >> i)))
+      continue;
+
+    packets[n_packets] = history_lookup (stream, seq, &sizes[n_packets]);
+    if (packets[n_packets] != NULL)
+      n_packets++;
+    else
+      missing[n_missing++] = seq;
+  }
+
+  if (n_missing == 1 && take_pending (stream, missing[0])) {
+    if (gst_ftl_fec_recover (data + 16, size - 16, packets, sizes,
+            n_packets, missing[0], stream->stats.ssrc, packet,
+            &packet_size)) {
+      history_store (stream, packet, packet_size);
+      stream->stats.recovered++;
+    } else if (mock->config.nack) {
+      send_nack (mock, stream, missing[0], 1);
+    }
+    return;
+  }
+
+  for (guint i = 0; i < n_missing; i++)
+    if (take_pending (stream, missing[i]) && mock->config.nack)
+      send_nack (mock, stream, missing[i], 1);
+}
+
+static void
+handle_packet (MockIngest * mock, const guint8 * data, gsize size,
+    const struct sockaddr_storage *addr, socklen_t addr_len, gint64 arrival)
+{
+  MockIngestStream *stream;
+  MockIngestMedia media;
+  guint32 ssrc, timestamp, frame_timestamp = 0;
+  guint16 seq;
+  gsize header, frame_bytes = 0;
+  gboolean marker, complete = FALSE;
+  gint16 diff;
+
+  if (size < 2)
+    return;
+
+  if (data[1] == PING_HEADER) {
+    g_mutex_lock (&mock->lock);
+    mock->stats.pings++;
+    g_mutex_unlock (&mock->lock);
+    send_reply (mock, data, size, addr, addr_len);
+    return;
+  }
+
+  /* RTCP sender reports and the like */
+  if (data[1] >= 192 && data[1] <= 223)
+    return;
+
+  if (size < 12 || (data[0] >> 6) != 2)
+    return;
+
+  if ((data[1] & 0x7f) == GST_FTL_FEC_PAYLOAD_TYPE) {
+    g_mutex_lock (&mock->lock);
+    handle_parity (mock, data, size);
+    g_mutex_unlock (&mock->lock);
+    return;
+  }
+
+  switch (data[1] & 0x7f) {
+    case VIDEO_PAYLOAD_TYPE:
+      media = MOCK_INGEST_VIDEO;
+      break;
+    case AUDIO_PAYLOAD_TYPE:
+      media = MOCK_INGEST_AUDIO;
+      break;
+    default:
+      return;
+  }
+
+  marker = (data[1] & 0x80) != 0;
+  seq = read_uint16 (data + 2);
+  timestamp = read_uint32 (data + 4);
+  ssrc = read_uint32 (data + 8);
+
+  header = 12 + 4 * (data[0] & 0xf);
+  if ((data[0] & 0x10) && header + 4 <= size)
+    header += 4 + 4 * read_uint16 (data + header + 2);
+  if (header > size)
+    return;
+
+  g_mutex_lock (&mock->lock);
+
+  stream = get_stream (mock, ssrc, media);
+  stream->addr = *addr;
+  stream->addr_len = addr_len;
+  stream->stats.packets++;
+  stream->stats.bytes += size - header;
+
+  if (stream->history != NULL)
+    history_store (stream, data, size);
+
+  diff = stream->have_seq ? (gint16) (seq - stream->next_seq) : 0;
+
+  if (diff < 0) {
+    /* Retransmitted or reordered, too late for its frame */
+    stream->stats.late++;
+    if (stream->pending != NULL)
+      take_pending (stream, seq);
+    g_mutex_unlock (&mock->lock);
+    return;
+  }
+
+  if (diff > 0) {
+    stream->stats.lost += diff;
+    if (stream->pending != NULL && diff <= FEC_WAIT_PACKETS) {
+      for (gint16 i = 0; i < diff; i++) {
+        guint16 lost = stream->next_seq + i;
+        g_array_append_val (stream->pending, lost);
+      }
+    } else if (mock->config.nack) {
+      send_nack (mock, stream, stream->next_seq, diff);
+    }
+  }
+
+  stream->have_seq = TRUE;
+  stream->next_seq = seq + 1;
+
+  if (stream->pending != NULL)
+    expire_pending (mock, stream);
+
+  /* A frame whose last packet got lost ends where the next one starts */
+  if (stream->have_frame && stream->frame_timestamp != timestamp) {
+    frame_timestamp = stream->frame_timestamp;
+    frame_bytes = stream->frame_bytes;
+    complete = TRUE;
+    stream->have_frame = FALSE;
+    stream->stats.frames++;
+  }
+
+  stream->frame_bytes = (stream->have_frame ? stream->frame_bytes : 0) +
+      size - header;
+  stream->frame_timestamp = timestamp;
+  stream->have_frame = TRUE;
+
+  g_mutex_unlock (&mock->lock);
+
+  if (complete && mock->func != NULL)
+    mock->func (ssrc, media, frame_timestamp, arrival, frame_bytes,
+        mock->user_data);
+
+  /* Every audio packet is a frame */
+  if (marker || media == MOCK_INGEST_AUDIO) {
+    g_mutex_lock (&mock->lock);
+    frame_bytes = stream->frame_bytes;
+    stream->have_frame = FALSE;
+    stream->stats.frames++;
+    g_mutex_unlock (&mock->lock);
+
+    if (mock->func != NULL)
+      mock->func (ssrc, media, timestamp, arrival, frame_bytes,
+          mock->user_data);
+  }
+}
+
+static void
+receive_packets (MockIngest * mock)
+{
+  guint8 data[MAX_PACKET_SIZE];
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  gssize size;
+
+  for (;;) {
+    addr_len = sizeof (addr);
+    size = recvfrom (mock->media_fd, data, sizeof (data), 0,
+        (struct sockaddr *) &addr, &addr_len);
+    if (size < 0)
+      break;
+
+    if (mock->config.loss > 0 &&
+        g_rand_double (mock->rand) < mock->config.loss) {
+      g_mutex_lock (&mock->lock);
+      mock->stats.dropped++;
+      g_mutex_unlock (&mock->lock);
+      continue;
+    }
+
+    if (mock->config.delay_us > 0) {
+      MockIngestPacket *packet = g_malloc (sizeof (MockIngestPacket) + size);
+
+      packet->due = g_get_monotonic_time () + mock->config.delay_us;
+      packet->reply = FALSE;
+      packet->addr = addr;
+      packet->addr_len = addr_len;
+      packet->size = size;
+      memcpy (packet->data, data, size);
+      g_queue_push_tail (&mock->delayed, packet);
+      continue;
+    }
+
+    handle_packet (mock, data, size, &addr, addr_len, g_get_monotonic_time ());
+  }
+}
+
+/* The delay is constant, so the queue is in due order */
+static void
+process_delayed (MockIngest * mock)
+{
+  gint64 now = g_get_monotonic_time ();
+  MockIngestPacket *packet;
+
+  while ((packet = g_queue_peek_head (&mock->delayed)) != NULL &&
+      packet->due <= now) {
+    g_queue_pop_head (&mock->delayed);
+
+    if (packet->reply)
+      sendto (mock->media_fd, packet->data, packet->size, 0,
+          (struct sockaddr *) &packet->addr, packet->addr_len);
+    else
+      handle_packet (mock, packet->data, packet->size, &packet->addr,
+          packet->addr_len, packet->due);
+
+    g_free (packet);
+  }
+}
+
+static void
+client_reply (MockIngestClient * client, const gchar * reply)
+{
+  if (send (client->fd, reply, strlen (reply), MSG_NOSIGNAL) < 0)
+    g_warning ("Failed to reply to client: %s", g_strerror (errno));
+}
+
+/* Returns FALSE if the client should be dropped */
+static gboolean
+handle_command (MockIngest * mock, MockIngestClient * client,
+    const gchar * command)
+{
+  if (g_str_equal (command, "HMAC")) {
+    GString *reply = g_string_new ("200 ");
+
+    for (guint i = 0; i < NONCE_SIZE; i++)
+      g_string_append_printf (reply, "%02x", g_rand_int_range (mock->rand, 0,
+              256));
+    g_string_append_c (reply, '\n');
+
+    client_reply (client, reply->str);
+    g_string_free (reply, TRUE);
+  } else if (g_str_has_prefix (command, "CONNECT ")) {
+    /* Any HMAC will do */
+    client_reply (client, "200\n");
+
+    g_mutex_lock (&mock->lock);
+    mock->stats.connections++;
+    g_mutex_unlock (&mock->lock);
+  } else if (g_str_equal (command, ".")) {
+    gchar *reply = g_strdup_printf ("200 hi. Use UDP port %u\n",
+        mock->config.media_port);
+
+    client_reply (client, reply);
+    g_free (reply);
+  } else if (g_str_has_prefix (command, "PING")) {
+    client_reply (client, "201\n");
+  } else if (g_str_equal (command, "DISCONNECT")) {
+    return FALSE;
+  }
+
+  /* Anything else is a stream attribute, which gets no reply */
+  return TRUE;
+}
+
+/* Returns FALSE if the client should be dropped */
+static gboolean
+read_client (MockIngest * mock, MockIngestClient * client)
+{
+  gchar data[1024];
+  gssize size;
+  gchar *end;
+
+  size = recv (client->fd, data, sizeof (data), 0);
+  if (size <= 0)
+    return size < 0 && errno == EAGAIN;
+
+  g_string_append_len (client->buffer, data, size);
+
+  /* Commands end with an empty line */
+  while ((end = strstr (client->buffer->str, "\r\n\r\n")) != NULL) {
+    gchar *command = g_strndup (client->buffer->str,
+        end - client->buffer->str);
+    gboolean keep = handle_command (mock, client, command);
+
+    g_free (command);
+    g_string_erase (client->buffer, 0, end + 4 - client->buffer->str);
+
+    if (!keep)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gint
+get_poll_timeout (MockIngest * mock)
+{
+  MockIngestPacket *packet = g_queue_peek_head (&mock->delayed);
+  gint64 wait;
+
+  if (packet == NULL)
+    return -1;
+
+  wait = packet->due - g_get_monotonic_time ();
+  return wait > 0 ? (gint) ((wait + 999) / 1000) : 0;
+}
+
+static gpointer
+mock_ingest_thread (gpointer user_data)
+{
+  MockIngest *mock = user_data;
+  GArray *fds = g_array_new (FALSE, FALSE, sizeof (struct pollfd));
+
+  for (;;) {
+    struct pollfd pfd = { 0, POLLIN, 0 };
+
+    g_array_set_size (fds, 0);
+    pfd.fd = mock->wake_fds[0];
+    g_array_append_val (fds, pfd);
+    pfd.fd = mock->listen_fd;
+    g_array_append_val (fds, pfd);
+    pfd.fd = mock->media_fd;
+    g_array_append_val (fds, pfd);
+    for (guint i = 0; i < mock->clients->len; i++) {
+      MockIngestClient *client = g_ptr_array_index (mock->clients, i);
+      pfd.fd = client->fd;
+      g_array_append_val (fds, pfd);
+    }
+
+    if (poll ((struct pollfd *) fds->data, fds->len,
+            get_poll_timeout (mock)) < 0 && errno != EINTR)
+      break;
+
+    if (g_array_index (fds, struct pollfd, 0).revents)
+      break;
+
+    if (g_array_index (fds, struct pollfd, 1).revents) {
+      gint fd = accept4 (mock->listen_fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (fd >= 0) {
+        MockIngestClient *client = g_new0 (MockIngestClient, 1);
+        client->fd = fd;
+        client->buffer = g_string_new (NULL);
+        g_ptr_array_add (mock->clients, client);
+      }
+    }
+
+    if (g_array_index (fds, struct pollfd, 2).revents)
+      receive_packets (mock);
+
+    /* Walk backwards, the array shrinks */
+    for (guint i = fds->len - 1; i >= 3; i--) {
+      MockIngestClient *client = g_ptr_array_index (mock->clients, i - 3);
+
+      if (g_array_index (fds, struct pollfd, i).revents &&
+          !read_client (mock, client))
+        g_ptr_array_remove_index (mock->clients, i - 3);
+    }
+
+    process_delayed (mock);
+  }
+
+  g_array_free (fds, TRUE);
+  return NULL;
+}
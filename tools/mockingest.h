@@ -0,0 +1,105 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A minimal stand-in for an FTL ingest, for testing and benchmarking
+ * ftlsink without a live Mixer-style service.
+ *
+ * It speaks the TCP handshake well enough for libftl (any stream key is
+ * accepted), receives RTP on a UDP port, echoes libftl's pings and can
+ * send generic NACKs for missing packets. Once a video stream comes with
+ * ftlsink's XOR parity, lost packets are rebuilt from it where possible
+ * and only NACKed if that fails. Packet loss and a one-way delay can be
+ * injected on the receive side.
+ */
+
+#ifndef _MOCK_INGEST_H_
+#define _MOCK_INGEST_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MOCK_INGEST_DEFAULT_PORT 8084
+#define MOCK_INGEST_DEFAULT_MEDIA_PORT 8082
+
+typedef enum
+{
+  MOCK_INGEST_AUDIO,
+  MOCK_INGEST_VIDEO,
+} MockIngestMedia;
+
+typedef struct
+{
+  guint port;
+  guint media_port;
+  /* Probability of dropping each received packet */
+  gdouble loss;
+  /* Added to every received packet and to every reply */
+  gint64 delay_us;
+  gboolean nack;
+  guint32 seed;
+} MockIngestConfig;
+
+typedef struct
+{
+  guint32 ssrc;
+  MockIngestMedia media;
+  guint64 packets;
+  guint64 bytes;
+  guint64 frames;
+  guint64 lost;
+  guint64 late;
+  guint64 nacks_sent;
+  guint64 fec_packets;
+  guint64 recovered;
+} MockIngestStreamStats;
+
+typedef struct
+{
+  guint64 connections;
+  guint64 pings;
+  guint64 dropped;
+} MockIngestStats;
+
+/* Called from the mock's thread for every complete video frame (RTP
+ * marker bit) and every audio packet. @arrival_us is in
+ * g_get_monotonic_time() units. */
+typedef void (*MockIngestFrameFunc) (guint32 ssrc, MockIngestMedia media,
+    guint32 rtp_timestamp, gint64 arrival_us, gsize bytes,
+    gpointer user_data);
+
+typedef struct _MockIngest MockIngest;
+
+void mock_ingest_config_init (MockIngestConfig * config);
+
+MockIngest * mock_ingest_new (const MockIngestConfig * config,
+    MockIngestFrameFunc func, gpointer user_data, GError ** error);
+void mock_ingest_free (MockIngest * mock);
+
+void mock_ingest_get_stats (MockIngest * mock, MockIngestStats * stats);
+GArray * mock_ingest_get_stream_stats (MockIngest * mock);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,525 @@
+/*
+ * GStreamer
+ * Copyright (C) 2019 Make.TV, Inc. <info@make.tv>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Throughput benchmark for the Annex-B start code scanners in gstftlnalu.c.
+ *
+ * Every scanner is first checked against the original byte-at-a-time
+ * scanner of ftlvideosink on synthetic access units and on a set of
+ * randomized edge cases; a scanner producing different NALU boundaries
+ * makes the benchmark fail. So does the multi-chunk parsing of byte-stream
+ * and length-prefixed access units, split at random points, disagreeing
+ * with parsing them in one piece, and so does an FEC XOR implementation
+ * of gstftlfec.c disagreeing with the scalar one.
+ */
+
+#include "../gstftlfec.h"
+#include "../gstftlnalu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CHUNKS 8
+
+static gint size_kb = 256;
+static gint iterations = 200;
+static gint seed = 1;
+
+static GOptionEntry entries[] = {
+  {"size", 's', 0, G_OPTION_ARG_INT, &size_kb,
+      "Size of the synthetic access unit in KiB", "KB"},
+  {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+      "Number of scans per scanner", "N"},
+  {"seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed", "SEED"},
+  {NULL}
+};
+
+/* The scanner ftlvideosink used before gstftlnalu.c, kept as reference */
+static guint8 *
+reference_next_nalu (guint8 * input, gsize len, gsize * last_len)
+{
+  guint32 start_code = 0xFFFFFFFF;
+
+  for (gsize pos = 0; pos < len; pos++) {
+    start_code = (start_code << 8) | input[pos];
+
+    if ((start_code & 0xFFFFFF) == 1) {
+      if (last_len)
+        *last_len = pos - (start_code == 1 ? 3 : 2);
+      return input + pos + 1;
+    }
+  }
+
+  if (last_len)
+    *last_len = len;
+  return NULL;
+}
+
+/* Same contract as get_next_nalu() in gstftlvideosink.c */
+static guint8 *
+scanner_next_nalu (const GstFtlStartCodeScanner * scanner, guint8 * input,
+    gsize len, gsize * last_len)
+{
+  gsize pos = scanner->find (input, len);
+
+  if (pos == len) {
+    if (last_len)
+      *last_len = len;
+    return NULL;
+  }
+
+  if (last_len)
+    *last_len = (pos > 0 && input[pos - 1] == 0) ? pos - 1 : pos;
+  return input + pos + 3;
+}
+
+static gboolean
+compare_boundaries (const GstFtlStartCodeScanner * scanner, guint8 * data,
+    gsize size)
+{
+  guint8 *ref = data, *got = data;
+  gsize ref_len = 0, got_len = 0;
+
+  do {
+    gsize remaining = size - (ref - data);
+
+    ref = reference_next_nalu (ref, remaining, &ref_len);
+    got = scanner_next_nalu (scanner, got, remaining, &got_len);
+
+    if (ref != got || ref_len != got_len) {
+      g_printerr ("%s: mismatch at offset %" G_GSIZE_FORMAT
+          " of %" G_GSIZE_FORMAT ": expected next %" G_GSSIZE_FORMAT
+          " (len %" G_GSIZE_FORMAT "), got %" G_GSSIZE_FORMAT
+          " (len %" G_GSIZE_FORMAT ")\n", scanner->name,
+          (gsize) (size - remaining), size,
+          ref ? (gssize) (ref - data) : (gssize) - 1, ref_len,
+          got ? (gssize) (got - data) : (gssize) - 1, got_len);
+      return FALSE;
+    }
+  } while (ref != NULL);
+
+  return TRUE;
+}
+
+/* NALU payload with emulation prevention applied, so it never contains a
+ * start code */
+static void
+fill_payload (GRand * rand, guint8 * data, gsize size)
+{
+  guint zeros = 0;
+
+  for (gsize i = 0; i < size; i++) {
+    guint8 byte = g_rand_int (rand);
+
+    /* Encoded slices are mostly entropy-coded noise with the odd zero run */
+    if (g_rand_int_range (rand, 0, 64) == 0)
+      byte = 0;
+
+    if (zeros >= 2 && byte <= 3)
+      byte = 3;
+
+    zeros = byte == 0 ? zeros + 1 : 0;
+    data[i] = byte;
+  }
+}
+
+static gsize
+fill_access_unit (GRand * rand, guint8 * data, gsize size)
+{
+  static const guint8 start_code[] = { 0, 0, 0, 1 };
+  gsize pos = 0;
+
+  while (pos + 64 < size) {
+    gsize nalu_len = g_rand_int_range (rand, 1, 32 * 1024);
+    gsize sc_len = g_rand_boolean (rand) ? 4 : 3;
+
+    nalu_len = MIN (nalu_len, size - pos - 5);
+
+    memcpy (data + pos, start_code + 4 - sc_len, sc_len);
+    pos += sc_len;
+
+    fill_payload (rand, data + pos, nalu_len);
+    /* NALU header with forbidden_zero_bit clear */
+    data[pos] = (data[pos] & 0x7f) | 0x01;
+    pos += nalu_len;
+  }
+
+  return pos;
+}
+
+/* Dense in 0x00 and 0x01 so that start codes of both lengths land at
+ * every offset, including across vector and chunk boundaries */
+static void
+fill_start_codes (GRand * rand, guint8 * data, gsize size)
+{
+  for (gsize i = 0; i < size; i++)
+    data[i] = g_rand_int_range (rand, 0, 4) == 0 ? 1 :
+        g_rand_int_range (rand, 0, 3) ? 0 : g_rand_int (rand);
+}
+
+static gboolean
+check_edge_cases (const GstFtlStartCodeScanner * scanner, GRand * rand)
+{
+  guint8 buf[128];
+
+  for (guint round = 0; round < 100000; round++) {
+    gsize len = g_rand_int_range (rand, 0, sizeof (buf) + 1);
+
+    fill_start_codes (rand, buf, len);
+
+    if (!compare_boundaries (scanner, buf, len))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Copies @data into separately allocated chunks split at random points,
+ * with plenty of empty and 1-byte ones */
+static guint
+split_chunks (GRand * rand, const guint8 * data, gsize size,
+    GstFtlNaluChunk * chunks)
+{
+  guint n_chunks = g_rand_int_range (rand, 1, MAX_CHUNKS + 1);
+  gsize pos = 0;
+
+  for (guint i = 0; i < n_chunks; i++) {
+    gsize len = size - pos;
+    guint8 *copy;
+
+    if (i < n_chunks - 1) {
+      switch (g_rand_int_range (rand, 0, 4)) {
+        case 0:
+          len = 0;
+          break;
+        case 1:
+          len = MIN (len, 1);
+          break;
+        default:
+          len = g_rand_int_range (rand, 0, len + 1);
+          break;
+      }
+    }
+
+    copy = g_malloc (MAX (len, 1));
+    memcpy (copy, data + pos, len);
+    chunks[i].data = copy;
+    chunks[i].size = len;
+    pos += len;
+  }
+
+  return n_chunks;
+}
+
+static void
+free_chunks (GstFtlNaluChunk * chunks, guint n_chunks)
+{
+  for (guint i = 0; i < n_chunks; i++)
+    g_free ((guint8 *) chunks[i].data);
+}
+
+static gboolean
+compare_nalus (const gchar * format, guint round, GArray * expected,
+    GArray * got, const guint8 * data)
+{
+  if (expected->len != got->len) {
+    g_printerr ("%s chunks, round %u: expected %u NALUs, got %u\n", format,
+        round, expected->len, got->len);
+    return FALSE;
+  }
+
+  for (guint i = 0; i < expected->len; i++) {
+    GstFtlNalu *want = &g_array_index (expected, GstFtlNalu, i);
+    GstFtlNalu *have = &g_array_index (got, GstFtlNalu, i);
+
+    if (want->offset != have->offset || want->size != have->size ||
+        want->type != have->type || want->ref_idc != have->ref_idc ||
+        (have->data != NULL &&
+            memcmp (have->data, data + want->offset, want->size) != 0)) {
+      g_printerr ("%s chunks, round %u: NALU %u differs: expected offset %"
+          G_GSIZE_FORMAT " size %" G_GSIZE_FORMAT " type %u, got offset %"
+          G_GSIZE_FORMAT " size %" G_GSIZE_FORMAT " type %u\n", format,
+          round, i, want->offset, want->size, want->type, have->offset,
+          have->size, have->type);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Re-encodes the NALUs of a byte-stream access unit with length prefixes */
+static gsize
+make_avc (const guint8 * data, GArray * nalus, guint nal_length_size,
+    guint8 * avc)
+{
+  gsize pos = 0;
+
+  for (guint i = 0; i < nalus->len; i++) {
+    GstFtlNalu *nalu = &g_array_index (nalus, GstFtlNalu, i);
+
+    for (guint j = nal_length_size; j > 0; j--)
+      avc[pos++] = nalu->size >> (8 * (j - 1));
+    memcpy (avc + pos, data + nalu->offset, nalu->size);
+    pos += nalu->size;
+  }
+
+  return pos;
+}
+
+static gboolean
+check_chunked_parsing (GRand * rand)
+{
+  GArray *expected = g_array_new (FALSE, FALSE, sizeof (GstFtlNalu));
+  GArray *got = g_array_new (FALSE, FALSE, sizeof (GstFtlNalu));
+  GstFtlNaluChunk chunks[MAX_CHUNKS];
+  guint8 *data = g_malloc (8 * 1024);
+  /* A 1-byte length prefix per data byte at worst */
+  guint8 *avc = g_malloc (2 * 8 * 1024);
+  gboolean ok = TRUE;
+
+  for (guint round = 0; ok && round < 20000; round++) {
+    gsize size, avc_size, max_nalu = 0;
+    guint n_chunks, nal_length_size;
+
+    if (g_rand_boolean (rand)) {
+      size = g_rand_int_range (rand, 0, 129);
+      fill_start_codes (rand, data, size);
+    } else {
+      size = fill_access_unit (rand, data, g_rand_int_range (rand, 65,
+              8 * 1024));
+    }
+
+    g_array_set_size (expected, 0);
+    g_array_set_size (got, 0);
+    gst_ftl_nalu_parse_byte_stream (data, size, expected);
+    n_chunks = split_chunks (rand, data, size, chunks);
+    gst_ftl_nalu_parse_byte_stream_chunks (chunks, n_chunks, got);
+    ok = compare_nalus ("byte-stream", round, expected, got, data);
+    free_chunks (chunks, n_chunks);
+
+    /* The same NALUs with the shortest length prefix that fits them */
+    for (guint i = 0; i < expected->len; i++)
+      max_nalu = MAX (max_nalu, g_array_index (expected, GstFtlNalu, i).size);
+    nal_length_size = g_rand_int_range (rand, 1, 5);
+    while (nal_length_size < 4 && max_nalu >> (8 * nal_length_size) != 0)
+      nal_length_size++;
+
+    avc_size = make_avc (data, expected, nal_length_size, avc);
+    g_array_set_size (expected, 0);
+    g_array_set_size (got, 0);
+    if (ok && !gst_ftl_nalu_parse_avc (avc, avc_size, nal_length_size,
+            expected)) {
+      g_printerr ("avc, round %u: failed to parse\n", round);
+      ok = FALSE;
+    }
+
+    n_chunks = split_chunks (rand, avc, avc_size, chunks);
+    if (ok && !gst_ftl_nalu_parse_avc_chunks (chunks, n_chunks,
+            nal_length_size, got)) {
+      g_printerr ("avc chunks, round %u: failed to parse\n", round);
+      ok = FALSE;
+    }
+    ok = ok && compare_nalus ("avc", round, expected, got, avc);
+    free_chunks (chunks, n_chunks);
+  }
+
+  g_free (avc);
+  g_free (data);
+  g_array_free (got, TRUE);
+  g_array_free (expected, TRUE);
+
+  return ok;
+}
+
+/* XORs random sizes at random alignments with @impl and with the scalar
+ * implementation, which comes last, including the bytes around them */
+static gboolean
+check_xor (const GstFtlFecXorImpl * impl, const GstFtlFecXorImpl * scalar,
+    GRand * rand)
+{
+  gsize buf_size = GST_FTL_FEC_MAX_PROTECTED_SIZE + 64;
+  guint8 *src = g_malloc (buf_size);
+  guint8 *expected = g_malloc (buf_size);
+  guint8 *got = g_malloc (buf_size);
+  gboolean ok = TRUE;
+
+  for (guint round = 0; ok && round < 20000; round++) {
+    gsize size = g_rand_int_range (rand, 0,
+        GST_FTL_FEC_MAX_PROTECTED_SIZE + 1);
+    gsize dst_offset = g_rand_int_range (rand, 0, 32);
+    gsize src_offset = g_rand_int_range (rand, 0, 32);
+
+    fill_payload (rand, src, buf_size);
+    fill_payload (rand, expected, buf_size);
+    memcpy (got, expected, buf_size);
+
+    scalar->xor (expected + dst_offset, src + src_offset, size);
+    impl->xor (got + dst_offset, src + src_offset, size);
+
+    if (memcmp (expected, got, buf_size) != 0) {
+      g_printerr ("%s XOR, round %u: differs from %s (size %" G_GSIZE_FORMAT
+          ", offsets %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT ")\n", impl->name,
+          round, scalar->name, size, dst_offset, src_offset);
+      ok = FALSE;
+    }
+  }
+
+  g_free (got);
+  g_free (expected);
+  g_free (src);
+
+  return ok;
+}
+
+static gboolean
+check_xor_impls (GRand * rand)
+{
+  const GstFtlFecXorImpl *impls;
+  gboolean ok = TRUE;
+  guint n_impls;
+
+  impls = gst_ftl_fec_get_xor_impls (&n_impls);
+
+  for (guint i = 0; i + 1 < n_impls; i++) {
+    if (!impls[i].supported ()) {
+      g_print ("%s XOR unsupported\n", impls[i].name);
+      continue;
+    }
+
+    if (check_xor (&impls[i], &impls[n_impls - 1], rand))
+      g_print ("%s XOR matches %s\n", impls[i].name, impls[n_impls - 1].name);
+    else
+      ok = FALSE;
+  }
+
+  return ok;
+}
+
+static guint
+walk_nalus (const GstFtlStartCodeScanner * scanner, guint8 * data, gsize size)
+{
+  guint8 *end = data + size;
+  guint num_nalus = 0;
+
+  if (scanner == NULL) {
+    data = reference_next_nalu (data, size, NULL);
+    while (data != NULL) {
+      data = reference_next_nalu (data, end - data, NULL);
+      num_nalus++;
+    }
+    return num_nalus;
+  }
+
+  data = scanner_next_nalu (scanner, data, size, NULL);
+  while (data != NULL) {
+    data = scanner_next_nalu (scanner, data, end - data, NULL);
+    num_nalus++;
+  }
+
+  return num_nalus;
+}
+
+static void
+run_benchmark (const GstFtlStartCodeScanner * scanner, guint8 * data,
+    gsize size)
+{
+  gint64 start, elapsed;
+  guint num_nalus = 0;
+
+  start = g_get_monotonic_time ();
+  for (gint iter = 0; iter < iterations; iter++)
+    num_nalus = walk_nalus (scanner, data, size);
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  g_print ("%-10s %8u %12.1f\n", scanner ? scanner->name : "reference",
+      num_nalus, (gdouble) size * iterations / elapsed * G_USEC_PER_SEC /
+      (1024 * 1024));
+}
+
+int
+main (int argc, char *argv[])
+{
+  const GstFtlStartCodeScanner *scanners;
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GRand *rand;
+  guint8 *data;
+  gsize size;
+  guint n_scanners;
+  gboolean ok = TRUE;
+
+  ctx = g_option_context_new ("- benchmark start code scanners");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  gst_ftl_nalu_init ();
+  scanners = gst_ftl_nalu_get_scanners (&n_scanners);
+  rand = g_rand_new_with_seed (seed);
+
+  size = (gsize) MAX (size_kb, 1) * 1024;
+  data = g_malloc (size);
+  size = fill_access_unit (rand, data, size);
+
+  g_print ("%" G_GSIZE_FORMAT " byte access unit, %d iterations, "
+      "plugin would use '%s'\n\n", size, iterations,
+      gst_ftl_nalu_get_scanner_name ());
+  g_print ("%-10s %8s %12s\n", "scanner", "NALUs", "MiB/s");
+  run_benchmark (NULL, data, size);
+
+  for (guint i = 0; i < n_scanners; i++) {
+    const GstFtlStartCodeScanner *scanner = &scanners[i];
+
+    if (!scanner->supported ()) {
+      g_print ("%-10s %8s %12s\n", scanner->name, "-", "unsupported");
+      continue;
+    }
+
+    if (!compare_boundaries (scanner, data, size) ||
+        !check_edge_cases (scanner, rand)) {
+      ok = FALSE;
+      continue;
+    }
+
+    run_benchmark (scanner, data, size);
+  }
+
+  if (check_chunked_parsing (rand))
+    g_print ("\nchunked parsing matches parsing in one piece\n");
+  else
+    ok = FALSE;
+
+  if (!check_xor_impls (rand))
+    ok = FALSE;
+
+  g_free (data);
+  g_rand_free (rand);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}